@@ -0,0 +1,145 @@
+/*
+ * backend.c
+ *
+ * Source/sink spec parsing, see backend.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+
+#include "backend.h"
+
+//--------------------------------------------------------------------------------------------------
+static int has_prefix(char **spec, const char *prefix)
+{
+  int n = strlen(prefix);
+
+  if (strncmp(*spec, prefix, n))
+    return 0;
+
+  *spec += n;
+  return 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+Source* Source_create(char *spec)
+{
+  Source *s = calloc(1, sizeof(Source));
+
+  if (!s)
+    errx(1, "cannot allocate source");
+
+  if (!strcmp(spec, "-"))
+  {
+    s->dev = "/dev/stdin";
+    Source_initFile(s, 0);
+  }
+  else if (has_prefix(&spec, "file:"))
+  {
+    s->dev = spec;
+    Source_initFile(s, 1);
+  }
+  else if (has_prefix(&spec, "fastfile:"))
+  {
+    s->dev = spec;
+    Source_initFile(s, 0);
+  }
+  else if (has_prefix(&spec, "record:"))
+  {
+    s->dev = spec;
+    Source_initRecord(s);
+  }
+  else if (has_prefix(&spec, "net:"))
+  {
+    s->dev = spec;
+    Source_initNet(s);
+  }
+  else
+  {
+    has_prefix(&spec, "alsa:");
+    s->dev = spec;
+    Source_initAlsa(s);
+  }
+
+  return s;
+}
+
+//--------------------------------------------------------------------------------------------------
+void Source_free(Source *s)
+{
+  if (!s)
+    return;
+
+  s->close(s);
+  free(s);
+}
+
+//--------------------------------------------------------------------------------------------------
+Sink* Sink_create(char *spec, int buffer_time)
+{
+  Sink *s = calloc(1, sizeof(Sink));
+
+  if (!s)
+    errx(1, "cannot allocate sink");
+
+  int ret = 0;
+
+  s->buffer_time = buffer_time;
+
+  if (!strcmp(spec, "-"))
+  {
+    s->dev = "/dev/stdout";
+    ret = Sink_initFile(s);
+  }
+  else if (has_prefix(&spec, "file:"))
+  {
+    s->dev = spec;
+    ret = Sink_initFile(s);
+  }
+  else if (!strcmp(spec, "null"))
+  {
+    s->dev = spec;
+    Sink_initNull(s);
+  }
+  else if (has_prefix(&spec, "rtp:"))
+  {
+    s->dev = spec;
+    Sink_initRtp(s);
+  }
+  else if (has_prefix(&spec, "net:"))
+  {
+    s->dev = spec;
+    Sink_initNet(s);
+  }
+  else
+  {
+    has_prefix(&spec, "alsa:");
+    s->dev = spec;
+    Sink_initAlsa(s);
+  }
+
+  if (ret != 0)
+  {
+    free(s);
+    return NULL;
+  }
+
+  return s;
+}
+
+//--------------------------------------------------------------------------------------------------
+void Sink_free(Sink *s)
+{
+  if (!s)
+    return;
+
+  s->close(s);
+  free(s);
+}
+
+//--------------------------------------------------------------------------------------------------
+int Sink_isOpen(Sink *s)
+{
+  return s->priv != NULL;
+}
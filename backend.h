@@ -0,0 +1,87 @@
+/*
+ * backend.h
+ *
+ * Input sources and output sinks.
+ *
+ *   source spec                  sink spec
+ *   [alsa:]<device>  capture     [alsa:]<device>  playback (default)
+ *   file:<path>      raw S16LE stereo, paced to the 48kHz line rate
+ *   fastfile:<path>  raw S16LE stereo, as fast as the loop reads
+ *   record:<path>    raw input of a recording made with -r
+ *   net:<addr>[:<port>][,opts]   raw input over RTP, see backend_net.c
+ *   -                stdin       -                stdout
+ *                                file:<path>      raw interleaved S16
+ *                                null             discards, paced like a real DAC
+ *                                rtp:<host>[:<port>][,opts]  RTP L16/L24, see backend_rtp.c
+ *                                net:<host>[:<port>]  forwards the raw input to a net: source
+ *
+ * A source delivers the raw IEC 61937 / PCM byte stream, a sink plays
+ * interleaved S16 frames.
+ */
+
+#ifndef BACKEND_H_
+#define BACKEND_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct s_source Source;
+typedef struct s_sink Sink;
+
+struct s_source {
+  const char *type;
+  char *dev;                    // device name or path
+  int finite;                   // AVERROR_EOF ends the loop instead of being an error
+  int sample_rate;              // reported by the device, 0 = unknown (48kHz assumed)
+  int period_time;              // ms, 0 = device default (ALSA only)
+  int pipeline;                 // for status events
+  void *priv;
+
+  void (*open)(Source *s);
+  int  (*read)(Source *s, uint8_t *buf, int buf_size);   // bytes or AVERROR_EOF
+  int  (*skip)(Source *s, int bytes);                    // optional: drop whole frames unread, bytes dropped
+  void (*reset)(Source *s);     // drop everything captured so far
+  void (*close)(Source *s);
+};
+
+struct s_sink {
+  const char *type;
+  char *dev;
+  int buffer_time;              // ms
+  int period_time;              // ms, 0 = device default (ALSA only), the buffer holds at least 3
+  int channels;
+  int sample_rate;
+  int pipeline;
+  double capture_time;          // gettimeofday_ms() when the next frames written were captured, 0 = unknown
+  unsigned xruns;               // output underruns since created, every sink that plays at the sample
+                                // rate (alsa, null) must count them, file:, rtp: and net: never underrun
+  void *priv;
+
+  int  (*open)(Sink *s);                                  // 0 on success
+  ssize_t (*write)(Sink *s, const void *buf, int frames); // frames written, 0 on fatal error
+  int  (*delay)(Sink *s, long *frames);                   // < 0 if unknown
+  void (*prefill)(Sink *s, int frames);                   // optional: frames buffered before playback (re)starts
+  void (*close)(Sink *s);
+};
+
+Source* Source_create(char *spec);
+void Source_free(Source *s);
+
+// NULL if the sink cannot be set up, logged
+Sink* Sink_create(char *spec, int buffer_time);
+void Sink_free(Sink *s);
+
+int Sink_isOpen(Sink *s);
+
+// backend constructors, spec prefix already removed
+void Source_initAlsa(Source *s);
+void Source_initFile(Source *s, int paced);
+void Source_initRecord(Source *s);
+void Source_initNet(Source *s);
+void Sink_initAlsa(Sink *s);
+int  Sink_initFile(Sink *s);     // -1 if the file cannot be created
+void Sink_initNull(Sink *s);
+void Sink_initRtp(Sink *s);
+void Sink_initNet(Sink *s);
+
+#endif /* BACKEND_H_ */
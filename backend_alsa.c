@@ -0,0 +1,412 @@
+/*
+ * backend_alsa.c
+ *
+ * ALSA capture source and playback sink
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <err.h>
+
+#include <alsa/asoundlib.h>
+#include <libavutil/avutil.h>
+
+#include "backend.h"
+#include "myspdif.h"
+#include "log.h"
+#include "status.h"
+#include "hwcache.h"
+#include "fault.h"
+
+extern atomic_int debug_data;
+
+//--------------------------------------------------------------------------------------------------
+// constrain p to the stream format, with cached = {buffer, period} frames the negotiation of the
+// last run is repeated exactly instead of refined from the buffer time again
+static int alsa_hw_params(snd_pcm_t *dev, snd_pcm_hw_params_t *p, int channels, unsigned rate, int buffer_time,
+  int period_time, const int *cached, const char **what, int capture)
+{
+  int err;
+
+  if ((err = snd_pcm_hw_params_any(dev, p)) < 0)
+    return *what = "initialize hw params", err;
+
+  if ((err = snd_pcm_hw_params_set_access(dev, p, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
+    return *what = "set access", err;
+
+  if ((err = snd_pcm_hw_params_set_format(dev, p, SND_PCM_FORMAT_S16)) < 0)
+    return *what = "set format", err;
+
+  // a capture device locked to its S/PDIF input may only offer the rate of the source
+  if ((err = snd_pcm_hw_params_set_rate(dev, p, rate, 0)) < 0 && capture)
+    err = snd_pcm_hw_params_set_rate_near(dev, p, &rate, 0);
+
+  if (err < 0)
+    return *what = "set rate", err;
+
+  if ((err = snd_pcm_hw_params_set_channels(dev, p, channels)) < 0)
+    return *what = "set channels", err;
+
+  if (cached)
+  {
+    if ((err = snd_pcm_hw_params_set_buffer_size(dev, p, cached[0])) < 0)
+      return *what = "set cached buffer size", err;
+
+    if ((err = snd_pcm_hw_params_set_period_size(dev, p, cached[1], 0)) < 0)
+      return *what = "set cached period size", err;
+  }
+  else
+  {
+    unsigned int period_us = period_time * 1000, buffer_us = buffer_time * 1000;
+
+    if (period_time && (err = snd_pcm_hw_params_set_period_time_near(dev, p, &period_us, 0)) < 0)
+      return *what = "set period_time", err;
+
+    if (buffer_time && (err = snd_pcm_hw_params_set_buffer_time_min(dev, p, &buffer_us, 0)) < 0)
+      return *what = "set buffer_time_min", err;
+  }
+
+  if ((err = snd_pcm_hw_params(dev, p)) < 0)
+    return *what = "set params", err;
+
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// rate: the rate the device was opened with, 48000 unless a capture device offers no other. An
+// output is opened at *rate if set, IEC 61937 E-AC-3 bursts play at 192kHz.
+// With period_time the device wakes up once per period of that length, the buffer holds three.
+// NULL if the device cannot be opened for the format, logged: a running pipeline keeps its output.
+static snd_pcm_t* alsa_open(char* dev_name, int channels, int buffer_time, int period_time, int *rate)
+{
+	snd_pcm_hw_params_t *p = NULL;
+  snd_pcm_t *dev = NULL;
+  int output = channels != 0;
+  int err, cached[2];
+  char key[HWCACHE_KEY_SIZE];
+  const char *what = NULL;
+  double start;
+
+  if(debug_data)
+    start = gettimeofday_ms();
+
+	if ((err = snd_pcm_open(&dev, dev_name, output ? SND_PCM_STREAM_PLAYBACK : SND_PCM_STREAM_CAPTURE, 0)) < 0)
+  {
+		log_printf("alsa error: failed to open device %s: %s\n", dev_name, snd_strerror(err));
+    return NULL;
+  }
+
+	if ((err = snd_pcm_hw_params_malloc(&p)) < 0)
+		errx(1, "alsa error: failed to allocate hw params: %s", snd_strerror(err));
+
+  unsigned wanted = output && *rate ? *rate : 48000;
+
+  if (!output)
+    channels = 2;
+
+  if (period_time && buffer_time < 3 * period_time)
+    buffer_time = 3 * period_time;
+
+  if(debug_data)
+    log_printf("alse open %s, channels=%d\n", output ? "output" : "input", channels);
+
+  snprintf(key, sizeof(key), "alsa %s %s %d %u %d %d", output ? "playback" : "capture", dev_name, channels, wanted, buffer_time, period_time);
+
+  int haveCache = hwcache_get(key, cached, 2) == 0;
+
+  if (haveCache && (err = alsa_hw_params(dev, p, channels, wanted, buffer_time, period_time, cached, &what, !output)) < 0)
+  {
+    log_printf("alsa: cached hw params for %s not accepted (%s: %s), negotiating\n", dev_name, what, snd_strerror(err));
+    haveCache = 0;
+  }
+
+  if (!haveCache && (err = alsa_hw_params(dev, p, channels, wanted, buffer_time, period_time, NULL, &what, !output)) < 0)
+  {
+    if (output && buffer_time && !strcmp(what, "set buffer_time_min"))
+      log_printf("alsa error: cannot set %s buffer_time_min %d: %s\n", dev_name, buffer_time, snd_strerror(err));
+    else
+      log_printf("alsa error: %s failed to %s (channels %d): %s\n", dev_name, what, channels, snd_strerror(err));
+
+    snd_pcm_hw_params_free(p);
+    snd_pcm_close(dev);
+    return NULL;
+  }
+
+  snd_pcm_uframes_t buffer, period;
+  unsigned actual;
+
+  *rate = snd_pcm_hw_params_get_rate(p, &actual, 0) == 0 ? actual : (int)wanted;
+
+  if (*rate != 48000)
+    log_printf("alsa: %s runs at %d Hz\n", dev_name, *rate);
+
+  if (!haveCache &&
+      snd_pcm_hw_params_get_buffer_size(p, &buffer) == 0 &&
+      snd_pcm_hw_params_get_period_size(p, &period, 0) == 0)
+    hwcache_put(key, (int[]){buffer, period}, 2);
+
+	snd_pcm_hw_params_free(p);
+
+  if(debug_data)
+    log_printf("alse open %s, channels=%d%s in %.1lf ms\n", dev_name, channels, haveCache ? " (cached params)" : "", gettimeofday_ms() - start);
+
+  return dev;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void alsa_source_open(Source *s)
+{
+  s->priv = alsa_open(s->dev, 0, 0, s->period_time, &s->sample_rate);
+
+  if (!s->priv)
+    errx(1, "cannot open input %s", s->dev);
+}
+
+//--------------------------------------------------------------------------------------------------
+static int alsa_source_read(Source *s, uint8_t *buf, int buf_size)
+{
+	snd_pcm_t *dev = s->priv;
+
+	if (snd_pcm_state(dev) == SND_PCM_STATE_SETUP)
+  {
+  	int err = snd_pcm_prepare(dev);
+
+	  if(err < 0)
+    {
+      log_printf("error: alsa failed to prepare input device: %s", snd_strerror(err));
+      return AVERROR_EOF;
+    }
+
+    if(debug_data)
+      log_printf("alsa input prepared\n");
+  }
+
+  int frames = buf_size / 4;
+
+	while(1)
+  {
+    ssize_t n = fault_fire(FAULT_XRUN_IN, NULL) ? -EPIPE : snd_pcm_readi(dev, (char *) buf, frames);
+
+    if(n >= 0)
+      return n * 4;
+
+    if (n == -EPIPE)
+    {
+      log_printf("warning: alsa input overrun occurred\n");
+      status_post_xrun(s->pipeline, 0);
+    }
+    else
+      log_printf("warning: alsa input %s\n", snd_strerror(n));
+
+    n = snd_pcm_recover(dev, n, 1);
+
+    if (n < 0)
+    {
+      log_printf("error: alsa input recover failed %s\n", snd_strerror(n));
+      return AVERROR_EOF;
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// the capture ring is advanced over the frames, they are never copied out. Only frames already
+// captured can be forwarded, the rest is waited for.
+static int alsa_source_skip(Source *s, int bytes)
+{
+	snd_pcm_t *dev = s->priv;
+  snd_pcm_sframes_t left = bytes / 4;
+
+  // the first read starts the capture
+  if (snd_pcm_state(dev) != SND_PCM_STATE_RUNNING)
+    return 0;
+
+  while (left > 0)
+  {
+    snd_pcm_sframes_t n = snd_pcm_avail(dev);
+
+    if (n == 0)
+    {
+      if ((n = snd_pcm_wait(dev, 1000)) == 0)
+        break;
+
+      if (n > 0)
+        continue;
+    }
+    else if (n > 0 && (n = snd_pcm_forward(dev, n < left ? n : left)) == 0)
+      break;
+
+    if (n == -EPIPE)
+    {
+      log_printf("warning: alsa input overrun occurred\n");
+      status_post_xrun(s->pipeline, 0);
+
+      // prepared again, the next read restarts the capture
+      if ((n = snd_pcm_recover(dev, n, 1)) < 0)
+        log_printf("error: alsa input recover failed %s\n", snd_strerror(n));
+      break;
+    }
+
+    // the rest is read
+    if (n < 0)
+    {
+      log_printf("warning: alsa input skip %s\n", snd_strerror(n));
+      break;
+    }
+
+    left -= n;
+  }
+
+  return (bytes / 4 - left) * 4;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void alsa_source_close(Source *s)
+{
+  if (!s->priv)
+    return;
+
+ 	snd_pcm_close(s->priv);
+  s->priv = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void alsa_source_reset(Source *s)
+{
+  // snd_pcm_drain(dev); // long delay !?
+
+  alsa_source_close(s);
+  alsa_source_open(s);
+}
+
+//--------------------------------------------------------------------------------------------------
+void Source_initAlsa(Source *s)
+{
+  s->type  = "alsa";
+  s->open  = alsa_source_open;
+  s->read  = alsa_source_read;
+  s->skip  = alsa_source_skip;
+  s->reset = alsa_source_reset;
+  s->close = alsa_source_close;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int alsa_sink_open(Sink *s)
+{
+  int rate = s->sample_rate;
+
+  s->priv = alsa_open(s->dev, s->channels, s->buffer_time, s->period_time, &rate);
+
+  return s->priv ? 0 : -1;
+}
+
+//--------------------------------------------------------------------------------------------------
+static ssize_t alsa_sink_write(Sink *s, const void *buf, int frames)
+{
+	snd_pcm_t *dev = s->priv;
+	ssize_t n;
+
+	if (snd_pcm_state(dev) == SND_PCM_STATE_SETUP)
+  {
+  	int err = snd_pcm_prepare(dev);
+
+	  if(err < 0)
+    {
+      log_printf("error: alsa failed to prepare output device: %s\n", snd_strerror(err));
+      return 0;
+    }
+
+    if(debug_data)
+      log_printf("alsa output prepared\n");
+  }
+
+  while(1)
+  {
+    n = fault_fire(FAULT_XRUN_OUT, NULL) ? -EPIPE : snd_pcm_writei(dev, buf, frames);
+
+    if(n >= 0)
+      return n;
+
+    if (n == -EPIPE)
+    {
+      log_printf("warning: alsa output underrun occurred\n");
+      status_post_xrun(s->pipeline, 1);
+      s->xruns++;
+    }
+    else
+      log_printf("warning: alsa output %s\n", snd_strerror(n));
+
+    n = snd_pcm_recover(dev, n, 1);
+
+    if (n < 0)
+    {
+      log_printf("error: alsa output recover failed %s\n", snd_strerror(n));
+      return 0;
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+static int alsa_sink_delay(Sink *s, long *frames)
+{
+  snd_pcm_sframes_t delay;
+  int err;
+
+  if ((err = snd_pcm_delay(s->priv, &delay)) < 0)
+  {
+    log_printf("alsa error: failed to get output latency: %s\n", snd_strerror(err));
+    return err;
+  }
+
+  *frames = delay;
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// start threshold, also applies when snd_pcm_recover() restarts after an underrun
+static void alsa_sink_prefill(Sink *s, int frames)
+{
+  snd_pcm_t *dev = s->priv;
+  snd_pcm_sw_params_t *sw;
+  snd_pcm_uframes_t buffer, period;
+  int err;
+
+  // a threshold above the buffer size never starts
+  if (snd_pcm_get_params(dev, &buffer, &period) == 0 && frames > (int)buffer)
+    frames = buffer;
+
+  if (frames < 1)
+    frames = 1;
+
+  if ((err = snd_pcm_sw_params_malloc(&sw)) < 0)
+    errx(1, "alsa error: failed to allocate sw params: %s", snd_strerror(err));
+
+  if ((err = snd_pcm_sw_params_current(dev, sw)) < 0 ||
+      (err = snd_pcm_sw_params_set_start_threshold(dev, sw, frames)) < 0 ||
+      (err = snd_pcm_sw_params(dev, sw)) < 0)
+    log_printf("alsa error: failed to set start threshold %d: %s\n", frames, snd_strerror(err));
+
+  snd_pcm_sw_params_free(sw);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void alsa_sink_close(Sink *s)
+{
+  if (!s->priv)
+    return;
+
+  snd_pcm_close(s->priv);
+  s->priv = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+void Sink_initAlsa(Sink *s)
+{
+  s->type  = "alsa";
+  s->open  = alsa_sink_open;
+  s->write = alsa_sink_write;
+  s->delay = alsa_sink_delay;
+  s->prefill = alsa_sink_prefill;
+  s->close = alsa_sink_close;
+}
@@ -0,0 +1,267 @@
+/*
+ * backend_file.c
+ *
+ * Raw file and pipe source and sink. A paced file source delivers bytes no
+ * faster than a S/PDIF receiver would (48kHz S16 stereo), so the timing
+ * sensitive parts of the loop behave like on real hardware.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#include <libavutil/avutil.h>
+
+#include "backend.h"
+#include "log.h"
+#include "myspdif.h"
+
+#define LINE_RATE_BYTES_PER_MS 192
+
+typedef struct {
+  int fd;
+  int paced;
+  double start;
+  long long consumed;
+} file_source;
+
+//--------------------------------------------------------------------------------------------------
+static int read_full(int fd, uint8_t *buf, int size)
+{
+  int done = 0;
+
+  while (done < size)
+  {
+    ssize_t n = read(fd, buf + done, size - done);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0)
+      break;
+
+    done += n;
+  }
+
+  return done;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void file_source_open(Source *s)
+{
+  file_source *f = calloc(1, sizeof(file_source));
+
+  if (!f)
+    errx(1, "cannot allocate file source");
+
+  f->paced = !strcmp(s->type, "file");
+  f->start = -1;
+  f->fd = !strcmp(s->dev, "/dev/stdin") ? dup(0) : open(s->dev, O_RDONLY | O_CLOEXEC);
+
+  if (f->fd < 0)
+    err(1, "cannot open input %s", s->dev);
+
+  s->priv = f;
+}
+
+//--------------------------------------------------------------------------------------------------
+// block until bytes more have "arrived", like snd_pcm_readi()
+static void file_pace(file_source *f, int bytes)
+{
+  if (!f->paced)
+    return;
+
+  double now = monotonic_ms();
+
+  if (f->start < 0)
+    f->start = now;
+
+  double due = f->start + (double)(f->consumed + bytes) / LINE_RATE_BYTES_PER_MS;
+
+  if (due > now)
+    sleep_ms(due - now);
+}
+
+//--------------------------------------------------------------------------------------------------
+static int file_source_read(Source *s, uint8_t *buf, int buf_size)
+{
+  file_source *f = s->priv;
+
+  buf_size &= ~3;
+
+  file_pace(f, buf_size);
+
+  int n = read_full(f->fd, buf, buf_size) & ~3;
+
+  if (n == 0)
+    return AVERROR_EOF;
+
+  f->consumed += n;
+
+  return n;
+}
+
+//--------------------------------------------------------------------------------------------------
+// a pipe cannot seek, the bytes are read instead
+static int file_source_skip(Source *s, int bytes)
+{
+  file_source *f = s->priv;
+
+  bytes &= ~3;
+  file_pace(f, bytes);
+
+  if (lseek(f->fd, bytes, SEEK_CUR) < 0)
+    return 0;
+
+  f->consumed += bytes;
+
+  return bytes;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void file_source_reset(Source *s)
+{
+  file_source *f = s->priv;
+
+  if (!f->paced || f->start < 0)
+    return;
+
+  // drop what a capture device would have buffered since the last read
+  long long due = (long long)((monotonic_ms() - f->start) * LINE_RATE_BYTES_PER_MS) & ~3LL;
+  long long skip = due - f->consumed;
+
+  if (skip <= 0)
+    return;
+
+  if (lseek(f->fd, skip, SEEK_CUR) < 0)
+  {
+    uint8_t tmp[4096];
+
+    for (long long left = skip; left > 0; )
+    {
+      int n = read_full(f->fd, tmp, left < (long long)sizeof(tmp) ? left : (long long)sizeof(tmp));
+
+      if (n <= 0)
+        break;
+
+      left -= n;
+    }
+  }
+
+  f->consumed = due;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void file_source_close(Source *s)
+{
+  file_source *f = s->priv;
+
+  if (!f)
+    return;
+
+  close(f->fd);
+  free(f);
+  s->priv = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+void Source_initFile(Source *s, int paced)
+{
+  s->type   = paced ? "file" : "fastfile";
+  s->finite = 1;
+  s->open   = file_source_open;
+  s->read   = file_source_read;
+  s->skip   = file_source_skip;
+  s->reset  = file_source_reset;
+  s->close  = file_source_close;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int file_sink_open(Sink *s)
+{
+  int fd = !strcmp(s->dev, "/dev/stdout") ? dup(1) : open(s->dev, O_WRONLY | O_APPEND | O_CLOEXEC);
+
+  if (fd < 0)
+  {
+    log_printf("cannot open output %s: %s\n", s->dev, strerror(errno));
+    return -1;
+  }
+
+  s->priv = (void*)(intptr_t)(fd + 1);
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static ssize_t file_sink_write(Sink *s, const void *buf, int frames)
+{
+  int fd = (intptr_t)s->priv - 1;
+  int size = frames * 2 * s->channels;
+  int done = 0;
+
+  while (done < size)
+  {
+    ssize_t n = write(fd, (const uint8_t*)buf + done, size - done);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0)
+    {
+      log_printf("error: write to %s failed: %s\n", s->dev, strerror(errno));
+      return 0;
+    }
+
+    done += n;
+  }
+
+  return frames;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int file_sink_delay(Sink *s, long *frames)
+{
+  *frames = 0;
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void file_sink_close(Sink *s)
+{
+  if (!s->priv)
+    return;
+
+  close((intptr_t)s->priv - 1);
+  s->priv = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+int Sink_initFile(Sink *s)
+{
+  s->type  = "file";
+  s->open  = file_sink_open;
+  s->write = file_sink_write;
+  s->delay = file_sink_delay;
+  s->close = file_sink_close;
+
+  // the sink is reopened on every channel change, start with an empty file once
+  if (strcmp(s->dev, "/dev/stdout"))
+  {
+    int fd = open(s->dev, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (fd < 0)
+    {
+      log_printf("cannot create output %s: %s\n", s->dev, strerror(errno));
+      return -1;
+    }
+
+    close(fd);
+  }
+
+  return 0;
+}
@@ -0,0 +1,726 @@
+/*
+ * backend_net.c
+ *
+ * Raw input over the network. The net: sink forwards the raw input stream
+ * (the bytes a source returns, IEC 61937 or PCM) as RTP, a packet starts at
+ * every burst preamble and carries the marker bit. The net: source receives
+ * it into an adaptive jitter buffer and delivers it at the line rate like a
+ * capture device. Spec for both:
+ *
+ *   net:<host>[:<port>][,jitter=<ms>]
+ *
+ * jitter is the minimum target delay of the source, the target grows with
+ * the measured network jitter. The delivery rate is trimmed by up to 0.5% to
+ * hold the target against the clock difference of sender and receiver.
+ *
+ * A lost packet damages the whole burst. While that is still unread it is
+ * replaced by the last complete burst and the rest of it is dropped, else
+ * the gap is filled with zeros to keep the demuxer in step (the decoder
+ * conceals the broken frame). Lost PCM is replaced by silence.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <math.h>
+#include <time.h>
+#include <poll.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "backend.h"
+#include "rtp.h"
+#include "log.h"
+#include "myspdif.h"
+#include "status.h"
+
+extern atomic_int debug_data;
+
+#define NET_SLOTS               256           // packets, must be a power of 2
+#define NET_RING_SIZE           (256*1024)    // bytes, must be a power of 2
+#define NET_MAX_BURST           32768
+#define NET_DEFAULT_TARGET_MS   20
+#define NET_MAX_TARGET_MS       200
+#define NET_REORDER_PACKETS     3             // a missing packet is lost once this many later ones arrived
+#define NET_PCM_PACKETS         64            // packets without a marker before the stream counts as PCM
+#define NET_MAX_RATE_TRIM       0.005
+#define NET_STATS_MS            1000
+#define LINE_RATE_BYTES_PER_MS  192
+
+#define SYNC_BYTES              0x72f81f4e    // Pa Pb as captured (little endian)
+
+typedef struct {
+  int used;
+  int marker;
+  uint16_t seq;
+  uint32_t ts;
+  int len;
+  uint8_t data[RTP_MAX_PAYLOAD];
+} net_packet;
+
+typedef struct {
+  int fd;
+
+  // reordering
+  net_packet slots[NET_SLOTS];
+  int packets;
+  uint16_t next_seq, newest_seq;
+  int have_seq;
+  uint32_t next_ts;
+  uint32_t ssrc;
+  int resync;                 // drop until the next burst start
+
+  // released, contiguous stream
+  uint8_t ring[NET_RING_SIZE];
+  uint64_t head, tail;
+  uint64_t burst_start;
+  int have_burst;
+  int since_marker;
+  uint8_t last_burst[NET_MAX_BURST];
+  int last_burst_len;
+
+  // delivery
+  int playing;
+  double last_ms;
+  double credit;              // bytes that may be delivered
+
+  // adaptive target
+  int min_target_ms;
+  double jitter_ms;
+  double last_transit;
+  int have_transit;
+
+  unsigned lost, late, concealed, underruns, overflows;
+  double last_stats;
+} net_source;
+
+//--------------------------------------------------------------------------------------------------
+static int parse_spec(const char *dev, struct sockaddr_in *addr, int *jitter)
+{
+  char spec[256], *save = NULL;
+
+  snprintf(spec, sizeof(spec), "%s", dev);
+
+  char *host = strtok_r(spec, ",", &save);
+  char *port = host ? strrchr(host, ':') : NULL;
+
+  if (!host || !*host)
+    return -1;
+
+  if (port)
+    *port++ = 0;
+
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM}, *res;
+
+  if (getaddrinfo(host, NULL, &hints, &res) != 0)
+  {
+    log_printf("net: cannot resolve %s\n", host);
+    return -1;
+  }
+
+  memcpy(addr, res->ai_addr, sizeof(*addr));
+  freeaddrinfo(res);
+
+  addr->sin_port = htons(port ? atoi(port) : RTP_DEFAULT_PORT);
+
+  for (char *opt; (opt = strtok_r(NULL, ",", &save));)
+  {
+    if (sscanf(opt, "jitter=%d", jitter) == 1 && *jitter > 0 && *jitter <= NET_MAX_TARGET_MS)
+      ;
+    else
+    {
+      log_printf("net: unknown option %s\n", opt);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static double depth_ms(net_source *n)
+{
+  return (n->head - n->tail) / (double)LINE_RATE_BYTES_PER_MS;
+}
+
+//--------------------------------------------------------------------------------------------------
+static double target_ms(net_source *n)
+{
+  double t = 4 * n->jitter_ms;
+
+  if (t < n->min_target_ms)
+    t = n->min_target_ms;
+
+  return t > NET_MAX_TARGET_MS ? NET_MAX_TARGET_MS : t;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void ring_append(net_source *n, const uint8_t *data, int len)
+{
+  if (n->head - n->tail + len > NET_RING_SIZE)
+  {
+    n->tail = n->head + len - NET_RING_SIZE;
+    n->overflows++;
+  }
+
+  for (int done = 0; done < len; )
+  {
+    int off = n->head & (NET_RING_SIZE - 1);
+    int k = len - done < NET_RING_SIZE - off ? len - done : NET_RING_SIZE - off;
+
+    if (data)
+      memcpy(n->ring + off, data + done, k);
+    else
+      memset(n->ring + off, 0, k);
+
+    n->head += k;
+    done += k;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void ring_copy(net_source *n, uint64_t pos, uint8_t *dst, int len)
+{
+  for (int done = 0; done < len; )
+  {
+    int off = (pos + done) & (NET_RING_SIZE - 1);
+    int k = len - done < NET_RING_SIZE - off ? len - done : NET_RING_SIZE - off;
+
+    memcpy(dst + done, n->ring + off, k);
+    done += k;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void release_packet(net_source *n, net_packet *pkt)
+{
+  if (pkt->marker)
+  {
+    // the burst before this one is complete, keep it for concealment
+    uint64_t len = n->head - n->burst_start;
+
+    if (n->have_burst && len <= NET_MAX_BURST && len <= NET_RING_SIZE)
+    {
+      ring_copy(n, n->burst_start, n->last_burst, len);
+      n->last_burst_len = len;
+    }
+
+    n->burst_start = n->head;
+    n->have_burst = 1;
+    n->since_marker = 0;
+  }
+  else if (n->since_marker < NET_PCM_PACKETS)
+    n->since_marker++;
+
+  ring_append(n, pkt->data, pkt->len);
+  n->next_ts = pkt->ts + pkt->len / 4;
+}
+
+//--------------------------------------------------------------------------------------------------
+// packets next_seq .. seq-1 are lost
+static void conceal(net_source *n, uint16_t seq, uint32_t ts)
+{
+  n->lost += (uint16_t)(seq - n->next_seq);
+
+  if (n->resync)
+    return;
+
+  // replace the damaged burst if the reader has not started on it
+  if (n->have_burst && n->since_marker < NET_PCM_PACKETS && n->burst_start >= n->tail && n->last_burst_len)
+  {
+    n->head = n->burst_start;
+    ring_append(n, n->last_burst, n->last_burst_len);
+    n->have_burst = 0;
+    n->resync = 1;
+    n->concealed++;
+    return;
+  }
+
+  int32_t gap = ts - n->next_ts;
+
+  if (gap > 0 && gap < RTP_RATE)
+  {
+    ring_append(n, NULL, gap * 4);
+    n->next_ts = ts;
+    n->concealed++;
+  }
+
+  // the burst cannot serve as concealment for the next one
+  n->have_burst = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// move packets in sequence into the ring, need: bytes the reader is waiting for
+static void release(net_source *n, int need)
+{
+  while (n->packets)
+  {
+    net_packet *pkt = &n->slots[n->next_seq & (NET_SLOTS - 1)];
+
+    if (pkt->used && pkt->seq == n->next_seq)
+    {
+      if (n->resync && !pkt->marker)
+        ;                 // rest of a replaced burst
+      else
+      {
+        n->resync = 0;
+        release_packet(n, pkt);
+      }
+
+      pkt->used = 0;
+      n->packets--;
+      n->next_seq++;
+      continue;
+    }
+
+    int16_t ahead = n->newest_seq - n->next_seq;
+
+    if (ahead < NET_REORDER_PACKETS && (int64_t)(n->head - n->tail) >= need)
+      break;
+
+    // skip to the next packet we have
+    uint16_t seq = n->next_seq;
+
+    while (!(n->slots[seq & (NET_SLOTS - 1)].used && n->slots[seq & (NET_SLOTS - 1)].seq == seq))
+      seq++;
+
+    conceal(n, seq, n->slots[seq & (NET_SLOTS - 1)].ts);
+    n->next_seq = seq;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void reset_sequence(net_source *n)
+{
+  for (int i = 0; i < NET_SLOTS; i++)
+    n->slots[i].used = 0;
+
+  n->packets = 0;
+  n->have_seq = 0;
+  n->have_transit = 0;
+  n->have_burst = 0;
+  n->resync = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void handle_packet(net_source *n, const uint8_t *buf, int len, double now)
+{
+  rtp_header h;
+
+  if (len < RTP_HEADER_SIZE)
+    return;
+
+  memcpy(&h, buf, sizeof(h));
+
+  if (h.vpxcc >> 6 != RTP_VERSION || (h.mpt & 0x7f) != RTP_PT_IEC61937)
+    return;
+
+  int offset = RTP_HEADER_SIZE + (h.vpxcc & 0x0f) * 4;
+  int payload = len - offset;
+
+  if (payload <= 0 || payload > RTP_MAX_PAYLOAD)
+    return;
+
+  uint16_t seq = ntohs(h.seq);
+  uint32_t ts = ntohl(h.timestamp);
+
+  if (ntohl(h.ssrc) != n->ssrc)
+  {
+    log_printf("net: new sender %08x\n", ntohl(h.ssrc));
+    n->ssrc = ntohl(h.ssrc);
+    reset_sequence(n);
+  }
+
+  if (!n->have_seq)
+  {
+    n->next_seq = n->newest_seq = seq;
+    n->have_seq = 1;
+  }
+
+  int16_t diff = seq - n->next_seq;
+
+  if (diff < 0)
+  {
+    n->late++;
+    return;
+  }
+
+  if (diff >= NET_SLOTS)
+  {
+    // long outage, start over
+    reset_sequence(n);
+    n->next_seq = n->newest_seq = seq;
+    n->have_seq = 1;
+  }
+
+  if ((int16_t)(seq - n->newest_seq) > 0)
+    n->newest_seq = seq;
+
+  // RFC 3550 interarrival jitter
+  double transit = now - ts / (RTP_RATE / 1000.0);
+
+  if (n->have_transit)
+  {
+    double d = fabs(transit - n->last_transit);
+
+    if (d < 1000)
+      n->jitter_ms += (d - n->jitter_ms) / 16;
+  }
+
+  n->last_transit = transit;
+  n->have_transit = 1;
+
+  net_packet *pkt = &n->slots[seq & (NET_SLOTS - 1)];
+
+  if (pkt->used)
+    return;   // duplicate
+
+  pkt->used = 1;
+  pkt->marker = h.mpt >> 7;
+  pkt->seq = seq;
+  pkt->ts = ts;
+  pkt->len = payload & ~3;
+  memcpy(pkt->data, buf + offset, pkt->len);
+  n->packets++;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void receive(net_source *n, int timeout, int need)
+{
+  uint8_t buf[2048];     // several net: sources receive on their own threads
+  struct pollfd pfd = {.fd = n->fd, .events = POLLIN};
+
+  if (poll(&pfd, 1, timeout) > 0)
+  {
+    double now = monotonic_ms();
+    ssize_t len;
+
+    while ((len = recv(n->fd, buf, sizeof(buf), 0)) > 0)
+      handle_packet(n, buf, len, now);
+  }
+
+  release(n, need);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void net_source_open(Source *s)
+{
+  struct sockaddr_in addr;
+  int jitter = NET_DEFAULT_TARGET_MS;
+
+  if (parse_spec(s->dev, &addr, &jitter) < 0)
+    errx(1, "invalid network input %s", s->dev);
+
+  net_source *n = calloc(1, sizeof(net_source));
+
+  if (!n)
+    errx(1, "cannot allocate network source");
+
+  n->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+
+  if (n->fd < 0)
+    err(1, "cannot create socket");
+
+  int on = 1;
+  setsockopt(n->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  if (bind(n->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    err(1, "cannot bind to %s", s->dev);
+
+  if (IN_MULTICAST(ntohl(addr.sin_addr.s_addr)))
+  {
+    struct ip_mreq mreq = {.imr_multiaddr = addr.sin_addr, .imr_interface.s_addr = htonl(INADDR_ANY)};
+
+    if (setsockopt(n->fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+      err(1, "cannot join %s", s->dev);
+  }
+
+  n->min_target_ms = jitter;
+  n->last_stats = monotonic_ms();
+
+  log_printf("net: receiving input on %s, jitter buffer >= %d ms\n", s->dev, jitter);
+
+  s->priv = n;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void post_stats(Source *s, net_source *n, double now)
+{
+  status_post_input(s->pipeline, (int)depth_ms(n), (int)target_ms(n), n->lost, n->concealed);
+
+  if (debug_data)
+    log_printf("net: depth %.1f ms, target %.1f ms, jitter %.2f ms, lost %u, late %u, concealed %u, underruns %u\n",
+      depth_ms(n), target_ms(n), n->jitter_ms, n->lost, n->late, n->concealed, n->underruns);
+
+  n->last_stats = now;
+}
+
+//--------------------------------------------------------------------------------------------------
+// deliver buf_size bytes at the line rate, blocks like snd_pcm_readi()
+static int net_source_read(Source *s, uint8_t *buf, int buf_size)
+{
+  net_source *n = s->priv;
+
+  buf_size &= ~3;
+
+  while (1)
+  {
+    double now = monotonic_ms();
+
+    if (now - n->last_stats >= NET_STATS_MS)
+      post_stats(s, n, now);
+
+    if (!n->playing)
+    {
+      if (depth_ms(n) < target_ms(n))
+      {
+        receive(n, 5, 0);
+        continue;
+      }
+
+      if (debug_data)
+        log_printf("net: playing, %.1f ms buffered\n", depth_ms(n));
+
+      n->playing = 1;
+      n->credit = 0;
+      n->last_ms = now;
+    }
+
+    // hold the target depth against the clock difference to the sender
+    double trim = (depth_ms(n) - target_ms(n)) / target_ms(n) * 0.02;
+
+    if (trim > NET_MAX_RATE_TRIM)
+      trim = NET_MAX_RATE_TRIM;
+    else if (trim < -NET_MAX_RATE_TRIM)
+      trim = -NET_MAX_RATE_TRIM;
+
+    n->credit += (now - n->last_ms) * LINE_RATE_BYTES_PER_MS * (1 + trim);
+    n->last_ms = now;
+
+    if (n->credit > 2 * buf_size)
+      n->credit = 2 * buf_size;
+
+    if (n->credit < buf_size)
+    {
+      receive(n, (int)ceil((buf_size - n->credit) / LINE_RATE_BYTES_PER_MS), 0);
+      continue;
+    }
+
+    receive(n, 0, buf_size);
+
+    if (n->head - n->tail < (uint64_t)buf_size)
+    {
+      log_printf("warning: network input underrun\n");
+      status_post_xrun(s->pipeline, 0);
+      n->underruns++;
+      n->playing = 0;
+      continue;
+    }
+
+    ring_copy(n, n->tail, buf, buf_size);
+    n->tail += buf_size;
+    n->credit -= buf_size;
+
+    return buf_size;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void net_source_reset(Source *s)
+{
+  net_source *n = s->priv;
+  long long excess = (long long)((depth_ms(n) - target_ms(n)) * LINE_RATE_BYTES_PER_MS) & ~3LL;
+
+  // like a capture device dropping its buffer, but keep the jitter protection
+  if (excess > 0)
+    n->tail += excess;
+
+  n->credit = 0;
+  n->last_ms = monotonic_ms();
+}
+
+//--------------------------------------------------------------------------------------------------
+static void net_source_close(Source *s)
+{
+  net_source *n = s->priv;
+
+  if (!n)
+    return;
+
+  log_printf("net: lost %u, late %u, concealed %u, underruns %u, overflows %u\n",
+    n->lost, n->late, n->concealed, n->underruns, n->overflows);
+
+  close(n->fd);
+  free(n);
+  s->priv = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+void Source_initNet(Source *s)
+{
+  s->type   = "net";
+  s->open   = net_source_open;
+  s->read   = net_source_read;
+  s->reset  = net_source_reset;
+  s->close  = net_source_close;
+}
+
+//--------------------------------------------------------------------------------------------------
+// sender
+
+typedef struct {
+  int fd;
+  uint16_t seq;
+  uint32_t ssrc;
+  uint32_t ts;                // timestamp of the first byte in packet
+  int started;
+  uint32_t sync;              // last 4 bytes
+  int marker;
+  int filled;
+  uint8_t packet[RTP_HEADER_SIZE + RTP_MAX_PAYLOAD];
+} net_sink;
+
+//--------------------------------------------------------------------------------------------------
+static int net_sink_open(Sink *s)
+{
+  struct sockaddr_in addr;
+  int jitter;
+
+  if (parse_spec(s->dev, &addr, &jitter) < 0)
+    return -1;
+
+  net_sink *n = calloc(1, sizeof(net_sink));
+
+  if (!n)
+    errx(1, "cannot allocate network sink");
+
+  n->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+  if (n->fd >= 0 && IN_MULTICAST(ntohl(addr.sin_addr.s_addr)))
+  {
+    unsigned char ttl = 1, loop = 1;
+
+    setsockopt(n->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    setsockopt(n->fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+  }
+
+  if (n->fd < 0 || connect(n->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+  {
+    log_printf("net: cannot connect to %s: %s\n", s->dev, strerror(errno));
+
+    if (n->fd >= 0)
+      close(n->fd);
+
+    free(n);
+    return -1;
+  }
+
+  n->ssrc = random() ^ (uint32_t)monotonic_ms();
+  n->seq = random();
+
+  log_printf("net: forwarding input to %s\n", s->dev);
+
+  s->priv = n;
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void net_sink_send(net_sink *n, int len)
+{
+  rtp_header *h = (rtp_header*)n->packet;
+
+  if (len <= 0)
+    return;
+
+  h->vpxcc     = RTP_VERSION << 6;
+  h->mpt       = (n->marker ? 0x80 : 0) | RTP_PT_IEC61937;
+  h->seq       = htons(n->seq++);
+  h->timestamp = htonl(n->ts);
+  h->ssrc      = htonl(n->ssrc);
+
+  if (send(n->fd, n->packet, RTP_HEADER_SIZE + len, MSG_DONTWAIT) < 0 && errno != ECONNREFUSED)
+    log_printf("net: send failed: %s\n", strerror(errno));
+
+  n->ts += len / 4;
+  n->marker = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// frames of the raw S16LE stereo input, 4 bytes each
+static ssize_t net_sink_write(Sink *s, const void *buf, int frames)
+{
+  net_sink *n = s->priv;
+  const uint8_t *in = buf;
+  uint8_t *payload = n->packet + RTP_HEADER_SIZE;
+
+  if (!n->started)
+  {
+    n->ts = s->capture_time > 0 ? (uint32_t)llround(s->capture_time * (RTP_RATE / 1000)) : 0;
+    n->started = 1;
+  }
+
+  for (int i = 0; i < frames * 4; i++)
+  {
+    payload[n->filled++] = in[i];
+    n->sync = n->sync << 8 | in[i];
+
+    // a burst starts a new packet
+    if (n->sync == SYNC_BYTES && n->filled >= 4)
+    {
+      net_sink_send(n, n->filled - 4);
+      memcpy(payload, "\x72\xf8\x1f\x4e", 4);
+      n->filled = 4;
+      n->marker = 1;
+    }
+
+    if (n->filled == RTP_MAX_PAYLOAD)
+    {
+      net_sink_send(n, n->filled);
+      n->filled = 0;
+    }
+  }
+
+  // keep the latency at one read, preambles are frame aligned so none spans two writes
+  net_sink_send(n, n->filled);
+  n->filled = 0;
+
+  return frames;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int net_sink_delay(Sink *s, long *frames)
+{
+  return -1;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void net_sink_close(Sink *s)
+{
+  net_sink *n = s->priv;
+
+  if (!n)
+    return;
+
+  close(n->fd);
+  free(n);
+  s->priv = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+void Sink_initNet(Sink *s)
+{
+  s->type  = "net";
+  s->open  = net_sink_open;
+  s->write = net_sink_write;
+  s->delay = net_sink_delay;
+  s->close = net_sink_close;
+}
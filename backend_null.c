@@ -0,0 +1,113 @@
+/*
+ * backend_null.c
+ *
+ * Null sink: discards the audio but consumes it at the sample rate like a
+ * real DAC. write() blocks while the simulated buffer (buffer_time) is full,
+ * playback starts once the prefill is buffered, delay() reports the simulated
+ * fill level and an empty buffer counts as underrun. This lets the catch-up
+ * and latency logic run without a sound card.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <err.h>
+
+#include "backend.h"
+#include "log.h"
+#include "myspdif.h"
+#include "status.h"
+
+typedef struct {
+  double start;           // time the first frame of the current run started playing, ms, -1 = stopped
+  long long written;      // frames written in the current run
+  long buffer_frames;
+  long start_frames;      // prefill
+} null_sink;
+
+//--------------------------------------------------------------------------------------------------
+static long long null_fill(Sink *s, null_sink *n, double now)
+{
+  return n->start < 0 ? n->written : n->written - (long long)((now - n->start) * s->sample_rate / 1000.0);
+}
+
+//--------------------------------------------------------------------------------------------------
+static int null_sink_open(Sink *s)
+{
+  null_sink *n = calloc(1, sizeof(null_sink));
+
+  if (!n)
+    errx(1, "cannot allocate null sink");
+
+  n->start = -1;
+  n->buffer_frames = (long)s->buffer_time * s->sample_rate / 1000;
+  n->start_frames = 1;
+
+  s->priv = n;
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static ssize_t null_sink_write(Sink *s, const void *buf, int frames)
+{
+  null_sink *n = s->priv;
+  double now = monotonic_ms();
+
+  if (n->start >= 0 && null_fill(s, n, now) < 0)
+  {
+    log_printf("warning: null output underrun occurred\n");
+    status_post_xrun(s->pipeline, 1);
+    s->xruns++;
+    n->start = -1;
+    n->written = 0;
+  }
+
+  if (n->start < 0 && n->written + frames >= n->start_frames)
+    n->start = now;
+
+  long long over = null_fill(s, n, now) + frames - n->buffer_frames;
+
+  if (over > 0)
+    sleep_ms(over * 1000.0 / s->sample_rate);
+
+  n->written += frames;
+
+  return frames;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int null_sink_delay(Sink *s, long *frames)
+{
+  null_sink *n = s->priv;
+  long long fill = null_fill(s, n, monotonic_ms());
+
+  *frames = fill > 0 ? fill : 0;
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// the ALSA start threshold, also after an underrun
+static void null_sink_prefill(Sink *s, int frames)
+{
+  null_sink *n = s->priv;
+
+  n->start_frames = frames < n->buffer_frames ? frames : n->buffer_frames;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void null_sink_close(Sink *s)
+{
+  free(s->priv);
+  s->priv = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+void Sink_initNull(Sink *s)
+{
+  s->type  = "null";
+  s->open  = null_sink_open;
+  s->write = null_sink_write;
+  s->delay = null_sink_delay;
+  s->prefill = null_sink_prefill;
+  s->close = null_sink_close;
+}
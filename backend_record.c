@@ -0,0 +1,209 @@
+/*
+ * backend_record.c
+ *
+ * Source replaying the raw input of a recording made with -r, oldest block
+ * first and paced by the recorded timestamps.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <time.h>
+
+#include <libavutil/avutil.h>
+
+#include "backend.h"
+#include "record.h"
+#include "log.h"
+#include "myspdif.h"
+
+typedef struct {
+  uint32_t slot;
+  uint32_t seq;
+} record_slot;
+
+typedef struct {
+  int fd;
+  record_slot *order;       // slots sorted by sequence
+  uint32_t blocks;
+  uint32_t next;            // index into order
+  uint8_t block[RECORD_BLOCK_SIZE];
+  uint32_t pos, used;       // parse position in block
+  uint32_t raw_left;        // bytes of the current raw record not yet delivered
+  double start;             // replay start, ms
+  uint64_t first_us;        // time of the oldest block
+} record_source;
+
+//--------------------------------------------------------------------------------------------------
+static int read_block_header(record_source *r, uint32_t slot, record_block_header *bh)
+{
+  off_t offset = RECORD_HEADER_SIZE + (off_t)slot * RECORD_BLOCK_SIZE;
+
+  if (pread(r->fd, bh, sizeof(*bh), offset) != sizeof(*bh) || bh->magic != RECORD_BLOCK_MAGIC)
+    return -1;
+
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int compare_seq(const void *a, const void *b)
+{
+  const record_slot *sa = a, *sb = b;
+
+  return sa->seq < sb->seq ? -1 : sa->seq > sb->seq;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void record_source_open(Source *s)
+{
+  record_source *r = calloc(1, sizeof(record_source));
+  record_file_header fh;
+  record_block_header bh;
+
+  if (!r)
+    errx(1, "cannot allocate record source");
+
+  r->fd = open(s->dev, O_RDONLY | O_CLOEXEC);
+
+  if (r->fd < 0)
+    err(1, "cannot open recording %s", s->dev);
+
+  if (pread(r->fd, &fh, sizeof(fh), 0) != sizeof(fh) || memcmp(fh.magic, RECORD_MAGIC, sizeof(fh.magic))
+      || fh.version != RECORD_VERSION || fh.block_size != RECORD_BLOCK_SIZE)
+    errx(1, "%s is not a recording", s->dev);
+
+  r->order = malloc(sizeof(record_slot) * fh.max_blocks);
+
+  if (!r->order)
+    errx(1, "cannot allocate record source");
+
+  for (uint32_t i = 0; i < fh.max_blocks; i++)
+    if (read_block_header(r, i, &bh) == 0)
+      r->order[r->blocks++] = (record_slot){.slot = i, .seq = bh.seq};
+
+  qsort(r->order, r->blocks, sizeof(record_slot), compare_seq);
+
+  if (r->blocks && read_block_header(r, r->order[0].slot, &bh) == 0)
+    r->first_us = bh.time_us;
+
+  r->start = -1;
+
+  log_printf("replaying %u blocks from %s\n", r->blocks, s->dev);
+
+  s->priv = r;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int load_next_block(record_source *r)
+{
+  if (r->next >= r->blocks)
+    return -1;
+
+  off_t offset = RECORD_HEADER_SIZE + (off_t)r->order[r->next++].slot * RECORD_BLOCK_SIZE;
+
+  if (pread(r->fd, r->block, RECORD_BLOCK_SIZE, offset) < (ssize_t)sizeof(record_block_header))
+    return -1;
+
+  r->used = sizeof(record_block_header) + ((record_block_header*)r->block)->used;
+  r->pos = sizeof(record_block_header);
+
+  if (r->used > RECORD_BLOCK_SIZE)
+    r->used = RECORD_BLOCK_SIZE;
+
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int record_source_read(Source *s, uint8_t *buf, int buf_size)
+{
+  record_source *r = s->priv;
+  int done = 0;
+
+  if (r->start < 0)
+    r->start = monotonic_ms();
+
+  while (done < buf_size)
+  {
+    if (r->raw_left)
+    {
+      int n = r->raw_left < (uint32_t)(buf_size - done) ? r->raw_left : buf_size - done;
+
+      memcpy(buf + done, r->block + r->pos, n);
+      r->pos += n;
+      r->raw_left -= n;
+      done += n;
+      continue;
+    }
+
+    if (r->pos + sizeof(record_header) > r->used)
+    {
+      if (done || load_next_block(r) < 0)
+        break;
+
+      continue;
+    }
+
+    record_header rh;
+    memcpy(&rh, r->block + r->pos, sizeof(rh));
+    r->pos += sizeof(rh);
+
+    if (r->pos + rh.len > r->used)
+    {
+      r->pos = r->used;
+      continue;
+    }
+
+    if (rh.type != RECORD_RAW)
+    {
+      r->pos += rh.len;
+      continue;
+    }
+
+    // deliver no earlier than recorded
+    uint64_t t = ((record_block_header*)r->block)->time_us + rh.dt_us - r->first_us;
+    double due = r->start + t / 1000.0;
+    double now = monotonic_ms();
+
+    if (due > now)
+      usleep((useconds_t)((due - now) * 1000));
+
+    r->raw_left = rh.len;
+  }
+
+  return done ? done : AVERROR_EOF;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void record_source_reset(Source *s)
+{
+}
+
+//--------------------------------------------------------------------------------------------------
+static void record_source_close(Source *s)
+{
+  record_source *r = s->priv;
+
+  if (!r)
+    return;
+
+  close(r->fd);
+  free(r->order);
+  free(r);
+  s->priv = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+void Source_initRecord(Source *s)
+{
+  s->type   = "record";
+  s->finite = 1;
+  s->open   = record_source_open;
+  s->read   = record_source_read;
+  s->reset  = record_source_reset;
+  s->close  = record_source_close;
+}
@@ -0,0 +1,318 @@
+/*
+ * backend_rtp.c
+ *
+ * RTP sink: sends the decoded frames as L16/L24 over UDP unicast or
+ * multicast, see rtp.h for the format. Spec:
+ *
+ *   rtp:<host>[:<port>][,l24][,ptime=<ms>][,ttl=<n>]
+ *
+ * Frames are sent as soon as a packet is full, the sink does not buffer
+ * beyond one packet and has no delay of its own.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <math.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "backend.h"
+#include "rtp.h"
+#include "log.h"
+
+#define RTP_DEFAULT_PTIME_MS  1
+#define RTP_RESYNC_FRAMES     (RTP_RATE / 50)   // capture clock and frame count may drift apart by 20ms
+
+typedef struct {
+  int fd, rtcp_fd;
+  int bytes;                  // per sample on the wire
+  int packet_frames;
+  uint8_t pt;
+  uint16_t seq;
+  uint32_t ssrc;
+  uint32_t next_ts;           // timestamp of the next frame written
+  int started;
+  int marker;
+  int filled;                 // frames in packet
+  uint32_t packets, octets;
+  double lastReport;
+  uint8_t packet[RTP_HEADER_SIZE + RTP_MAX_PAYLOAD];
+} rtp_sink;
+
+//--------------------------------------------------------------------------------------------------
+static double realtime_ms()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int rtp_socket(struct sockaddr_in *addr, int ttl)
+{
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+  if (fd < 0)
+    return -1;
+
+  if (IN_MULTICAST(ntohl(addr->sin_addr.s_addr)))
+  {
+    unsigned char t = ttl, loop = 1;
+
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &t, sizeof(t));
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+  }
+
+  // lowest latency class, ignored where not supported
+  int tos = 0xb8;   // DSCP EF
+  setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+
+  if (connect(fd, (struct sockaddr*)addr, sizeof(*addr)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int parse_spec(const char *dev, struct sockaddr_in *addr, int *bytes, int *ptime, int *ttl)
+{
+  char spec[256], *save = NULL;
+
+  snprintf(spec, sizeof(spec), "%s", dev);
+
+  char *host = strtok_r(spec, ",", &save);
+  char *port = host ? strrchr(host, ':') : NULL;
+
+  if (!host || !*host)
+    return -1;
+
+  if (port)
+    *port++ = 0;
+
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM}, *res;
+
+  if (getaddrinfo(host, NULL, &hints, &res) != 0)
+  {
+    log_printf("rtp: cannot resolve %s\n", host);
+    return -1;
+  }
+
+  memcpy(addr, res->ai_addr, sizeof(*addr));
+  freeaddrinfo(res);
+
+  addr->sin_port = htons(port ? atoi(port) : RTP_DEFAULT_PORT);
+
+  for (char *opt; (opt = strtok_r(NULL, ",", &save));)
+  {
+    if (!strcmp(opt, "l24"))
+      *bytes = 3;
+    else if (!strcmp(opt, "l16"))
+      *bytes = 2;
+    else if (sscanf(opt, "ptime=%d", ptime) == 1 && *ptime > 0)
+      ;
+    else if (sscanf(opt, "ttl=%d", ttl) == 1 && *ttl >= 0 && *ttl < 256)
+      ;
+    else
+    {
+      log_printf("rtp: unknown option %s\n", opt);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int rtp_sink_open(Sink *s)
+{
+  struct sockaddr_in addr;
+  int bytes = 2, ptime = RTP_DEFAULT_PTIME_MS, ttl = 1;
+
+  if (s->channels < 1 || s->channels > RTP_MAX_CHANNELS || s->sample_rate != RTP_RATE)
+  {
+    log_printf("rtp: unsupported format %d channels %d Hz\n", s->channels, s->sample_rate);
+    return -1;
+  }
+
+  if (parse_spec(s->dev, &addr, &bytes, &ptime, &ttl) < 0)
+    return -1;
+
+  rtp_sink *r = calloc(1, sizeof(rtp_sink));
+
+  if (!r)
+    errx(1, "cannot allocate rtp sink");
+
+  r->fd = rtp_socket(&addr, ttl);
+  addr.sin_port = htons(ntohs(addr.sin_port) + 1);
+  r->rtcp_fd = rtp_socket(&addr, ttl);
+
+  if (r->fd < 0 || r->rtcp_fd < 0)
+  {
+    log_printf("rtp: cannot connect to %s: %s\n", s->dev, strerror(errno));
+
+    if (r->fd >= 0)
+      close(r->fd);
+
+    if (r->rtcp_fd >= 0)
+      close(r->rtcp_fd);
+
+    free(r);
+    return -1;
+  }
+
+  r->bytes = bytes;
+  r->pt = rtp_payload_type(bytes, s->channels);
+  r->packet_frames = ptime * RTP_RATE / 1000;
+
+  if (r->packet_frames * bytes * s->channels > RTP_MAX_PAYLOAD)
+    r->packet_frames = RTP_MAX_PAYLOAD / (bytes * s->channels);
+
+  r->ssrc = random() ^ (uint32_t)realtime_ms();
+  r->seq = random();
+
+  log_printf("rtp: sending L%d %d channels, %d frames per packet to %s\n", bytes * 8, s->channels, r->packet_frames, s->dev);
+
+  s->priv = r;
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void send_report(Sink *s, rtp_sink *r, double now)
+{
+  double sec = floor(now / 1000);
+  rtcp_sr sr = {
+    .vprc          = RTP_VERSION << 6,
+    .pt            = RTCP_SR,
+    .length        = htons(sizeof(rtcp_sr) / 4 - 1),
+    .ssrc          = htonl(r->ssrc),
+    .ntp_sec       = htonl((uint32_t)(sec + RTP_NTP_OFFSET)),
+    .ntp_frac      = htonl((uint32_t)((now / 1000 - sec) * 4294967296.0)),
+    .rtp_timestamp = htonl((uint32_t)llround(now * (RTP_RATE / 1000))),
+    .packets       = htonl(r->packets),
+    .octets        = htonl(r->octets),
+  };
+
+  send(r->rtcp_fd, &sr, sizeof(sr), MSG_DONTWAIT);
+  r->lastReport = now;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void send_packet(Sink *s, rtp_sink *r)
+{
+  rtp_header *h = (rtp_header*)r->packet;
+  int payload = r->filled * r->bytes * s->channels;
+
+  h->vpxcc     = RTP_VERSION << 6;
+  h->mpt       = (r->marker ? 0x80 : 0) | r->pt;
+  h->seq       = htons(r->seq++);
+  h->timestamp = htonl(r->next_ts - r->filled);
+  h->ssrc      = htonl(r->ssrc);
+
+  // a missing receiver (ECONNREFUSED) or a full socket buffer only loses this packet
+  if (send(r->fd, r->packet, RTP_HEADER_SIZE + payload, MSG_DONTWAIT) < 0 && errno != ECONNREFUSED)
+    log_printf("rtp: send failed: %s\n", strerror(errno));
+
+  r->packets++;
+  r->octets += payload;
+  r->marker = 0;
+  r->filled = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static ssize_t rtp_sink_write(Sink *s, const void *buf, int frames)
+{
+  rtp_sink *r = s->priv;
+  const int16_t *in = buf;
+  double now = realtime_ms();
+
+  // follow the capture clock, resync with a marker if the frame count drifts too far from it
+  if (s->capture_time > 0)
+  {
+    uint32_t capture_ts = (uint32_t)llround(s->capture_time * (RTP_RATE / 1000));
+    int32_t drift = capture_ts - r->next_ts;
+
+    if (!r->started || drift > RTP_RESYNC_FRAMES || drift < -RTP_RESYNC_FRAMES)
+    {
+      if (r->filled)
+        send_packet(s, r);
+
+      r->next_ts = capture_ts;
+      r->marker = 1;
+    }
+  }
+  else if (!r->started)
+    r->marker = 1;
+
+  r->started = 1;
+
+  for (int f = 0; f < frames; f++)
+  {
+    uint8_t *p = r->packet + RTP_HEADER_SIZE + r->filled * r->bytes * s->channels;
+
+    for (int c = 0; c < s->channels; c++)
+    {
+      int16_t v = *in++;
+
+      *p++ = (uint16_t)v >> 8;
+      *p++ = v & 0xff;
+
+      if (r->bytes == 3)
+        *p++ = 0;
+    }
+
+    r->filled++;
+    r->next_ts++;
+
+    if (r->filled == r->packet_frames)
+      send_packet(s, r);
+  }
+
+  if (now - r->lastReport >= RTCP_INTERVAL_MS)
+    send_report(s, r, now);
+
+  return frames;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int rtp_sink_delay(Sink *s, long *frames)
+{
+  return -1;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void rtp_sink_close(Sink *s)
+{
+  rtp_sink *r = s->priv;
+
+  if (!r)
+    return;
+
+  close(r->fd);
+  close(r->rtcp_fd);
+  free(r);
+  s->priv = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+void Sink_initRtp(Sink *s)
+{
+  s->type  = "rtp";
+  s->open  = rtp_sink_open;
+  s->write = rtp_sink_write;
+  s->delay = rtp_sink_delay;
+  s->close = rtp_sink_close;
+}
@@ -0,0 +1,207 @@
+/*
+ * bench.c
+ *
+ * Helpers shared by the offline benchmarks, see bench.h
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <errno.h>
+#include <err.h>
+
+#include "bench.h"
+#include "myspdif.h"
+
+//--------------------------------------------------------------------------------------------------
+// Allocation counter. The benchmark executable interposes the glibc allocator, so allocations
+// inside the shared ffmpeg libraries are counted as well (av_malloc uses posix_memalign).
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+
+static atomic_ullong allocs;
+
+void* malloc(size_t size)
+{
+  atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+  atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+  return __libc_calloc(n, size);
+}
+
+void* realloc(void *ptr, size_t size)
+{
+  atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t align, size_t size)
+{
+  atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+  return __libc_memalign(align, size);
+}
+
+void* aligned_alloc(size_t align, size_t size)
+{
+  return memalign(align, size);
+}
+
+int posix_memalign(void **ptr, size_t align, size_t size)
+{
+  *ptr = memalign(align, size);
+  return *ptr ? 0 : ENOMEM;
+}
+
+unsigned long long bench_allocs()
+{
+  return atomic_load_explicit(&allocs, memory_order_relaxed);
+}
+
+//--------------------------------------------------------------------------------------------------
+double bench_wall_ms()
+{
+  return monotonic_ms();
+}
+
+//--------------------------------------------------------------------------------------------------
+double bench_cpu_ms()
+{
+  return clock_ms(CLOCK_THREAD_CPUTIME_ID);
+}
+
+//--------------------------------------------------------------------------------------------------
+uint8_t* bench_load_file(const char *name, size_t *size)
+{
+  FILE *f = fopen(name, "rb");
+
+  if (!f)
+    err(1, "cannot open %s", name);
+
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  uint8_t *data = __libc_malloc(*size ? *size : 1);
+
+  if (!data)
+    errx(1, "cannot allocate %zu bytes for %s", *size, name);
+
+  if (fread(data, 1, *size, f) != *size)
+    errx(1, "cannot read %s", name);
+
+  fclose(f);
+
+  return data;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int bench_reader(void *opaque, uint8_t *buf, int buf_size)
+{
+  bench_input *in = opaque;
+  size_t n = in->size - in->pos;
+
+  if (n == 0)
+    return AVERROR_EOF;
+
+  if (n > (size_t)buf_size)
+    n = buf_size;
+
+  // whole 16 bit stereo frames, like snd_pcm_readi()
+  n &= ~3;
+
+  if (n == 0)
+    return AVERROR_EOF;
+
+  memcpy(buf, in->data + in->pos, n);
+  in->pos += n;
+
+  return n;
+}
+
+//--------------------------------------------------------------------------------------------------
+int bench_skip(void *opaque, int bytes)
+{
+  bench_input *in = opaque;
+  size_t n = in->size - in->pos;
+
+  if (n > (size_t)bytes)
+    n = bytes;
+
+  n &= ~3;
+  in->pos += n;
+
+  return n;
+}
+
+//--------------------------------------------------------------------------------------------------
+AVFormatContext* bench_open_spdif(bench_input *in)
+{
+  AVInputFormat *spdif_fmt = av_find_input_format("spdif");
+
+  if (!spdif_fmt)
+    errx(1, "cannot find S/PDIF demux driver");
+
+  AVFormatContext *ctx = avformat_alloc_context();
+
+  if (!ctx)
+    errx(1, "cannot allocate S/PDIF context");
+
+  uint8_t *buf = av_malloc(BENCH_IO_BUFFER_SIZE);
+
+  if (!buf)
+    errx(1, "cannot allocate input buffer");
+
+  ctx->pb = avio_alloc_context(buf, BENCH_IO_BUFFER_SIZE, 0, in, bench_reader, NULL, NULL);
+
+  if (!ctx->pb)
+    errx(1, "cannot set up reader");
+
+  if (avformat_open_input(&ctx, "internal", spdif_fmt, NULL) != 0)
+    errx(1, "cannot open S/PDIF input");
+
+  return ctx;
+}
+
+//--------------------------------------------------------------------------------------------------
+void bench_close_spdif(AVFormatContext **ctx)
+{
+  AVIOContext *pb = (*ctx)->pb;
+
+  avformat_close_input(ctx);
+
+  if (pb)
+  {
+    av_freep(&pb->buffer);
+    avio_context_free(&pb);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void bench_stage_add(bench_stage *stage, double start)
+{
+  double us = (bench_cpu_ms() - start) * 1000.0;
+
+  stage->cpu_ms += us / 1000.0;
+  stage->count++;
+
+  if (us > stage->max_us)
+    stage->max_us = us;
+}
+
+//--------------------------------------------------------------------------------------------------
+void bench_stage_print(bench_stage *stage, unsigned long bursts)
+{
+  printf("  %-10s %10.1f ms cpu %8.1f us/burst %8.1f us max\n",
+    stage->name, stage->cpu_ms, bursts ? stage->cpu_ms * 1000.0 / bursts : 0.0, stage->max_us);
+}
@@ -0,0 +1,48 @@
+/*
+ * bench.h
+ *
+ * Helpers shared by the offline benchmarks: cpu/wall clocks, allocation
+ * counter and an in-memory IEC 61937 input for my_spdif_read_packet().
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <libavformat/avformat.h>
+
+#define BENCH_IO_BUFFER_SIZE 768   // same as I_BUFFER_SIZE in spdif-loop.c
+#define BENCH_BYTES_PER_MS   192   // 48kHz S16 stereo line rate
+
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+  size_t pos;
+} bench_input;
+
+typedef struct {
+  const char *name;
+  double cpu_ms;
+  double max_us;
+  unsigned long count;
+} bench_stage;
+
+double bench_wall_ms();
+double bench_cpu_ms();
+unsigned long long bench_allocs();
+
+uint8_t* bench_load_file(const char *name, size_t *size);
+
+// S/PDIF demuxer context reading from in, like initContext() in spdif-loop.c
+AVFormatContext* bench_open_spdif(bench_input *in);
+void bench_close_spdif(AVFormatContext **ctx);
+
+// MySpdifState.skip for in, the padding is dropped like the ALSA and file sources do
+int bench_skip(void *opaque, int bytes);
+
+// account cpu time since start (from bench_cpu_ms()) to stage
+void bench_stage_add(bench_stage *stage, double start);
+void bench_stage_print(bench_stage *stage, unsigned long bursts);
+
+#endif /* BENCH_H_ */
@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# decoder-bench.sh
+#
+# Compares the float and the fixed-point decoders (-D) on the AC-3 captures
+# of a corpus made by make-corpus.sh: cpu time per burst for decode and
+# convert, and realtime factor. Meant to be run on the target board, e.g.
+# ARMv6 (no NEON, fixed-point expected to win) and ARMv7 with NEON.
+#
+# usage: decoder-bench.sh <corpus-dir> [loops] [spdif-bench]
+
+set -e
+
+CORPUS=$1
+LOOPS=${2:-5}
+BENCH=${3:-./spdif-bench}
+
+[ -d "$CORPUS" ] || { sed -n '3,11p' "$0"; exit 1; }
+
+echo "cpu: $(sed -n 's/^\(model name\|Processor\)[^:]*: *//p' /proc/cpuinfo | head -1)"
+echo "features: $(sed -n 's/^Features[^:]*: *//p' /proc/cpuinfo | head -1)"
+echo
+
+for policy in float fixed auto; do
+  echo "== -D $policy"
+  "$BENCH" -n "$LOOPS" -D "$policy" "$CORPUS"/ac3-*.spdif | grep -v '^ *read '
+done
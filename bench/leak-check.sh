@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# leak-check.sh
+#
+# Runs the full loop with a restart after every burst played (-L), the way
+# a codec switch tears down and rebuilds the demuxer, decoder and output,
+# and fails if the resident size grows once the allocator has settled.
+#
+# usage: leak-check.sh [corpus-dir] [cycles] [spdif-decoder]
+#
+# The corpus is generated with make-corpus.sh
+
+CORPUS=${1:-corpus}
+CYCLES=${2:-10000}
+DECODER=${3:-./spdif-decoder}
+LOG=$(mktemp)
+STATUS=0
+
+trap 'rm -f "$LOG"' EXIT
+
+for f in ac3-5.1-448k.spdif dts-5.1.spdif pcm-2.0.raw; do
+  echo "== $f"
+  "$DECODER" -i "fastfile:$CORPUS/$f" -o null -s 0 -C off -L "$CYCLES" > "$LOG" 2>&1 || STATUS=1
+  grep '^leak check' "$LOG" || { tail -5 "$LOG"; STATUS=1; }
+done
+
+exit $STATUS
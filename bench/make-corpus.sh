@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# make-corpus.sh
+#
+# Generates reproducible IEC 61937 captures for spdif-bench: a 5.1 test signal
+# is encoded with ffmpeg and wrapped by ffmpeg's spdif muxer, the result is the
+# same raw S16LE stereo byte stream alsa_reader() returns from a S/PDIF input.
+#
+# usage: make-corpus.sh [output-dir] [seconds]
+#
+# Requires an ffmpeg binary with the ac3, eac3 and dca encoders and the spdif muxer.
+
+set -e
+
+OUT=${1:-corpus}
+SECONDS_=${2:-60}
+FFMPEG=${FFMPEG:-ffmpeg}
+
+mkdir -p "$OUT"
+
+# deterministic 5.1 source: different tone per channel plus seeded noise
+SRC="sine=f=220:r=48000:d=$SECONDS_[c0];sine=f=330:r=48000:d=$SECONDS_[c1];sine=f=440:r=48000:d=$SECONDS_[c2];\
+sine=f=55:r=48000:d=$SECONDS_[c3];anoisesrc=r=48000:d=$SECONDS_:a=0.1:seed=1[c4];anoisesrc=r=48000:d=$SECONDS_:a=0.1:seed=2[c5];\
+[c0][c1][c2][c3][c4][c5]join=inputs=6:channel_layout=5.1"
+
+gen()
+{
+  name=$1
+  shift
+  echo "$OUT/$name"
+  $FFMPEG -hide_banner -loglevel error -y -filter_complex "$SRC" "$@" -f spdif "$OUT/$name"
+}
+
+gen ac3-5.1-448k.spdif   -c:a ac3  -b:a 448k
+gen ac3-2.0-192k.spdif   -c:a ac3  -b:a 192k -ac 2
+gen eac3-5.1-640k.spdif  -c:a eac3 -b:a 640k
+gen dts-5.1.spdif        -c:a dca  -strict -2
+
+# plain PCM, no IEC 61937 bursts
+echo "$OUT/pcm-2.0.raw"
+$FFMPEG -hide_banner -loglevel error -y -filter_complex "$SRC" -ac 2 -f s16le -ar 48000 "$OUT/pcm-2.0.raw"
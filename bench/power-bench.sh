@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# power-bench.sh
+#
+# Plays the same input for a while in the default mode and in the efficiency
+# mode (-e) and prints the cpu load and wakeups per second spdif-decoder
+# logs at exit for both. The defaults run on any box (paced file input, null
+# output); pass ALSA devices to measure the real period wakeups.
+#
+# usage: power-bench.sh [seconds] [input] [output] [batch-ms] [spdif-decoder]
+#
+# e.g.   power-bench.sh 60 file:corpus/ac3-5.1-448k.spdif null 128
+#        power-bench.sh 60 hw:CARD=Device dsp# 256
+
+SECONDS_PER_RUN=${1:-60}
+INPUT=${2:-file:corpus/ac3-5.1-448k.spdif}
+OUTPUT=${3:-null}
+BATCH=${4:-128}
+DECODER=${5:-./spdif-decoder}
+LOG=$(mktemp)
+
+trap 'rm -f "$LOG"' EXIT
+
+run()
+{
+  # the status server polls on its own, -s 0 leaves the pipeline alone
+  timeout -s TERM "$SECONDS_PER_RUN" "$DECODER" -i "$INPUT" -o "$OUTPUT" -s 0 -C off "$@" > "$LOG" 2>&1
+  grep '^usage:' "$LOG" || tail -5 "$LOG"
+}
+
+echo "== default"
+run
+echo "== -e $BATCH"
+run -e "$BATCH"
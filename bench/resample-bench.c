@@ -0,0 +1,169 @@
+/*
+ * resample-bench.c
+ *
+ * Resampler benchmark: raw S16 stereo PCM at 32, 44.1, 88.2 and 96kHz is
+ * converted to the 48kHz output in chunks of one PCM burst through
+ * CodecHandler_convertPcm(), like the loop does, at every quality setting
+ * (-Q). Reports cpu time per second of audio and the signal to noise and
+ * distortion ratio of a 1kHz tone and a tone near the band edge.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <math.h>
+#include <err.h>
+
+#include "codechandler.h"
+#include "resample.h"
+#include "bench.h"
+
+#define CHUNK_FRAMES  1536        // one PCM burst, MAX_BURST_SIZE in myspdif.h
+#define SKIP_FRAMES   4800        // filter delay and start up, excluded from the SINAD
+
+atomic_int debug_data = 0;
+
+static const int rates[] = {32000, 44100, 88200, 96000};
+static const char *qualities[] = {"low", "medium", "high"};
+
+//--------------------------------------------------------------------------------------------------
+void usage(void)
+{
+  fprintf(stderr,
+    "usage:\n"
+    "  resample-bench [-s seconds]\n\n"
+    " -s n ... seconds of audio per rate and quality (default 10)\n");
+
+  exit(1);
+}
+
+//--------------------------------------------------------------------------------------------------
+// SINAD in dB: least squares fit of a sine of frequency f at the output rate, the residual is
+// noise and distortion
+static double sinad(const int16_t *pcm, int frames, double f)
+{
+  double w = 2 * M_PI * f / RESAMPLE_OUTPUT_RATE;
+  double ss = 0, cc = 0, sc = 0, ys = 0, yc = 0;
+
+  for (int n = SKIP_FRAMES; n < frames; n++)
+  {
+    double s = sin(w * n), c = cos(w * n), y = pcm[n * 2];
+
+    ss += s * s; cc += c * c; sc += s * c;
+    ys += y * s; yc += y * c;
+  }
+
+  double det = ss * cc - sc * sc;
+  double a = (ys * cc - yc * sc) / det;
+  double b = (yc * ss - ys * sc) / det;
+  double signal = 0, noise = 0;
+
+  for (int n = SKIP_FRAMES; n < frames; n++)
+  {
+    double fit = a * sin(w * n) + b * cos(w * n);
+    double r = pcm[n * 2] - fit;
+
+    signal += fit * fit;
+    noise += r * r;
+  }
+
+  return noise > 0 ? 10 * log10(signal / noise) : 200;
+}
+
+//--------------------------------------------------------------------------------------------------
+// convert seconds of a half scale tone f at rate, returns the SINAD, cpu time to *cpu_ms
+static double run(int rate, double f, int seconds, double *cpu_ms)
+{
+  CodecHandler h;
+  int inFrames = rate * seconds;
+  int outMax = (int)((int64_t)inFrames * RESAMPLE_OUTPUT_RATE / rate) + CODEC_MAX_FRAME_SAMPLES;
+  int16_t *in = malloc(inFrames * 4);
+  int16_t *out = malloc(outMax * 4);
+  uint8_t *buf = malloc(CODEC_MAX_OUTPUT_SIZE);
+  int outFrames = 0;
+
+  if (!in || !out || !buf)
+    errx(1, "cannot allocate %d frames", inFrames);
+
+  for (int n = 0; n < inFrames; n++)
+    in[n * 2] = in[n * 2 + 1] = lrint(16384 * sin(2 * M_PI * f * n / rate));
+
+  CodecHandler_init(&h);
+
+  double start = bench_cpu_ms();
+
+  for (int pos = 0; pos < inFrames; pos += CHUNK_FRAMES)
+  {
+    uint32_t size = (inFrames - pos < CHUNK_FRAMES ? inFrames - pos : CHUNK_FRAMES) * 4;
+
+    memcpy(buf, in + pos * 2, size);
+
+    if (CodecHandler_convertPcm(&h, rate, buf, &size) != 0)
+      errx(1, "%d Hz: conversion failed", rate);
+
+    if (outFrames + size / 4 > (unsigned)outMax)
+      errx(1, "%d Hz: more output than expected", rate);
+
+    memcpy(out + outFrames * 2, buf, size);
+    outFrames += size / 4;
+  }
+
+  *cpu_ms = bench_cpu_ms() - start;
+
+  double db = sinad(out, outFrames, f);
+
+  CodecHandler_deinit(&h);
+  free(in);
+  free(out);
+  free(buf);
+
+  return db;
+}
+
+//--------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+  int opt, seconds = 10;
+
+  while ((opt = getopt(argc, argv, "hs:")) != -1)
+  {
+    switch (opt)
+    {
+    case 's':
+      seconds = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+
+  if (optind != argc || seconds < 1)
+    usage();
+
+  printf("%-8s %-7s %12s %10s %10s %14s\n", "input", "quality", "cpu ms/s", "realtime", "1k SINAD", "edge SINAD");
+
+  for (unsigned r = 0; r < sizeof(rates) / sizeof(rates[0]); r++)
+  {
+    // 80% of the narrower band, where the filters differ
+    int band = rates[r] < RESAMPLE_OUTPUT_RATE ? rates[r] : RESAMPLE_OUTPUT_RATE;
+    double edge = band * 0.4;
+
+    for (int q = 0; q < 3; q++)
+    {
+      double cpu, cpuEdge;
+
+      resample_setQuality(qualities[q]);
+
+      double db = run(rates[r], 1000, seconds, &cpu);
+      double dbEdge = run(rates[r], edge, seconds, &cpuEdge);
+
+      printf("%-8d %-7s %12.2f %9.0fx %7.1f dB %8.1f dB %.0f Hz\n", rates[r], qualities[q],
+        cpu / seconds, seconds * 1000.0 / cpu, db, dbEdge, edge);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# soak.sh
+#
+# Plays a looped capture through the full loop for a while with faults
+# injected on a schedule (-F) and prints the recovery time per fault type:
+# the time from the injection to the end of the last output gap it caused.
+# The defaults run on any box (paced file input, null output); pass ALSA
+# devices to exercise the xrun_in and xrun_out paths too.
+#
+# usage: soak.sh [seconds] [corpus-dir] [faults] [output] [spdif-decoder]
+#
+# The corpus is generated with make-corpus.sh
+
+SECONDS_PER_FILE=${1:-300}
+CORPUS=${2:-corpus}
+FAULTS=${3:-all}
+OUTPUT=${4:-null}
+DECODER=${5:-./spdif-decoder}
+LOG=$(mktemp)
+STATUS=0
+
+trap 'rm -f "$LOG"' EXIT
+
+for f in ac3-5.1-448k.spdif dts-5.1.spdif eac3-5.1-640k.spdif; do
+  echo "== $f, $SECONDS_PER_FILE s, faults $FAULTS"
+
+  # the loop ends with the decoder, cat fails on the closed pipe
+  while cat "$CORPUS/$f"; do :; done 2>/dev/null |
+    timeout -s TERM "$SECONDS_PER_FILE" "$DECODER" -i file:/dev/stdin -o "$OUTPUT" -s 0 -C off -F "$FAULTS" > "$LOG" 2>&1
+
+  sed -n '/^faults:/,$p' "$LOG" | grep . || { tail -5 "$LOG"; STATUS=1; }
+  echo
+done
+
+exit $STATUS
@@ -0,0 +1,254 @@
+/*
+ * spdif-bench.c
+ *
+ * Offline replay benchmark: feeds recorded raw S16LE stereo captures through
+ * my_spdif_read_packet(), CodecHandler_decodeFrame() and CodecHandler_convertFrame()
+ * as fast as possible and reports throughput, cpu time per stage and
+ * allocations per burst. -m/-M mix like spdif-decoder, the convert stage
+ * then includes the mixer; -l meters the converted output as a stage of its own.
+ * The padding between bursts is skipped like the ALSA and file sources do, -S
+ * reads it through the AVIO buffer instead.
+ *
+ * Captures are recorded with "arecord -f S16_LE -c 2 -r 48000 -t raw" or
+ * generated with bench/make-corpus.sh
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <err.h>
+
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+
+#include "myspdif.h"
+#include "codechandler.h"
+#include "meter.h"
+#include "bench.h"
+
+atomic_int debug_data = 0;
+
+static int readPadding = 0;   // -S
+
+//--------------------------------------------------------------------------------------------------
+void usage(void)
+{
+  fprintf(stderr,
+    "usage:\n"
+    "  spdif-bench [-n loops] [-D policy] [-m channels] [-M mixing] [-l metering] [-S] <capture> ...\n\n"
+    " -n n ... replay every capture n times (default 1)\n"
+    " -D p ... decoder policy auto, float, fixed or per codec (ac3=fixed,...)\n"
+    " -m n ... mix into n output channels\n"
+    " -M x ... mixing loro, ltrt, upmix (see spdif-decoder)\n"
+    " -l x ... level metering <ms>[,loudness] (see spdif-decoder)\n"
+    " -S   ... read the padding between bursts instead of skipping it\n"
+    " -v   ... verbose\n");
+
+  exit(1);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void bench_file(const char *name, int loops)
+{
+  size_t size;
+  uint8_t *data = bench_load_file(name, &size);
+  uint8_t *resamples = av_malloc(CODEC_MAX_OUTPUT_SIZE);
+
+  bench_stage stages[4] = {{.name = "read"}, {.name = "decode"}, {.name = "convert"}, {.name = "meter"}};
+  unsigned long bursts = 0, pcm = 0, restarts = 0, rejected = 0;
+  unsigned long long allocs = 0;
+  enum AVCodecID codec = AV_CODEC_ID_NONE;
+  int channels = 0;
+  const char *decoder = "-";
+  const char *kernel = "-";
+  enum AVSampleFormat format = AV_SAMPLE_FMT_NONE;
+
+  double wall = bench_wall_ms();
+
+  for (int l = 0; l < loops; l++)
+  {
+    bench_input in = {.data = data, .size = size, .pos = 0};
+    AVFormatContext *ctx = bench_open_spdif(&in);
+    AVPacket pkt;
+    MySpdifState rs = MY_SPDIF_STATE_INIT;
+
+    if (!readPadding)
+    {
+      rs.skip = bench_skip;
+      rs.skip_opaque = &in;
+    }
+
+    CodecHandler h;
+    meter m = {0};
+    meter_levels levels;
+    uint32_t howmuch = 0;
+
+    memset(&pkt, 0, sizeof(AVPacket));
+    av_init_packet(&pkt);
+    CodecHandler_init(&h);
+
+    while (1)
+    {
+      unsigned long long a = bench_allocs();
+      double start = bench_cpu_ms();
+
+      int ret = my_spdif_read_packet(ctx, &rs, &pkt, resamples, MAX_BURST_SIZE, &howmuch);
+
+      bench_stage_add(&stages[0], start);
+
+      if (ret == AVERROR_EOF)
+        break;
+
+      if (ret == SPIF_DECODER_RETRY_REQUIRED)
+        continue;
+
+      if (ret == SPIF_DECODER_PCM)
+      {
+        pcm++;
+        continue;
+      }
+
+      if (ret == SPIF_DECODER_REJECTED)
+      {
+        rejected++;
+        continue;
+      }
+
+      if (ret == SPIF_DECODER_RESTART_REQUIRED)
+      {
+        restarts++;
+        CodecHandler_closeCodec(&h);
+        bench_close_spdif(&ctx);
+        ctx = bench_open_spdif(&in);
+        continue;
+      }
+
+      if (ret)
+        errx(1, "%s: read packet failed", name);
+
+      start = bench_cpu_ms();
+
+      CodecHandler_loadCodec(&h, ctx);
+      ret = CodecHandler_decodeFrame(&h, &pkt);
+
+      bench_stage_add(&stages[1], start);
+
+      if (ret != SPIF_DECODER_RESTART_REQUIRED)
+      {
+        start = bench_cpu_ms();
+        ret = CodecHandler_convertFrame(&h, resamples, &howmuch);
+        bench_stage_add(&stages[2], start);
+      }
+
+      if (ret != SPIF_DECODER_RESTART_REQUIRED && meter_enabled)
+      {
+        int outChannels = h.mix.in_channels ? h.mix.out_channels : h.currentChannelCount;
+        uint64_t layout = h.mix.in_channels ? 0 : h.currentChannelLayout;
+
+        start = bench_cpu_ms();
+
+        if (m.channels != outChannels || m.layout != layout)
+          meter_setup(&m, layout, outChannels, 48000);
+
+        meter_process(&m, (int16_t*)resamples, howmuch / 2 / outChannels, &levels);
+        bench_stage_add(&stages[3], start);
+      }
+
+      av_packet_unref(&pkt);
+
+      if (ret == SPIF_DECODER_RESTART_REQUIRED)
+      {
+        restarts++;
+        CodecHandler_closeCodec(&h);
+        continue;
+      }
+
+      bursts++;
+      allocs += bench_allocs() - a;
+      codec = h.currentCodecID;
+      channels = h.currentChannelCount;
+      decoder = h.codec->name;
+      format = h.currentSampleFormat;
+
+      if (h.mix.in_channels && !h.mix.identity)
+        kernel = format == AV_SAMPLE_FMT_FLTP ? h.mix.kernel_name : "interleaved";
+    }
+
+    CodecHandler_closeCodec(&h);
+    CodecHandler_deinit(&h);
+    bench_close_spdif(&ctx);
+  }
+
+  wall = bench_wall_ms() - wall;
+
+  double audio_ms = (double)size * loops / BENCH_BYTES_PER_MS;
+
+  printf("%s: %s, %d channels, %zu bytes x %d\n", name, avcodec_get_name(codec), channels, size, loops);
+  printf("  decoder %s, %s, mixer %s\n", decoder, format == AV_SAMPLE_FMT_NONE ? "-" : av_get_sample_fmt_name(format), kernel);
+  printf("  bursts %lu, pcm blocks %lu, restarts %lu, rejected %lu\n", bursts, pcm, restarts, rejected);
+  printf("  wall %.1f ms, %.1f bursts/s, %.1fx realtime\n", wall, bursts * 1000.0 / wall, audio_ms / wall);
+
+  for (int i = 0; i < (meter_enabled ? 4 : 3); i++)
+    bench_stage_print(&stages[i], bursts);
+
+  printf("  allocs     %10.2f per burst\n\n", bursts ? (double)allocs / bursts : 0.0);
+
+  av_free(resamples);
+  free(data);
+}
+
+//--------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+  int opt, loops = 1, channels = 0, mixFlags = 0;
+
+  while ((opt = getopt(argc, argv, "hn:D:m:M:l:Sv")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      loops = atoi(optarg);
+      break;
+    case 'D':
+      if (CodecHandler_setPolicy(optarg) != 0)
+        errx(1, "invalid decoder policy %s", optarg);
+      break;
+    case 'm':
+      channels = atoi(optarg);
+      if (channels < 1 || channels > CODEC_MAX_CHANNELS)
+        errx(1, "output channels must be 1..%d", CODEC_MAX_CHANNELS);
+      break;
+    case 'M':
+      if ((mixFlags = mixer_parse(optarg)) < 0)
+        errx(1, "invalid mixing %s", optarg);
+      break;
+    case 'l':
+      if (meter_init(optarg) != 0)
+        errx(1, "invalid metering %s", optarg);
+      break;
+    case 'S':
+      readPadding = 1;
+      break;
+    case 'v':
+      debug_data = 1;
+      break;
+    default:
+      usage();
+    }
+  }
+
+  if (optind >= argc || loops < 1)
+    usage();
+
+  CodecHandler_setOutput(channels, mixFlags);
+
+  av_register_all();
+  avcodec_register_all();
+
+  for (int i = optind; i < argc; i++)
+    bench_file(argv[i], loops);
+
+  return 0;
+}
@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# startup-bench.sh
+#
+# Measures the time from process start to the first sample written, the
+# startup timeline spdif-decoder logs once every pipeline played. Every
+# input/output pair is started RUNS times with an empty startup cache (cold)
+# and RUNS times with the cache the previous run left (warm), the full
+# timeline of the last warm run is printed, headed by the board and kernel
+# so the block can go into the README as it is.
+#
+# usage: startup-bench.sh <input> <output> [runs] [spdif-decoder]
+#
+# e.g.   startup-bench.sh hw:CARD=Device dsp# 10
+#        startup-bench.sh file:corpus/ac3-5.1-448k.spdif null
+
+set -e
+
+INPUT=$1
+OUTPUT=$2
+RUNS=${3:-5}
+DECODER=${4:-./spdif-decoder}
+TMP=$(mktemp -d)
+
+trap 'rm -rf "$TMP"' EXIT
+
+[ -n "$INPUT" ] && [ -n "$OUTPUT" ] || { sed -n '3,16p' "$0"; exit 1; }
+
+run()
+{
+  timeout 3 "$DECODER" -i "$INPUT" -o "$OUTPUT" -s 0 -C "$TMP/cache" > "$TMP/log" 2>&1 || true
+  sed -n 's/^ *\([0-9.]*\) ms .*first sample written$/\1/p' "$TMP/log"
+}
+
+board()
+{
+  for f in /proc/device-tree/model /sys/class/dmi/id/product_name; do
+    [ -r "$f" ] && { tr -d '\0' < "$f"; return; }
+  done
+  uname -m
+}
+
+median()
+{
+  sort -n | awk '{ v[NR] = $1 } END { if (NR) print v[int((NR + 1) / 2)]; else print "-" }'
+}
+
+for i in $(seq "$RUNS"); do
+  rm -f "$TMP/cache"
+  run
+done > "$TMP/cold"
+
+for i in $(seq "$RUNS"); do
+  run
+done > "$TMP/warm"
+
+echo "$(board), $(uname -sr), $INPUT -> $OUTPUT"
+echo "first sample after (ms, median of $RUNS): cold $(median < "$TMP/cold"), warm $(median < "$TMP/warm")"
+echo
+sed -n '/startup timeline/,/first sample written/p' "$TMP/log"
@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+# transition-bench.sh
+#
+# Plays scripted input sequences with stream transitions through the full
+# loop (paced file input, null output) and prints the transition statistics
+# of spdif-decoder -T: time to first output sample after each switch, input
+# samples lost and time spent in sink open, initContext, loadCodec and
+# source reset.
+#
+# usage: transition-bench.sh [corpus-dir] [spdif-decoder]
+#
+# The corpus is generated with make-corpus.sh
+
+set -e
+
+CORPUS=${1:-corpus}
+DECODER=${2:-./spdif-decoder}
+SEG_BYTES=$((192 * 3000))     # 3 seconds at the 48kHz S16 stereo line rate
+TMP=$(mktemp -d)
+
+trap 'rm -rf "$TMP"' EXIT
+
+seg()
+{
+  head -c $SEG_BYTES "$CORPUS/$1"
+}
+
+sequence()
+{
+  name=$1
+  shift
+  for s in "$@"; do
+    seg "$s"
+  done > "$TMP/$name.raw"
+
+  echo "== $name: $*"
+  "$DECODER" -i "file:$TMP/$name.raw" -o null -s 0 -T | sed -n '/^transitions:/,$p'
+  echo
+}
+
+sequence pcm-ac3       pcm-2.0.raw        ac3-5.1-448k.spdif
+sequence ac3-2.0-5.1   ac3-2.0-192k.spdif ac3-5.1-448k.spdif ac3-2.0-192k.spdif
+sequence ac3-eac3      ac3-5.1-448k.spdif eac3-5.1-640k.spdif ac3-5.1-448k.spdif
+sequence ac3-pcm       ac3-5.1-448k.spdif pcm-2.0.raw
+sequence ac3-dts       ac3-5.1-448k.spdif dts-5.1.spdif
@@ -0,0 +1,182 @@
+/*
+ * burstcheck.c
+ *
+ * IEC 61937 payload validation, see burstcheck.h
+ */
+
+#include <pthread.h>
+
+#include "burstcheck.h"
+
+#define AC3_SYNC_SIZE  2          // the CRC covers the frame after the sync word
+
+static const char *reasons[BURSTCHECK_REASONS] = {"ok", "sync", "size", "crc"};
+
+// AC-3 frmsizecod >> 1
+static const uint16_t ac3_kbps[19] = {
+  32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512, 576, 640
+};
+
+// CRC-16 x^16 + x^15 + x^2 + 1, MSB first. crc[k] is the CRC of a byte followed by k zero bytes,
+// four bytes per step with one lookup each.
+static uint16_t crc[4][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+//--------------------------------------------------------------------------------------------------
+static void crc_init()
+{
+  for (int i = 0; i < 256; i++)
+  {
+    uint16_t c = i << 8;
+
+    for (int b = 0; b < 8; b++)
+      c = (c << 1) ^ (c & 0x8000 ? 0x8005 : 0);
+
+    crc[0][i] = c;
+  }
+
+  for (int k = 1; k < 4; k++)
+    for (int i = 0; i < 256; i++)
+      crc[k][i] = (uint16_t)(crc[k - 1][i] << 8) ^ crc[0][crc[k - 1][i] >> 8];
+}
+
+//--------------------------------------------------------------------------------------------------
+static uint16_t crc16(const uint8_t *p, int len)
+{
+  uint16_t c = 0;
+
+  for (; len >= 4; len -= 4, p += 4)
+    c = crc[3][(c >> 8) ^ p[0]] ^ crc[2][(c & 0xff) ^ p[1]] ^ crc[1][p[2]] ^ crc[0][p[3]];
+
+  for (; len > 0; len--)
+    c = (uint16_t)(c << 8) ^ crc[0][(c >> 8) ^ *p++];
+
+  return c;
+}
+
+//--------------------------------------------------------------------------------------------------
+// crc2 at the end makes the CRC of the whole frame after the sync word zero
+static int check_crc(const uint8_t *frame, int size)
+{
+  return crc16(frame + AC3_SYNC_SIZE, size - AC3_SYNC_SIZE) ? BURSTCHECK_CRC : BURSTCHECK_OK;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int check_ac3(const uint8_t *data, int size)
+{
+  if (size < 6 || data[0] != 0x0B || data[1] != 0x77)
+    return BURSTCHECK_SYNC;
+
+  int fscod = data[4] >> 6;
+  int frmsizecod = data[4] & 0x3f;
+  int bsid = data[5] >> 3;
+  int frame;
+
+  if (bsid > 10)
+    return BURSTCHECK_SYNC;
+
+  // half and quarter rate (bsid 9, 10) are left to the decoder
+  if (bsid > 8)
+    return BURSTCHECK_OK;
+
+  if (fscod == 3 || frmsizecod >= 38)
+    return BURSTCHECK_SIZE;
+
+  int kbps = ac3_kbps[frmsizecod >> 1];
+
+  if (fscod == 0)
+    frame = kbps * 4;                                     // 48kHz
+  else if (fscod == 1)
+    frame = (kbps * 96000 / 44100 + (frmsizecod & 1)) * 2; // 44.1kHz, in 16 bit words
+  else
+    frame = kbps * 6;                                     // 32kHz
+
+  if (frame > size)
+    return BURSTCHECK_SIZE;
+
+  return check_crc(data, frame);
+}
+
+//--------------------------------------------------------------------------------------------------
+// a burst carries several syncframes back to back
+static int check_eac3(const uint8_t *data, int size)
+{
+  int pos = 0;
+
+  while (size - pos >= 6)
+  {
+    const uint8_t *frame = data + pos;
+
+    if (frame[0] != 0x0B || frame[1] != 0x77 || (frame[5] >> 3) <= 10 || (frame[5] >> 3) > 16)
+      return BURSTCHECK_SYNC;
+
+    int bytes = (((frame[2] & 7) << 8 | frame[3]) + 1) * 2;
+
+    if (pos + bytes > size)
+      return BURSTCHECK_SIZE;
+
+    if (check_crc(frame, bytes) != BURSTCHECK_OK)
+      return BURSTCHECK_CRC;
+
+    pos += bytes;
+  }
+
+  // the burst length is rounded up to 16 bit
+  return pos == 0 ? BURSTCHECK_SYNC : size - pos < 2 ? BURSTCHECK_OK : BURSTCHECK_SIZE;
+}
+
+//--------------------------------------------------------------------------------------------------
+// the core has no mandatory CRC
+static int check_dts(const uint8_t *data, int size)
+{
+  int frame;
+
+  if (size < 8)
+    return BURSTCHECK_SYNC;
+
+  uint32_t sync = (uint32_t)data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+
+  switch (sync)
+  {
+  case 0x7FFE8001:
+    // 16 bit big endian
+    frame = ((data[5] & 3) << 12 | data[6] << 4 | data[7] >> 4) + 1;
+    break;
+  case 0xFE7F0180:
+    // 16 bit little endian
+    frame = ((data[4] & 3) << 12 | data[7] << 4 | data[6] >> 4) + 1;
+    break;
+  case 0x1FFFE800:
+  case 0xFF1F00E8:
+    // 14 bit packed, the size counts unpacked bytes
+    return BURSTCHECK_OK;
+  default:
+    return BURSTCHECK_SYNC;
+  }
+
+  return frame < 96 || frame > size ? BURSTCHECK_SIZE : BURSTCHECK_OK;
+}
+
+//--------------------------------------------------------------------------------------------------
+int burstcheck(enum AVCodecID codec, const uint8_t *data, int size)
+{
+  pthread_once(&crc_once, crc_init);
+
+  switch (codec)
+  {
+  case AV_CODEC_ID_AC3:
+    return check_ac3(data, size);
+  case AV_CODEC_ID_EAC3:
+    return check_eac3(data, size);
+  case AV_CODEC_ID_DTS:
+    return check_dts(data, size);
+  default:
+    return BURSTCHECK_OK;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+const char* burstcheck_reason(int reason)
+{
+  return reason >= 0 && reason < BURSTCHECK_REASONS ? reasons[reason] : "?";
+}
@@ -0,0 +1,23 @@
+/*
+ * burstcheck.h
+ *
+ * Payload validation of IEC 61937 bursts before they reach the decoder:
+ * AC-3 and E-AC-3 sync word, frame size and CRC, DTS sync word and frame
+ * size. A corrupt payload otherwise only shows as a decoder failure, which
+ * restarts the pipeline; a rejected burst is dropped and played as silence.
+ */
+
+#ifndef BURSTCHECK_H_
+#define BURSTCHECK_H_
+
+#include <stdint.h>
+#include <libavcodec/avcodec.h>
+
+enum { BURSTCHECK_OK, BURSTCHECK_SYNC, BURSTCHECK_SIZE, BURSTCHECK_CRC, BURSTCHECK_REASONS };
+
+// payload after the byte swap, as the decoder gets it. BURSTCHECK_OK for codecs without checks.
+int burstcheck(enum AVCodecID codec, const uint8_t *data, int size);
+
+const char* burstcheck_reason(int reason);
+
+#endif /* BURSTCHECK_H_ */
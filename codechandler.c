@@ -6,13 +6,138 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
 #include <errno.h>
 #include <err.h>
+#include <libavutil/cpu.h>
 #include "resample.h"
 #include "codechandler.h"
 #include "myspdif.h"
+#include "log.h"
 
-extern int debug_data;
+extern atomic_int debug_data;
+
+enum { POLICY_AUTO, POLICY_FLOAT, POLICY_FIXED };
+
+// codecs with a fixed-point decoder, its output is integer and skips swr, see resample_interleave()
+static struct {
+  enum AVCodecID id;
+  const char *name;
+  const char *floatDecoder;
+  const char *fixedDecoder;
+  int policy;
+} decoders[] = {
+  {AV_CODEC_ID_AC3, "ac3", "ac3",      "ac3_fixed", POLICY_AUTO},
+  {AV_CODEC_ID_AAC, "aac", "aac",      "aac_fixed", POLICY_AUTO},
+  {AV_CODEC_ID_MP1, "mp1", "mp1float", "mp1",       POLICY_AUTO},
+  {AV_CODEC_ID_MP2, "mp2", "mp2float", "mp2",       POLICY_AUTO},
+  {AV_CODEC_ID_MP3, "mp3", "mp3float", "mp3",       POLICY_AUTO},
+};
+
+#define DECODERS (sizeof(decoders) / sizeof(decoders[0]))
+
+static int outputChannels;        // 0 = no mixing
+static int outputMixFlags;
+
+//--------------------------------------------------------------------------------------------------
+static int parse_policy(const char *s, int len)
+{
+  if (len == 4 && !strncmp(s, "auto", 4))
+    return POLICY_AUTO;
+
+  if (len == 5 && !strncmp(s, "float", 5))
+    return POLICY_FLOAT;
+
+  if (len == 5 && !strncmp(s, "fixed", 5))
+    return POLICY_FIXED;
+
+  return -1;
+}
+
+//--------------------------------------------------------------------------------------------------
+int CodecHandler_setPolicy(const char *spec)
+{
+  for (const char *s = spec; *s; )
+  {
+    int len = strcspn(s, ",");
+    const char *eq = memchr(s, '=', len);
+    int found = 0;
+
+    if (!eq)
+    {
+      // all codecs
+      int policy = parse_policy(s, len);
+
+      if (policy < 0)
+        return -1;
+
+      for (unsigned i = 0; i < DECODERS; i++)
+        decoders[i].policy = policy;
+    }
+    else
+    {
+      int policy = parse_policy(eq + 1, len - (eq + 1 - s));
+
+      for (unsigned i = 0; i < DECODERS && policy >= 0; i++)
+      {
+        if (strlen(decoders[i].name) == (size_t)(eq - s) && !strncmp(decoders[i].name, s, eq - s))
+        {
+          decoders[i].policy = policy;
+          found = 1;
+        }
+      }
+
+      if (!found)
+        return -1;
+    }
+
+    s += len + (s[len] == ',');
+  }
+
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+void CodecHandler_setOutput(int channels, int mixFlags)
+{
+  outputChannels = channels;
+  outputMixFlags = mixFlags;
+}
+
+//--------------------------------------------------------------------------------------------------
+// the float decoders are fast with NEON, without it (ARMv6, some ARMv7) integer decoding wins
+static int prefer_fixed()
+{
+#if defined(__arm__)
+  return !(av_get_cpu_flags() & AV_CPU_FLAG_NEON);
+#else
+  return 0;
+#endif
+}
+
+//--------------------------------------------------------------------------------------------------
+static AVCodec* find_decoder(enum AVCodecID id)
+{
+  for (unsigned i = 0; i < DECODERS; i++)
+  {
+    if (decoders[i].id != id)
+      continue;
+
+    int fixed = decoders[i].policy == POLICY_FIXED || (decoders[i].policy == POLICY_AUTO && prefer_fixed());
+    const char *name = fixed ? decoders[i].fixedDecoder : decoders[i].floatDecoder;
+    AVCodec *codec = avcodec_find_decoder_by_name(name);
+
+    if (codec)
+      return codec;
+
+    log_printf("loadCodec: decoder %s not built into libavcodec, using the default\n", name);
+    break;
+  }
+
+  return avcodec_find_decoder(id);
+}
 
 void CodecHandler_init(CodecHandler* h)
 {
@@ -21,16 +146,21 @@ void CodecHandler_init(CodecHandler* h)
 	h->currentChannelCount = 0;
 	h->currentCodecID = AV_CODEC_ID_NONE;
 	h->currentSampleRate = 0;
+	h->pcmSampleRate = 0;
+	h->mix.in_channels = 0;
 	h->swr = resample_init();
 	h->frame = av_frame_alloc();
+	h->pcmIn = malloc(MAX_BURST_SIZE);
+
+	if(!h->pcmIn)
+		errx(1, "cannot allocate PCM input buffer");
 }
 
 //--------------------------------------------------------------------------------------------------
-char error_bfufer[1024];
-char* my_av_strerror(int err) 
+char* my_av_strerror(int err, char *buf, int size)
 {
-  av_strerror(err, error_bfufer, sizeof(error_bfufer));
-  return error_bfufer;
+  av_strerror(err, buf, size);
+  return buf;
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -38,12 +168,15 @@ void CodecHandler_deinit(CodecHandler* h)
 {
 	resample_deinit(h->swr);
 	av_frame_free(&h->frame);
+	free(h->pcmIn);
+	h->pcmIn = NULL;
 }
 
 //--------------------------------------------------------------------------------------------------
 int CodecHandler_loadCodec(CodecHandler * handler, AVFormatContext * formatcontext)
 {
   int err;
+  char msg[AV_ERROR_MAX_STRING_SIZE];
 
 	if (formatcontext->nb_streams == 0)
     errx(1, "loadCodec: no stream\n");
@@ -54,17 +187,17 @@ int CodecHandler_loadCodec(CodecHandler * handler, AVFormatContext * formatconte
 		return 0;
 	}
 
-  if(debug_data) printf("loadCodec %s\n", avcodec_get_name(formatcontext->streams[0]->codec->codec_id));
+  if(debug_data) log_printf("loadCodec %s\n", avcodec_get_name(formatcontext->streams[0]->codec->codec_id));
 
 	if(handler->codecContext) 
   {
-    if(debug_data) printf("loadCodec closeCodec\n");    
+    if(debug_data) log_printf("loadCodec closeCodec\n");    
 		CodecHandler_closeCodec(handler);
   }
 
 	handler->currentCodecID = AV_CODEC_ID_NONE;
 
-	handler->codec = avcodec_find_decoder(formatcontext->streams[0]->codec->codec_id);
+	handler->codec = find_decoder(formatcontext->streams[0]->codec->codec_id);
 
 	if (!handler->codec) 
     errx(1, "loadCodec: could not find codec\n");
@@ -84,7 +217,7 @@ int CodecHandler_loadCodec(CodecHandler * handler, AVFormatContext * formatconte
   }
 
 	if ((err = avcodec_open2(handler->codecContext, handler->codec, NULL)) != 0)
-		errx(1, "loadCodec: cannot open codec %s", my_av_strerror(err));
+		errx(1, "loadCodec: cannot open codec %s", my_av_strerror(err, msg, sizeof(msg)));
 
 	handler->currentCodecID = formatcontext->streams[0]->codec->codec_id;
 
@@ -92,17 +225,19 @@ int CodecHandler_loadCodec(CodecHandler * handler, AVFormatContext * formatconte
 }
 
 //--------------------------------------------------------------------------------------------------
-int CodecHandler_decodeCodec(CodecHandler * h, AVPacket * pkt, uint8_t *outbuffer, uint32_t* bufferfilled)
+int CodecHandler_decodeFrame(CodecHandler * h, AVPacket * pkt)
 {
 	int got_frame;
 
-  if(debug_data) printf("decodeCodec decode_audio4 %d bytes\n", pkt->size);
+  if(debug_data) log_printf("decodeFrame decode_audio4 %d bytes\n", pkt->size);
 
 	int processed_len = avcodec_decode_audio4(h->codecContext, h->frame, &got_frame, pkt);
 
 	if (processed_len < 0) 
   {
-    printf("cannot decode input: %s\n", my_av_strerror(processed_len));
+    char msg[AV_ERROR_MAX_STRING_SIZE];
+
+    log_printf("cannot decode input: %s\n", my_av_strerror(processed_len, msg, sizeof(msg)));
     return SPIF_DECODER_RESTART_REQUIRED;
   }
 
@@ -112,7 +247,7 @@ int CodecHandler_decodeCodec(CodecHandler * h, AVPacket * pkt, uint8_t *outbuffe
 	pkt->size -= processed_len;
 
 	if(!h->codecContext->sample_rate) {
-		printf("decodeCodec: no sample rate > restart\n");
+		log_printf("decodeFrame: no sample rate > restart\n");
 		return SPIF_DECODER_RESTART_REQUIRED;
 	}
 
@@ -121,42 +256,165 @@ int CodecHandler_decodeCodec(CodecHandler * h, AVPacket * pkt, uint8_t *outbuffe
      h->currentChannelLayout != h->codecContext->channel_layout  ||
 		 h->currentSampleFormat  != h->codecContext->sample_fmt         )
   {
-    if(debug_data) printf("decodeCodec loadFromCodec\n");
+    if(debug_data) log_printf("decodeFrame loadFromCodec\n");
 
 		resample_loadFromCodec(h->swr, h->codecContext);
+		h->pcmSampleRate = 0;
 
     if(debug_data && h->currentChannelCount && h->currentChannelCount  != h->codecContext->channels)
-      printf("channels changed: %d > %d, channel-layout:%08x > %08x\n", h->currentChannelCount, h->codecContext->channels, h->currentChannelLayout, h->codecContext->channel_layout);
+      log_printf("channels changed: %d > %d, channel-layout:%08llx > %08llx\n", h->currentChannelCount, h->codecContext->channels, (unsigned long long)h->currentChannelLayout, (unsigned long long)h->codecContext->channel_layout);
 
 		ret = 1;
 	}
 
-  if(debug_data) printf("decodeCodec swr_convert\n");
+	h->currentChannelCount  = h->codecContext->channels;
+	h->currentSampleRate    = h->codecContext->sample_rate;
+	h->currentChannelLayout = h->codecContext->channel_layout;
+	h->currentSampleFormat  = h->codecContext->sample_fmt;
+
+	return ret;
+}
 
-  int samples = swr_convert(h->swr, &outbuffer, h->frame->nb_samples, (const uint8_t **)h->frame->data, h->frame->nb_samples);
-	if(samples < 0)
-	{
-		printf("decodeCodec: swr_convert failed > restart (%s)\n", my_av_strerror(samples));
-		return SPIF_DECODER_RESTART_REQUIRED;
-	}
+//--------------------------------------------------------------------------------------------------
+// once per layout change
+static void setup_mixer(CodecHandler * h, uint64_t layout, int channels)
+{
+  if(h->mix.in_channels == channels && h->mix.in_layout == layout)
+    return;
 
-  if(debug_data) printf("decodeCodec get_buffer_size\n");
+  mixer_setup(&h->mix, layout, channels, outputChannels, outputMixFlags);
+
+  if(!h->mix.identity)
+    log_printf("mixer: %d channels (%08llx) > %d, %s, kernel %s\n", channels, (unsigned long long)layout, outputChannels,
+      outputMixFlags & MIXER_LTRT ? "LtRt" : "LoRo", h->mix.kernel_name);
+}
+
+//--------------------------------------------------------------------------------------------------
+int CodecHandler_convertFrame(CodecHandler * h, uint8_t *outbuffer, uint32_t* bufferfilled)
+{
+  if(debug_data) log_printf("convertFrame swr_convert\n");
+
+  if(h->codecContext->channels < 1)
+  {
+    log_printf("convertFrame: no channels > restart\n");
+    return SPIF_DECODER_RESTART_REQUIRED;
+  }
+
+  int channels = h->codecContext->channels;
+  int outChannels = outputChannels ? outputChannels : channels;
+
+  // mixed in place after interleaving, the buffer holds the wider of both
+  int maxSamples = CODEC_MAX_OUTPUT_SIZE / 2 / FFMAX(channels, outChannels);
+  int resampling = h->codecContext->sample_rate != RESAMPLE_OUTPUT_RATE;
+  int samples = h->frame->nb_samples;
+  int outMax = maxSamples;
+
+  // the output buffer limits the resampled frame, swr keeps what does not fit for the next call
+  if(resampling)
+    maxSamples = (int64_t)maxSamples * h->codecContext->sample_rate / RESAMPLE_OUTPUT_RATE;
+
+  if(h->frame->nb_samples > maxSamples)
+  {
+    log_printf("convertFrame: frame of %d samples truncated to %d\n", h->frame->nb_samples, maxSamples);
+    h->frame->nb_samples = samples = maxSamples;
+  }
+
+  if(outputChannels)
+    setup_mixer(h, h->codecContext->channel_layout, channels);
+
+  int mixing = outputChannels && !h->mix.identity;
+
+  if(mixing && !resampling && h->frame->format == AV_SAMPLE_FMT_FLTP)
+  {
+    // the float decoders' planar output is mixed and interleaved in one pass
+    mixer_planar(&h->mix, (const float **)h->frame->extended_data, (int16_t*)outbuffer, samples);
+  }
+  else
+  {
+    // integer output of the fixed-point decoders is interleaved directly
+    if(resampling || resample_interleave(h->frame, channels, outbuffer) != 0)
+    {
+      samples = swr_convert(h->swr, &outbuffer, outMax, (const uint8_t **)h->frame->data, h->frame->nb_samples);
+    	if(samples < 0)
+    	{
+    		char msg[AV_ERROR_MAX_STRING_SIZE];
+
+    		log_printf("convertFrame: swr_convert failed > restart (%s)\n", my_av_strerror(samples, msg, sizeof(msg)));
+    		return SPIF_DECODER_RESTART_REQUIRED;
+    	}
+    }
+
+    if(mixing)
+      mixer_interleaved(&h->mix, (int16_t*)outbuffer, samples);
+  }
+
+  if(debug_data) log_printf("convertFrame get_buffer_size\n");
 
 	*bufferfilled = av_samples_get_buffer_size(NULL,
-			   h->codecContext->channels,
-			   h->frame->nb_samples,
+			   outChannels,
+			   samples,
 			   AV_SAMPLE_FMT_S16,
 			   1);
 
-	h->currentChannelCount  = h->codecContext->channels;
-	h->currentSampleRate    = h->codecContext->sample_rate;
-	h->currentChannelLayout = h->codecContext->channel_layout;
-	h->currentSampleFormat  = h->codecContext->sample_fmt;
+  if(debug_data) log_printf("convertFrame done\n");
+	return 0;
+}
 
-  if(debug_data) printf("decodeCodec done\n");
-	return ret;
+//--------------------------------------------------------------------------------------------------
+static int resample_pcm(CodecHandler * h, int sampleRate, uint8_t *buffer, uint32_t* bufferfilled)
+{
+  if(h->pcmSampleRate != sampleRate)
+  {
+    resample_loadPcm(h->swr, sampleRate);
+    h->pcmSampleRate = sampleRate;
+
+    // the next decoded frame sets swr up again
+    h->currentSampleFormat = AV_SAMPLE_FMT_NONE;
+  }
+
+  // swr does not convert in place, a PCM chunk is at most one burst
+  if(*bufferfilled > MAX_BURST_SIZE)
+    *bufferfilled = MAX_BURST_SIZE;
+
+  const uint8_t *src = h->pcmIn;
+
+  memcpy(h->pcmIn, buffer, *bufferfilled);
+
+  int outMax = CODEC_MAX_OUTPUT_SIZE / 2 / FFMAX(2, outputChannels);
+  int samples = swr_convert(h->swr, &buffer, outMax, &src, *bufferfilled / 4);
+
+  if(samples < 0)
+  {
+    char msg[AV_ERROR_MAX_STRING_SIZE];
+
+    log_printf("convertPcm: swr_convert failed > restart (%s)\n", my_av_strerror(samples, msg, sizeof(msg)));
+    return SPIF_DECODER_RESTART_REQUIRED;
+  }
+
+  *bufferfilled = samples * 4;
+  return 0;
 }
 
+//--------------------------------------------------------------------------------------------------
+int CodecHandler_convertPcm(CodecHandler * h, int sampleRate, uint8_t *buffer, uint32_t* bufferfilled)
+{
+  if(sampleRate != RESAMPLE_OUTPUT_RATE && resample_pcm(h, sampleRate, buffer, bufferfilled) != 0)
+    return SPIF_DECODER_RESTART_REQUIRED;
+
+  if(!outputChannels)
+    return 0;
+
+  int samples = *bufferfilled / 4;
+
+  if(samples > CODEC_MAX_OUTPUT_SIZE / 2 / outputChannels)
+    samples = CODEC_MAX_OUTPUT_SIZE / 2 / outputChannels;
+
+  setup_mixer(h, AV_CH_LAYOUT_STEREO, 2);
+  mixer_interleaved(&h->mix, (int16_t*)buffer, samples);
+
+  *bufferfilled = samples * 2 * outputChannels;
+  return 0;
+}
 
 //--------------------------------------------------------------------------------------------------
 int CodecHandler_closeCodec(CodecHandler * handler)
@@ -11,6 +11,17 @@
 #include <libavformat/avformat.h>
 #include <libswresample/swresample.h>
 #include <libavutil/frame.h>
+#include "mixer.h"
+#include "resample.h"
+
+// output buffer limits: one decoded frame (DTS up to 4096 samples, AC-3 1536) of up to 8 channels
+// S16 after resampling to RESAMPLE_OUTPUT_RATE. The largest ratio is 1.5 from 32kHz (AC-3, DTS),
+// longer frames at lower rates are truncated.
+#define CODEC_MAX_FRAME_SAMPLES 4096
+#define CODEC_MIN_FRAME_RATE    32000
+#define CODEC_MAX_CHANNELS      8
+#define CODEC_MAX_OUTPUT_SAMPLES (CODEC_MAX_FRAME_SAMPLES * RESAMPLE_OUTPUT_RATE / CODEC_MIN_FRAME_RATE)
+#define CODEC_MAX_OUTPUT_SIZE   (CODEC_MAX_OUTPUT_SAMPLES * CODEC_MAX_CHANNELS * 2)
 
 typedef struct s_codechandler{
 	AVCodecContext *codecContext;
@@ -20,19 +31,41 @@ typedef struct s_codechandler{
 	uint64_t currentChannelLayout;
 	int currentSampleRate;
 	enum AVSampleFormat currentSampleFormat;
+	int pcmSampleRate;            // swr is set up for raw PCM at this rate, 0 = for the codec
 	SwrContext * swr;
 	AVFrame * frame;
+	mixer mix;                    // set up for the current layout, with CodecHandler_setOutput()
+	uint8_t *pcmIn;               // MAX_BURST_SIZE, swr input for PCM, it does not convert in place
 } CodecHandler;
 
+// decoder selection for codecs with a fixed-point decoder (ac3, aac, mp1, mp2, mp3): "auto",
+// "float", "fixed" for all of them or per codec, e.g. "ac3=fixed,aac=float". auto picks the
+// fixed-point decoder on ARM cores without NEON. Set once before any codec is loaded, -1 on
+// a bad spec.
+int CodecHandler_setPolicy(const char *spec);
+
+// every layout mixed into channels (0 = the stream's own layout, default) with the MIXER_* flags.
+// Set once before any handler converts.
+void CodecHandler_setOutput(int channels, int mixFlags);
+
 void CodecHandler_init(CodecHandler* handler);
 void CodecHandler_deinit(CodecHandler* handler);
 
 int CodecHandler_loadCodec(CodecHandler * handler, AVFormatContext * formatcontext);
 int CodecHandler_hasCodecChangend(CodecHandler * handler, AVFormatContext * formatcontext);
 
-int CodecHandler_decodeCodec(CodecHandler * h, AVPacket * pkt,
-		uint8_t *outbuffer, uint32_t* bufferfilled);
+// decoding takes two stages: decode a packet into h->frame, then convert the frame to interleaved
+// S16 mixed to the CodecHandler_setOutput() channels, outbuffer holds CODEC_MAX_OUTPUT_SIZE bytes
+int CodecHandler_decodeFrame(CodecHandler * h, AVPacket * pkt);
+int CodecHandler_convertFrame(CodecHandler * h, uint8_t *outbuffer, uint32_t* bufferfilled);
+
+// raw S16 stereo PCM at sampleRate to RESAMPLE_OUTPUT_RATE and the CodecHandler_setOutput() channels
+// in place, bufferfilled in and out. Untouched at the output rate without output channels.
+int CodecHandler_convertPcm(CodecHandler * h, int sampleRate, uint8_t *buffer, uint32_t* bufferfilled);
 int CodecHandler_closeCodec(CodecHandler * handler);
 
+// av_strerror() into the caller's buffer, pipelines log errors from their own threads
+char* my_av_strerror(int err, char *buf, int size);
+
 
 #endif /* CODECHANDLER_H_ */
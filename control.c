@@ -0,0 +1,299 @@
+/*
+ * control.c
+ *
+ * Runtime reconfiguration, see control.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "control.h"
+#include "log.h"
+
+extern atomic_int debug_data;
+
+typedef struct {
+  atomic_int pending_mask;
+  control_config pending;
+  control_config current;
+  int locked;                       // no commands, see control_lock()
+} control_pipeline;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static control_pipeline pipelines[CONTROL_MAX_PIPELINES];
+static int npipelines;
+
+//--------------------------------------------------------------------------------------------------
+void control_init(int pipeline, const control_config *cfg)
+{
+  pthread_mutex_lock(&lock);
+  pipelines[pipeline].current = *cfg;
+  pipelines[pipeline].pending = *cfg;
+
+  if (pipeline >= npipelines)
+    npipelines = pipeline + 1;
+
+  pthread_mutex_unlock(&lock);
+}
+
+//--------------------------------------------------------------------------------------------------
+void control_lock(int pipeline)
+{
+  pthread_mutex_lock(&lock);
+  pipelines[pipeline].locked = 1;
+  pthread_mutex_unlock(&lock);
+}
+
+//--------------------------------------------------------------------------------------------------
+static int parse_int(const char *s, int min, int max, int *value)
+{
+  char *end;
+  long v = strtol(s, &end, 10);
+
+  if (end == s || *end || v < min || v > max)
+    return -1;
+
+  *value = v;
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+int control_parse_latency(const char *s, int *min, int *max)
+{
+  char *end;
+
+  if (!strcmp(s, "off"))
+  {
+    *min = *max = 0;
+    return 0;
+  }
+
+  long lo = strtol(s, &end, 10);
+
+  if (end == s || *end != ':')
+    return -1;
+
+  s = end + 1;
+  long hi = strtol(s, &end, 10);
+
+  if (end == s || *end || lo < 1 || hi < lo || hi > 1000)
+    return -1;
+
+  *min = lo;
+  *max = hi;
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// the spec is echoed in JSON replies, keep it to printable characters without quoting
+static int valid_spec(const char *s)
+{
+  if (!*s || strlen(s) >= CONTROL_SPEC_SIZE)
+    return 0;
+
+  for (; *s; s++)
+    if (*s < 0x20 || *s == '"' || *s == '\\' || *s == 0x7f)
+      return 0;
+
+  return 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+// the socket is not authenticated: an output writing to a path would let any local client create
+// and truncate files as the service user. That rules out file: and stdout, and the file and tee
+// plugins of an ALSA device. A net: output forwards raw input, a decoding pipeline cannot feed it.
+static int allowed_output(const char *s)
+{
+  if (!strncmp(s, "net:", 4))
+    return 0;
+
+  if (!strncmp(s, "alsa:", 5))
+    s += 5;
+
+  return strcmp(s, "-") && !strstr(s, "file") && !strstr(s, "FILE") && !strstr(s, "tee:");
+}
+
+//--------------------------------------------------------------------------------------------------
+// "off" or a comma separated list of codec names
+static int valid_codecs(const char *s)
+{
+  if (!*s || strlen(s) >= CONTROL_CODECS_SIZE)
+    return 0;
+
+  for (; *s; s++)
+    if (!(*s >= 'a' && *s <= 'z') && !(*s >= '0' && *s <= '9') && *s != ',' && *s != '_')
+      return 0;
+
+  return 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int format_config(int p, char *reply, int size)
+{
+  control_config c;
+
+  pthread_mutex_lock(&lock);
+  c = pipelines[p].current;
+  pthread_mutex_unlock(&lock);
+
+  return snprintf(reply, size,
+    "{\"event\":\"config\", \"pipeline\":%d, \"buffer_ms\":%d, \"catchup_ms\":%d, \"latency_min_ms\":%d, \"latency_max_ms\":%d, "
+    "\"verbose\":%d, \"output\":\"%s\", \"passthrough\":\"%s\"}\n",
+    p, c.buffer_time, c.catchup_ms, c.latency_min, c.latency_max, atomic_load(&debug_data), c.output, c.passthrough);
+}
+
+//--------------------------------------------------------------------------------------------------
+static int reply_error(char *reply, int size, const char *error)
+{
+  return snprintf(reply, size, "{\"event\":\"control\", \"ok\":false, \"error\":\"%s\"}\n", error);
+}
+
+//--------------------------------------------------------------------------------------------------
+// the debug log is shared by all pipelines, set right away for all of them
+static int set_verbose(const char *arg, int prefixed, char *reply, int size)
+{
+  int value;
+
+  if (prefixed)
+    return reply_error(reply, size, "verbose is not per pipeline");
+
+  if (parse_int(arg, 0, 1, &value) != 0)
+    return reply_error(reply, size, "invalid setting");
+
+  atomic_store(&debug_data, value);
+  log_printf("control: set verbose %d\n", value);
+
+  return snprintf(reply, size, "{\"event\":\"control\", \"ok\":true}\n");
+}
+
+//--------------------------------------------------------------------------------------------------
+int control_command(const char *line, char *reply, int size)
+{
+  char key[16];
+  int value, n = 0, p = 0, prefixed = 0;
+
+  // optional pipeline prefix
+  if (sscanf(line, "%d %n", &p, &n) == 1)
+  {
+    if (p < 0 || p >= npipelines)
+      return reply_error(reply, size, "no such pipeline");
+
+    line += n;
+    n = 0;
+    prefixed = 1;
+  }
+
+  control_pipeline *cp = &pipelines[p];
+
+  if (!strcmp(line, "config"))
+    return format_config(p, reply, size);
+
+  if (sscanf(line, "set %15s %n", key, &n) != 1 || !n)
+    return reply_error(reply, size, "unknown command");
+
+  if (!strcmp(key, "verbose"))
+    return set_verbose(line + n, prefixed, reply, size);
+
+  pthread_mutex_lock(&lock);
+  int locked = cp->locked;
+  pthread_mutex_unlock(&lock);
+
+  if (locked)
+    return reply_error(reply, size, "pipeline takes no commands");
+
+  const char *arg = line + n;
+  int mask;
+
+  if (!strcmp(key, "output") && !allowed_output(arg))
+    return reply_error(reply, size, "output not allowed");
+
+  pthread_mutex_lock(&lock);
+
+  if (!strcmp(key, "buffer") && parse_int(arg, 1, 2000, &value) == 0)
+  {
+    cp->pending.buffer_time = value;
+    mask = CONTROL_BUFFER;
+  }
+  else if (!strcmp(key, "catchup") && parse_int(arg, 1, 1000, &value) == 0)
+  {
+    cp->pending.catchup_ms = value;
+    mask = CONTROL_CATCHUP;
+  }
+  else if (!strcmp(key, "latency") && control_parse_latency(arg, &cp->pending.latency_min, &cp->pending.latency_max) == 0)
+  {
+    mask = CONTROL_LATENCY;
+  }
+  else if (!strcmp(key, "output") && valid_spec(arg))
+  {
+    snprintf(cp->pending.output, sizeof(cp->pending.output), "%s", arg);
+    mask = CONTROL_OUTPUT;
+  }
+  else if (!strcmp(key, "passthrough") && valid_codecs(arg))
+  {
+    snprintf(cp->pending.passthrough, sizeof(cp->pending.passthrough), "%s", strcmp(arg, "off") ? arg : "");
+    mask = CONTROL_PASSTHROUGH;
+  }
+  else
+    mask = 0;
+
+  if (mask)
+    atomic_fetch_or_explicit(&cp->pending_mask, mask, memory_order_release);
+
+  pthread_mutex_unlock(&lock);
+
+  if (!mask)
+    return reply_error(reply, size, "invalid setting");
+
+  log_printf("control: pipeline %d: %s\n", p, line);
+
+  return snprintf(reply, size, "{\"event\":\"control\", \"ok\":true}\n");
+}
+
+//--------------------------------------------------------------------------------------------------
+int control_pending(int pipeline)
+{
+  return atomic_load_explicit(&pipelines[pipeline].pending_mask, memory_order_relaxed) != 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+int control_take(int pipeline, control_config *cfg)
+{
+  control_pipeline *cp = &pipelines[pipeline];
+
+  pthread_mutex_lock(&lock);
+
+  int mask = atomic_exchange_explicit(&cp->pending_mask, 0, memory_order_acquire);
+
+  if (mask & CONTROL_BUFFER)
+    cfg->buffer_time = cp->pending.buffer_time;
+
+  if (mask & CONTROL_CATCHUP)
+    cfg->catchup_ms = cp->pending.catchup_ms;
+
+  if (mask & CONTROL_LATENCY)
+  {
+    cfg->latency_min = cp->pending.latency_min;
+    cfg->latency_max = cp->pending.latency_max;
+  }
+
+  if (mask & CONTROL_OUTPUT)
+    memcpy(cfg->output, cp->pending.output, sizeof(cfg->output));
+
+  if (mask & CONTROL_PASSTHROUGH)
+    memcpy(cfg->passthrough, cp->pending.passthrough, sizeof(cfg->passthrough));
+
+  pthread_mutex_unlock(&lock);
+
+  return mask;
+}
+
+//--------------------------------------------------------------------------------------------------
+void control_applied(int pipeline, const control_config *cfg)
+{
+  pthread_mutex_lock(&lock);
+  pipelines[pipeline].current = *cfg;
+  pthread_mutex_unlock(&lock);
+}
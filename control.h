@@ -0,0 +1,71 @@
+/*
+ * control.h
+ *
+ * Runtime reconfiguration. Commands arrive as lines on the status socket,
+ * the status thread only validates them and stores them as pending. The
+ * audio loop picks them up at the next burst boundary and rebuilds the
+ * affected stage, capture and decode keep running.
+ *
+ * With several pipelines a command can be prefixed with the pipeline number,
+ * e.g. "1 set output dsp", the default is pipeline 0.
+ *
+ *   set buffer <ms>       output buffer time, reopens the output
+ *   set catchup <ms>      output latency above which frames are dropped
+ *   set latency <min>:<max>|off  adapt the catchup level within the bounds,
+ *                         see latency.h and -a
+ *   set output <spec>     output device, see backend.h; not file:, net: or - (stdout)
+ *   set passthrough <codecs>|off  comma separated codec names or "all" to
+ *                         forward undecoded, see -p
+ *   set verbose 0|1       process wide, takes no pipeline prefix
+ *   config                current configuration
+ *
+ * A forwarding pipeline (net: output) has nothing to reconfigure, it only
+ * answers config.
+ */
+
+#ifndef CONTROL_H_
+#define CONTROL_H_
+
+#define CONTROL_SPEC_SIZE  256
+#define CONTROL_CODECS_SIZE 64
+#define CONTROL_MAX_PIPELINES 8
+
+enum {
+  CONTROL_BUFFER  = 1 << 0,
+  CONTROL_CATCHUP = 1 << 1,
+  CONTROL_OUTPUT  = 1 << 2,
+  CONTROL_PASSTHROUGH = 1 << 4,
+  CONTROL_LATENCY = 1 << 5,
+};
+
+typedef struct {
+  int buffer_time;                  // ms
+  int catchup_ms;
+  int latency_min;                  // adaptive catchup bounds in ms, 0 = fixed catchup_ms
+  int latency_max;
+  char output[CONTROL_SPEC_SIZE];
+  char passthrough[CONTROL_CODECS_SIZE];  // codec names, empty = decode everything
+} control_config;
+
+// initial configuration of a pipeline as given on the command line
+void control_init(int pipeline, const control_config *cfg);
+
+// the pipeline refuses set commands, it never polls for them
+void control_lock(int pipeline);
+
+// "<min>:<max>" in ms or "off" (0:0), -1 if invalid
+int control_parse_latency(const char *s, int *min, int *max);
+
+// called by the status thread with one line, writes a JSON reply line
+int control_command(const char *line, char *reply, int size);
+
+// audio loop: cheap check for pending changes
+int control_pending(int pipeline);
+
+// audio loop: merge pending changes into cfg, returns the CONTROL_* mask of changed fields
+int control_take(int pipeline, control_config *cfg);
+
+// audio loop: report the configuration in effect after applying
+void control_applied(int pipeline, const control_config *cfg);
+
+#endif /* CONTROL_H_ */
@@ -0,0 +1,254 @@
+/*
+ * fault.c
+ *
+ * Fault injection, see fault.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fault.h"
+#include "log.h"
+#include "myspdif.h"
+
+#define FAULT_DEFAULT_PERIOD_MS 10000
+#define FAULT_SETTLE_MS         5000    // startup, before the first fault
+#define FAULT_STEADY_MS         1000    // output without gaps after a fault
+#define LINE_BYTES_PER_MS       192     // 48kHz S16 stereo
+
+static struct {
+  const char *name;
+  int param;                    // default
+} types[FAULTS] = {
+  {"drop",      1001},
+  {"corrupt",   8},
+  {"silence",   300},
+  {"codec",     0},
+  {"decode",    0},
+  {"xrun_in",   0},
+  {"xrun_out",  0},
+  {"delay",     100},
+  {"slow_open", 500},
+};
+
+typedef struct {
+  double period;                // ms, 0 = off
+  int param;
+  double next;                  // due time
+  unsigned injected;
+  unsigned recovered;
+  double sum, max;              // recovery ms
+} fault_state;
+
+int fault_enabled = 0;
+
+static fault_state faults[FAULTS];
+static int pending = -1;        // fault in flight
+static double pending_since;
+static double gap_end;          // first write after the last gap
+static double last_write;
+static int last_frames;
+static int drop_left, zero_left;
+static uint32_t seed = 1;
+
+//--------------------------------------------------------------------------------------------------
+// reproducible between runs
+static uint32_t next_random()
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int find_type(const char *s, int len)
+{
+  for (int i = 0; i < FAULTS; i++)
+    if ((int)strlen(types[i].name) == len && !strncmp(types[i].name, s, len))
+      return i;
+
+  return -1;
+}
+
+//--------------------------------------------------------------------------------------------------
+int fault_init(const char *spec)
+{
+  double now = monotonic_ms();
+
+  for (const char *s = spec; *s; )
+  {
+    int len = strcspn(s, ",");
+    int name = strcspn(s, "@:,");
+    double period = FAULT_DEFAULT_PERIOD_MS;
+    int param = -1;
+    int all = name == 3 && !strncmp(s, "all", 3);
+    int type = all ? 0 : find_type(s, name);
+    char *end;
+
+    if (type < 0)
+      return -1;
+
+    const char *p = s + name;
+
+    if (*p == '@')
+    {
+      period = strtod(p + 1, &end) * 1000;
+      p = end;
+
+      if (period <= 0)
+        return -1;
+    }
+
+    if (*p == ':' && !all)
+    {
+      param = strtol(p + 1, &end, 10);
+      p = end;
+
+      if (param < 0)
+        return -1;
+    }
+
+    if (p != s + len)
+      return -1;
+
+    for (int i = type; i < (all ? FAULTS : type + 1); i++)
+    {
+      faults[i].period = period;
+      faults[i].param = param >= 0 ? param : types[i].param;
+
+      // staggered, one fault in flight at a time anyway
+      faults[i].next = now + FAULT_SETTLE_MS + i * 1000;
+    }
+
+    s += len + (s[len] == ',');
+  }
+
+  fault_enabled = 1;
+
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+int fault_fire(int type, int *param)
+{
+  fault_state *f = &faults[type];
+
+  if (!fault_enabled || !f->period || pending >= 0)
+    return 0;
+
+  double now = monotonic_ms();
+
+  if (now < f->next)
+    return 0;
+
+  f->next = now + f->period;
+  f->injected++;
+
+  pending = type;
+  pending_since = now;
+  gap_end = 0;
+  last_write = 0;
+
+  if (param)
+    *param = f->param;
+
+  log_printf("fault: %s injected\n", types[type].name);
+
+  return 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+int fault_input(uint8_t *buf, int n)
+{
+  int param;
+
+  if (!fault_enabled || n <= 0)
+    return n;
+
+  if (fault_fire(FAULT_CORRUPT, &param))
+    for (int i = 0; i < param; i++)
+      buf[next_random() % n] ^= 1 << next_random() % 8;
+
+  if (fault_fire(FAULT_DROP, &param))
+    drop_left = param;
+
+  if (fault_fire(FAULT_SILENCE, &param))
+    zero_left = param * LINE_BYTES_PER_MS;
+
+  if (zero_left)
+  {
+    int k = zero_left < n ? zero_left : n;
+
+    memset(buf, 0, k);
+    zero_left -= k;
+  }
+
+  if (drop_left)
+  {
+    // a read of 0 bytes would be taken for the end of the input
+    int k = drop_left < n - 1 ? drop_left : n - 1;
+
+    memmove(buf, buf + k, n - k);
+    drop_left -= k;
+    n -= k;
+  }
+
+  return n;
+}
+
+//--------------------------------------------------------------------------------------------------
+void fault_output(int frames, int rate)
+{
+  if (!fault_enabled || pending < 0 || rate <= 0)
+    return;
+
+  double now = monotonic_ms();
+
+  // a gap: more than half a write late
+  if (!last_write || now - last_write > last_frames * 1500.0 / rate + 10)
+    gap_end = now;
+
+  last_write = now;
+  last_frames = frames;
+
+  if (now - gap_end < FAULT_STEADY_MS)
+    return;
+
+  fault_state *f = &faults[pending];
+  double ms = gap_end - pending_since;
+
+  f->recovered++;
+  f->sum += ms;
+
+  if (ms > f->max)
+    f->max = ms;
+
+  log_printf("fault: %s recovered in %.1f ms\n", types[pending].name, ms);
+  pending = -1;
+}
+
+//--------------------------------------------------------------------------------------------------
+// log_report() is not rate limited
+void fault_report()
+{
+  if (!fault_enabled)
+    return;
+
+  log_report("faults:\n");
+  log_report("  %-10s %8s %9s %12s %12s\n", "type", "injected", "recovered", "mean ms", "max ms");
+
+  for (int i = 0; i < FAULTS; i++)
+  {
+    fault_state *f = &faults[i];
+
+    if (!f->period)
+      continue;
+
+    log_report("  %-10s %8u %9u %12.1f %12.1f\n", types[i].name, f->injected, f->recovered,
+      f->recovered ? f->sum / f->recovered : 0.0, f->max);
+  }
+
+  if (pending >= 0)
+    log_report("  %s still recovering after %.1f ms\n", types[pending].name, monotonic_ms() - pending_since);
+}
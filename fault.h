@@ -0,0 +1,50 @@
+/*
+ * fault.h
+ *
+ * Fault injection (-F) for the recovery paths: input bytes dropped,
+ * corrupted or replaced by silence, a fake codec change, a decoder failure,
+ * ALSA overruns and underruns (EPIPE into snd_pcm_recover()), delayed
+ * output writes and slow output opens, each on its own schedule. Only one
+ * fault is in flight at a time; it counts as recovered once the output has
+ * been written without gaps for a second, the recovery time runs from the
+ * injection to the end of the last gap. A report per fault type is logged
+ * at exit, see bench/soak.sh.
+ */
+
+#ifndef FAULT_H_
+#define FAULT_H_
+
+#include <stdint.h>
+
+enum {
+  FAULT_DROP,               // input bytes dropped, sync lost
+  FAULT_CORRUPT,            // input bits flipped
+  FAULT_SILENCE,            // input zeroed, "No packet found > PCM"
+  FAULT_CODEC,              // burst data type changed, "codec changed"
+  FAULT_DECODE,             // SPIF_DECODER_RESTART_REQUIRED after decoding
+  FAULT_XRUN_IN,            // ALSA capture EPIPE
+  FAULT_XRUN_OUT,           // ALSA playback EPIPE
+  FAULT_DELAY,              // output write delayed
+  FAULT_SLOW_OPEN,          // output open delayed
+  FAULTS
+};
+
+extern int fault_enabled;
+
+// "all" or a comma separated list of <type>[@<seconds>][:<param>], e.g. "drop@5:2000,delay@20".
+// Period default 10s; param: bytes (drop, default 1001), bit flips (corrupt, 8), ms (silence 300,
+// delay 100, slow_open 500). -1 on a bad spec.
+int fault_init(const char *spec);
+
+// 1 if the fault is due and injected now, the caller makes it happen. *param if not NULL.
+int fault_fire(int type, int *param);
+
+// input as read by the source, drop, corrupt and silence applied. Returns the new length, > 0.
+int fault_input(uint8_t *buf, int n);
+
+// frames were written to the output at rate
+void fault_output(int frames, int rate);
+
+void fault_report();
+
+#endif /* FAULT_H_ */
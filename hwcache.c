@@ -0,0 +1,263 @@
+/*
+ * hwcache.c
+ *
+ * Startup cache, see hwcache.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+
+#include "hwcache.h"
+#include "log.h"
+
+typedef struct {
+  char key[HWCACHE_KEY_SIZE];
+  int values[HWCACHE_MAX_VALUES];
+  int n;
+} hwcache_entry;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static hwcache_entry entries[HWCACHE_MAX_ENTRIES];
+static int count;
+static int dirty;               // entries differ from the file
+static char *file;
+
+// the file is written by its own thread, never by the audio threads that update the entries
+static pthread_t writer_thread;
+static atomic_int writer_running;
+static hwcache_entry snapshot[HWCACHE_MAX_ENTRIES];
+
+//--------------------------------------------------------------------------------------------------
+static void load()
+{
+  FILE *f = fopen(file, "r");
+  char line[HWCACHE_KEY_SIZE + 64];
+
+  if (!f)
+    return;
+
+  while (count < HWCACHE_MAX_ENTRIES && fgets(line, sizeof(line), f))
+  {
+    char *tab = strchr(line, '\t');
+    hwcache_entry *e = &entries[count];
+
+    if (!tab || tab - line >= HWCACHE_KEY_SIZE)
+      continue;
+
+    *tab = 0;
+    strcpy(e->key, line);
+
+    e->n = sscanf(tab + 1, "%d %d %d %d", &e->values[0], &e->values[1], &e->values[2], &e->values[3]);
+
+    if (e->n > 0)
+      count++;
+  }
+
+  fclose(f);
+}
+
+//--------------------------------------------------------------------------------------------------
+// written to a temporary file and renamed, a crash never leaves a torn cache
+static void save(const hwcache_entry *e, int n)
+{
+  char tmp[strlen(file) + 8];
+  FILE *f;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+
+  if (!(f = fopen(tmp, "w")))
+  {
+    log_printf("hwcache: cannot write %s\n", tmp);
+    return;
+  }
+
+  for (int i = 0; i < n; i++)
+  {
+    fprintf(f, "%s\t", e[i].key);
+
+    for (int v = 0; v < e[i].n; v++)
+      fprintf(f, v ? " %d" : "%d", e[i].values[v]);
+
+    fprintf(f, "\n");
+  }
+
+  if (fclose(f) != 0 || rename(tmp, file) != 0)
+    log_printf("hwcache: cannot write %s\n", file);
+}
+
+//--------------------------------------------------------------------------------------------------
+// copies the entries to the snapshot if they changed, number copied or -1
+static int take_snapshot()
+{
+  int n = dirty ? count : -1;
+
+  if (dirty)
+    memcpy(snapshot, entries, count * sizeof(hwcache_entry));
+
+  dirty = 0;
+  return n;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void* writer_main(void *arg)
+{
+  pthread_mutex_lock(&lock);
+
+  while (atomic_load(&writer_running))
+  {
+    int n = take_snapshot();
+
+    if (n < 0)
+    {
+      pthread_cond_wait(&changed, &lock);
+      continue;
+    }
+
+    pthread_mutex_unlock(&lock);
+    save(snapshot, n);
+    pthread_mutex_lock(&lock);
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+// exit() must not lose the last change
+static void hwcache_deinit()
+{
+  if (atomic_load(&writer_running))
+  {
+    pthread_mutex_lock(&lock);
+    atomic_store(&writer_running, 0);
+    pthread_cond_signal(&changed);
+    pthread_mutex_unlock(&lock);
+
+    pthread_join(writer_thread, NULL);
+  }
+
+  pthread_mutex_lock(&lock);
+
+  int n = take_snapshot();
+
+  pthread_mutex_unlock(&lock);
+
+  if (n >= 0)
+    save(snapshot, n);
+}
+
+//--------------------------------------------------------------------------------------------------
+void hwcache_init(const char *path)
+{
+  char buf[512];
+
+  if (path && !strcmp(path, "off"))
+    return;
+
+  if (!path)
+  {
+    const char *dir = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    if (dir && *dir)
+      snprintf(buf, sizeof(buf), "%s/spdif-decoder.cache", dir);
+    else if (home && *home)
+    {
+      snprintf(buf, sizeof(buf), "%s/.cache", home);
+      mkdir(buf, 0755);
+      snprintf(buf, sizeof(buf), "%s/.cache/spdif-decoder.cache", home);
+    }
+    else
+      return;
+
+    path = buf;
+  }
+
+  file = strdup(path);
+
+  if (!file)
+    return;
+
+  load();
+
+  atomic_store(&writer_running, 1);
+
+  if (pthread_create(&writer_thread, NULL, writer_main, NULL) != 0)
+  {
+    atomic_store(&writer_running, 0);
+    log_printf("hwcache: cannot create thread, saving at exit only\n");
+  }
+
+  atexit(hwcache_deinit);
+}
+
+//--------------------------------------------------------------------------------------------------
+static hwcache_entry* find(const char *key)
+{
+  for (int i = 0; i < count; i++)
+    if (!strcmp(entries[i].key, key))
+      return &entries[i];
+
+  return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+int hwcache_get(const char *key, int *values, int n)
+{
+  int ret = -1;
+
+  if (!file)
+    return -1;
+
+  pthread_mutex_lock(&lock);
+
+  hwcache_entry *e = find(key);
+
+  if (e && e->n >= n)
+  {
+    memcpy(values, e->values, n * sizeof(int));
+    ret = 0;
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  return ret;
+}
+
+//--------------------------------------------------------------------------------------------------
+void hwcache_put(const char *key, const int *values, int n)
+{
+  if (!file || n > HWCACHE_MAX_VALUES || strlen(key) >= HWCACHE_KEY_SIZE || strpbrk(key, "\t\n"))
+    return;
+
+  pthread_mutex_lock(&lock);
+
+  hwcache_entry *e = find(key);
+
+  if (!e || e->n != n || memcmp(e->values, values, n * sizeof(int)))
+  {
+    if (!e)
+    {
+      // full: the oldest entry goes
+      if (count == HWCACHE_MAX_ENTRIES)
+        memmove(entries, entries + 1, --count * sizeof(hwcache_entry));
+
+      e = &entries[count++];
+      strcpy(e->key, key);
+    }
+
+    memcpy(e->values, values, n * sizeof(int));
+    e->n = n;
+
+    dirty = 1;
+    pthread_cond_signal(&changed);
+  }
+
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,29 @@
+/*
+ * hwcache.h
+ *
+ * Values that speed up the next start, kept in a small text file across
+ * restarts: the ALSA buffer and period sizes negotiated per device and the
+ * channel count last played per output, so the output can be opened while
+ * the input is still starting up. One "key<TAB>values" line per entry.
+ *
+ * Default file $XDG_CACHE_HOME/spdif-decoder.cache (~/.cache/...), -C.
+ */
+
+#ifndef HWCACHE_H_
+#define HWCACHE_H_
+
+#define HWCACHE_MAX_ENTRIES  64
+#define HWCACHE_MAX_VALUES   4
+#define HWCACHE_KEY_SIZE     300
+
+// path NULL = default location, "off" = disabled
+void hwcache_init(const char *path);
+
+// 0 if key was found, fills up to n values
+int hwcache_get(const char *key, int *values, int n);
+
+// stores n values, the file is only rewritten if they changed, by a background thread (or at exit)
+// so this never blocks on file I/O
+void hwcache_put(const char *key, const int *values, int n);
+
+#endif /* HWCACHE_H_ */
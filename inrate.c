@@ -0,0 +1,82 @@
+/*
+ * inrate.c
+ *
+ * Input sample rate detection, see inrate.h
+ */
+
+#include <math.h>
+
+#include "inrate.h"
+
+static const int rates[] = {32000, 44100, 48000, 88200, 96000, 176400, 192000};
+
+//--------------------------------------------------------------------------------------------------
+void inrate_reset(inrate_probe *r, int reported)
+{
+  // a device opened at 48kHz may still run at the rate of its input, keep what was measured
+  if (reported && reported != 48000)
+    r->rate = reported;
+  else if (!r->rate)
+    r->rate = 48000;
+
+  r->candidate = 0;
+  r->opened = 0;
+  r->start = 0;
+  r->bytes = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int snap(double measured)
+{
+  for (unsigned i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+    if (fabs(measured - rates[i]) < rates[i] * INRATE_TOLERANCE)
+      return rates[i];
+
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+int inrate_update(inrate_probe *r, int bytes, double now)
+{
+  if (!r->opened)
+  {
+    r->opened = now;
+    return 0;
+  }
+
+  if (!r->start)
+  {
+    // bytes of this read arrived before the window starts
+    if (now - r->opened >= INRATE_SETTLE_MS)
+      r->start = now;
+
+    return 0;
+  }
+
+  r->bytes += bytes;
+
+  if (now - r->start < INRATE_WINDOW_MS)
+    return 0;
+
+  int rate = snap(r->bytes / 4 * 1000.0 / (now - r->start));
+
+  r->start = now;
+  r->bytes = 0;
+
+  if (!rate || rate == r->rate)
+  {
+    r->candidate = 0;
+    return 0;
+  }
+
+  if (rate != r->candidate)
+  {
+    r->candidate = rate;
+    return 0;
+  }
+
+  r->rate = rate;
+  r->candidate = 0;
+
+  return 1;
+}
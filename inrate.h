@@ -0,0 +1,33 @@
+/*
+ * inrate.h
+ *
+ * Input sample rate detection. A capture device that runs from the clock
+ * of its S/PDIF input delivers frames at the rate of the source, whatever
+ * rate it was opened with. The frames read per second are measured over
+ * windows of INRATE_WINDOW_MS and snapped to the nearest standard rate, a
+ * new rate is taken once two windows in a row agree. Rates the device
+ * reports itself (other than 48kHz) are used right away.
+ */
+
+#ifndef INRATE_H_
+#define INRATE_H_
+
+#define INRATE_WINDOW_MS   2000
+#define INRATE_SETTLE_MS   200      // skipped after a (re)open while the capture buffer fills
+#define INRATE_TOLERANCE   0.015    // clock drift of a real source is far below
+
+typedef struct {
+  int rate;                         // input rate in effect
+  int candidate;                    // measured once, not yet confirmed
+  double opened;                    // first read after the last reset, 0 = none yet
+  double start;                     // current window, 0 = settling
+  long long bytes;
+} inrate_probe;
+
+// (re)start measuring after the source was opened, reported = Source.sample_rate
+void inrate_reset(inrate_probe *r, int reported);
+
+// account bytes returned by a read at now, 1 if rate changed
+int inrate_update(inrate_probe *r, int bytes, double now);
+
+#endif /* INRATE_H_ */
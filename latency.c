@@ -0,0 +1,74 @@
+/*
+ * latency.c
+ *
+ * Adaptive output latency, see latency.h
+ */
+
+#include <limits.h>
+
+#include "latency.h"
+
+//--------------------------------------------------------------------------------------------------
+static int clamp(const latency_ctl *l, int ms)
+{
+  return ms < l->min_ms ? l->min_ms : ms > l->max_ms ? l->max_ms : ms;
+}
+
+//--------------------------------------------------------------------------------------------------
+void latency_init(latency_ctl *l, int min_ms, int max_ms, int start_ms, unsigned xruns, double now)
+{
+  l->min_ms    = min_ms;
+  l->max_ms    = max_ms;
+  l->target_ms = clamp(l, start_ms);
+  l->xruns     = xruns;
+  l->grown     = 0;
+  l->since     = now;
+  l->quiet_ms  = LATENCY_QUIET_MS;
+  l->low_ms    = INT_MAX;
+}
+
+//--------------------------------------------------------------------------------------------------
+int latency_update(latency_ctl *l, unsigned xruns, int delay_ms, double now)
+{
+  int old = l->target_ms;
+
+  if (xruns != l->xruns)
+  {
+    l->xruns = xruns;
+
+    // snd_pcm_recover() right after an underrun often sees another one
+    if (now - l->grown < LATENCY_MERGE_MS)
+      return 0;
+
+    int step = l->target_ms / 2;
+
+    l->target_ms = clamp(l, l->target_ms + (step > LATENCY_GROW_MIN_MS ? step : LATENCY_GROW_MIN_MS));
+    l->grown = l->since = now;
+    l->low_ms = INT_MAX;
+
+    if ((l->quiet_ms *= 2) > LATENCY_QUIET_MAX_MS)
+      l->quiet_ms = LATENCY_QUIET_MAX_MS;
+
+    return l->target_ms != old;
+  }
+
+  if (delay_ms < l->low_ms)
+    l->low_ms = delay_ms;
+
+  if (now - l->since < l->quiet_ms)
+    return 0;
+
+  // the output never ran closer to empty than low_ms, half of the spare goes
+  int spare = l->low_ms - LATENCY_MARGIN_MS;
+
+  if (spare > 0)
+    l->target_ms = clamp(l, l->target_ms - (spare > 1 ? spare / 2 : 1));
+
+  l->since = now;
+  l->low_ms = INT_MAX;
+
+  if ((l->quiet_ms /= 2) < LATENCY_QUIET_MS)
+    l->quiet_ms = LATENCY_QUIET_MS;
+
+  return l->target_ms != old;
+}
@@ -0,0 +1,40 @@
+/*
+ * latency.h
+ *
+ * Adaptive output latency. The loop drops frames once the output delay
+ * reaches a target (-c), too low a target underruns on a busy box, too high
+ * adds latency for nothing. With bounds given (-a min:max) the target is
+ * raised on every output underrun and lowered again after a quiet period,
+ * by half the margin the lowest delay seen in that period left. The quiet
+ * period doubles after each underrun and halves after each quiet step, so
+ * a box settles at the lowest latency it can sustain without oscillating.
+ *
+ * The device is never reopened: the target moves the catch up level and the
+ * prefill (ALSA start threshold) used when playback (re)starts.
+ */
+
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#define LATENCY_GROW_MIN_MS   8         // smallest step up after an underrun
+#define LATENCY_MARGIN_MS     4         // kept above the lowest delay when stepping down
+#define LATENCY_QUIET_MS      30000     // no underrun for this long before stepping down
+#define LATENCY_QUIET_MAX_MS  600000
+#define LATENCY_MERGE_MS      1000      // underruns this close count once
+
+typedef struct {
+  int min_ms, max_ms;
+  int target_ms;
+  unsigned xruns;                       // sink underrun count last seen
+  double grown;                         // last step up
+  double since;                         // start of the quiet period
+  double quiet_ms;                      // length of the quiet period
+  int low_ms;                           // lowest delay in the quiet period
+} latency_ctl;
+
+void latency_init(latency_ctl *l, int min_ms, int max_ms, int start_ms, unsigned xruns, double now);
+
+// called with every output delay measurement, 1 if target_ms changed
+int latency_update(latency_ctl *l, unsigned xruns, int delay_ms, double now);
+
+#endif /* LATENCY_H_ */
@@ -0,0 +1,510 @@
+/*
+ * log.c
+ *
+ * Asynchronous logging, see log.h
+ *
+ * The ring is a bounded multi producer / single consumer queue: each record
+ * carries a sequence number, producers claim a slot with a CAS on the head,
+ * fill it and publish it by storing the sequence. No locks, no syscalls and
+ * no formatting on the producer side; a full ring drops the record.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "log.h"
+#include "myspdif.h"
+
+#define LOG_RATE_TABLE_SIZE 64
+#define LOG_LINE_SIZE       1024
+#define LOG_POLL_US         10000
+
+enum { LEN_INT, LEN_LONG, LEN_LLONG, LEN_SIZE, LEN_INTMAX };
+
+typedef union {
+  long long i;
+  double d;
+} log_arg;
+
+typedef struct {
+  atomic_uint seq;
+  double time;
+  const char *fmt;
+  int nargs;
+  log_arg args[LOG_MAX_ARGS];
+  char str[LOG_STR_SIZE];
+} log_record;
+
+typedef struct {
+  const char *fmt;
+  double window_start;
+  int count;
+  int suppressed;
+} log_rate;
+
+static log_record ring[LOG_RING_SIZE];
+static atomic_uint ring_head;
+static unsigned ring_tail;
+static atomic_uint ring_dropped;
+
+static log_rate rates[LOG_RATE_TABLE_SIZE];
+
+static pthread_t log_thread;
+static pthread_mutex_t consume_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int log_running;
+static FILE *log_out;
+
+//--------------------------------------------------------------------------------------------------
+// parse a conversion spec, p points behind the '%', returns pointer behind the conversion char
+static const char* parse_spec(const char *p, int *len, char *conv)
+{
+  while (*p && strchr("-+ #0", *p))
+    p++;
+
+  while ((*p >= '0' && *p <= '9') || *p == '.')
+    p++;
+
+  *len = LEN_INT;
+
+  if (*p == 'h')
+  {
+    p++;
+    if (*p == 'h')
+      p++;
+  }
+  else if (*p == 'l')
+  {
+    p++;
+    *len = LEN_LONG;
+
+    if (*p == 'l')
+    {
+      p++;
+      *len = LEN_LLONG;
+    }
+  }
+  else if (*p == 'z')
+  {
+    p++;
+    *len = LEN_SIZE;
+  }
+  else if (*p == 'j')
+  {
+    p++;
+    *len = LEN_INTMAX;
+  }
+
+  *conv = *p;
+
+  return *p ? p + 1 : p;
+}
+
+//--------------------------------------------------------------------------------------------------
+void log_printf(const char *fmt, ...)
+{
+  va_list ap;
+
+  if (!atomic_load_explicit(&log_running, memory_order_relaxed))
+  {
+    va_start(ap, fmt);
+    vfprintf(log_out ? log_out : stdout, fmt, ap);
+    va_end(ap);
+    return;
+  }
+
+  log_record *r;
+  unsigned pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+
+  while (1)
+  {
+    r = &ring[pos & (LOG_RING_SIZE - 1)];
+
+    unsigned seq = atomic_load_explicit(&r->seq, memory_order_acquire);
+    int diff = (int)(seq - pos);
+
+    if (diff == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&ring_head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else if (diff < 0)
+    {
+      // ring full
+      atomic_fetch_add_explicit(&ring_dropped, 1, memory_order_relaxed);
+      return;
+    }
+    else
+      pos = atomic_load_explicit(&ring_head, memory_order_relaxed);
+  }
+
+  r->time  = monotonic_ms();
+  r->fmt   = fmt;
+  r->nargs = 0;
+
+  int strUsed = 0, stop = 0;
+
+  va_start(ap, fmt);
+
+  for (const char *p = fmt; *p && !stop && r->nargs < LOG_MAX_ARGS; p++)
+  {
+    if (*p != '%')
+      continue;
+
+    if (p[1] == '%')
+    {
+      p++;
+      continue;
+    }
+
+    int len;
+    char conv;
+    p = parse_spec(p + 1, &len, &conv) - 1;
+
+    log_arg *a = &r->args[r->nargs++];
+
+    switch (conv)
+    {
+    case 'd': case 'i': case 'c':
+      a->i = len == LEN_LLONG  ? va_arg(ap, long long)
+           : len == LEN_LONG   ? va_arg(ap, long)
+           : len == LEN_SIZE   ? (long long)va_arg(ap, ssize_t)
+           : len == LEN_INTMAX ? (long long)va_arg(ap, intmax_t)
+           :                     va_arg(ap, int);
+      break;
+
+    case 'u': case 'x': case 'X': case 'o':
+      a->i = len == LEN_LLONG  ? (long long)va_arg(ap, unsigned long long)
+           : len == LEN_LONG   ? (long long)va_arg(ap, unsigned long)
+           : len == LEN_SIZE   ? (long long)va_arg(ap, size_t)
+           : len == LEN_INTMAX ? (long long)va_arg(ap, uintmax_t)
+           :                     (long long)va_arg(ap, unsigned int);
+      break;
+
+    case 'p':
+      a->i = (long long)(intptr_t)va_arg(ap, void*);
+      break;
+
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+      a->d = va_arg(ap, double);
+      break;
+
+    case 's':
+    {
+      const char *s = va_arg(ap, const char*);
+      int n = s ? strlen(s) : 0;
+
+      if (n > LOG_STR_SIZE - 1 - strUsed)
+        n = LOG_STR_SIZE - 1 - strUsed;
+
+      if (n > 0)
+        memcpy(r->str + strUsed, s, n);
+
+      r->str[strUsed + n] = 0;
+      a->i = strUsed;
+      strUsed += n + (strUsed + n < LOG_STR_SIZE - 1);
+      break;
+    }
+
+    default:
+      // unsupported conversion, stop capturing
+      r->nargs--;
+      stop = 1;
+      break;
+    }
+  }
+
+  va_end(ap);
+
+  atomic_store_explicit(&r->seq, pos + 1, memory_order_release);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void format_record(log_record *r, char *line, int size)
+{
+  int used = 0, arg = 0;
+  char spec[32];
+
+  for (const char *p = r->fmt; *p && used < size - 1; )
+  {
+    if (*p != '%' || p[1] == '%' || arg >= r->nargs)
+    {
+      if (*p == '%' && p[1] == '%')
+        p++;
+
+      line[used++] = *p++;
+      continue;
+    }
+
+    int len;
+    char conv;
+    const char *end = parse_spec(p + 1, &len, &conv);
+    int specLen = end - p;
+
+    if (specLen >= (int)sizeof(spec))
+      specLen = sizeof(spec) - 1;
+
+    memcpy(spec, p, specLen);
+    spec[specLen] = 0;
+
+    log_arg *a = &r->args[arg++];
+    int n;
+
+    switch (conv)
+    {
+    case 'd': case 'i': case 'c':
+      n = len == LEN_LLONG  ? snprintf(line + used, size - used, spec, a->i)
+        : len == LEN_LONG   ? snprintf(line + used, size - used, spec, (long)a->i)
+        : len == LEN_SIZE   ? snprintf(line + used, size - used, spec, (ssize_t)a->i)
+        : len == LEN_INTMAX ? snprintf(line + used, size - used, spec, (intmax_t)a->i)
+        :                     snprintf(line + used, size - used, spec, (int)a->i);
+      break;
+
+    case 'u': case 'x': case 'X': case 'o':
+      n = len == LEN_LLONG  ? snprintf(line + used, size - used, spec, (unsigned long long)a->i)
+        : len == LEN_LONG   ? snprintf(line + used, size - used, spec, (unsigned long)a->i)
+        : len == LEN_SIZE   ? snprintf(line + used, size - used, spec, (size_t)a->i)
+        : len == LEN_INTMAX ? snprintf(line + used, size - used, spec, (uintmax_t)a->i)
+        :                     snprintf(line + used, size - used, spec, (unsigned int)a->i);
+      break;
+
+    case 'p':
+      n = snprintf(line + used, size - used, spec, (void*)(intptr_t)a->i);
+      break;
+
+    case 's':
+      n = snprintf(line + used, size - used, spec, r->str + a->i);
+      break;
+
+    default:
+      n = snprintf(line + used, size - used, spec, a->d);
+      break;
+    }
+
+    if (n > 0)
+      used += n;
+
+    if (used > size - 1)
+      used = size - 1;
+
+    p = end;
+  }
+
+  line[used] = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static log_rate* rate_lookup(const char *fmt)
+{
+  unsigned h = ((uintptr_t)fmt >> 3) % LOG_RATE_TABLE_SIZE;
+
+  for (int i = 0; i < LOG_RATE_TABLE_SIZE; i++)
+  {
+    log_rate *rt = &rates[(h + i) % LOG_RATE_TABLE_SIZE];
+
+    if (rt->fmt == fmt)
+      return rt;
+
+    if (!rt->fmt)
+    {
+      rt->fmt = fmt;
+      return rt;
+    }
+  }
+
+  return NULL;  // table full, no rate limit
+}
+
+//--------------------------------------------------------------------------------------------------
+static void rate_report(log_rate *rt)
+{
+  fprintf(log_out, "last message suppressed %d times: %.60s", rt->suppressed, rt->fmt);
+
+  if (!strchr(rt->fmt, '\n'))
+    fputs("\n", log_out);
+
+  rt->suppressed = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// close windows of format strings which were not logged again
+static void rate_sweep(double now, int force)
+{
+  for (int i = 0; i < LOG_RATE_TABLE_SIZE; i++)
+  {
+    log_rate *rt = &rates[i];
+
+    if (rt->fmt && rt->suppressed && (force || now - rt->window_start >= LOG_RATE_WINDOW_MS))
+    {
+      rate_report(rt);
+      rt->count = 0;
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// caller holds consume_lock
+static int consume_locked(int force)
+{
+  char line[LOG_LINE_SIZE];
+  int n = 0;
+
+  while (1)
+  {
+    log_record *r = &ring[ring_tail & (LOG_RING_SIZE - 1)];
+
+    if (atomic_load_explicit(&r->seq, memory_order_acquire) != ring_tail + 1)
+      break;
+
+    log_rate *rt = rate_lookup(r->fmt);
+    int show = 1;
+
+    if (rt)
+    {
+      if (r->time - rt->window_start >= LOG_RATE_WINDOW_MS)
+      {
+        if (rt->suppressed)
+          rate_report(rt);
+
+        rt->window_start = r->time;
+        rt->count = 0;
+      }
+
+      if (++rt->count > LOG_RATE_MAX)
+      {
+        rt->suppressed++;
+        show = 0;
+      }
+    }
+
+    if (show)
+    {
+      format_record(r, line, sizeof(line));
+      fputs(line, log_out);
+    }
+
+    atomic_store_explicit(&r->seq, ring_tail + LOG_RING_SIZE, memory_order_release);
+    ring_tail++;
+    n++;
+  }
+
+  unsigned dropped = atomic_exchange_explicit(&ring_dropped, 0, memory_order_relaxed);
+
+  if (dropped)
+  {
+    fprintf(log_out, "log: %u messages dropped, ring full\n", dropped);
+    n++;
+  }
+
+  rate_sweep(monotonic_ms(), force);
+
+  return n;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int consume(int force)
+{
+  pthread_mutex_lock(&consume_lock);
+
+  int n = consume_locked(force);
+
+  pthread_mutex_unlock(&consume_lock);
+
+  return n;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void* log_thread_main(void *arg)
+{
+  while (atomic_load(&log_running))
+  {
+    if (consume(0))
+      fflush(log_out);
+
+    usleep(LOG_POLL_US);
+  }
+
+  return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+void log_flush()
+{
+  consume(0);
+  fflush(log_out);
+}
+
+//--------------------------------------------------------------------------------------------------
+void log_report(const char *fmt, ...)
+{
+  va_list ap;
+  FILE *out = log_out ? log_out : stdout;
+
+  pthread_mutex_lock(&consume_lock);
+
+  if (atomic_load(&log_running))
+    consume_locked(0);
+
+  va_start(ap, fmt);
+  vfprintf(out, fmt, ap);
+  va_end(ap);
+
+  fflush(out);
+
+  pthread_mutex_unlock(&consume_lock);
+}
+
+//--------------------------------------------------------------------------------------------------
+void log_set_output(FILE *out)
+{
+  log_out = out;
+}
+
+//--------------------------------------------------------------------------------------------------
+void log_init()
+{
+  if (atomic_load(&log_running))
+    return;
+
+  if (!log_out)
+    log_out = stdout;
+
+  for (unsigned i = 0; i < LOG_RING_SIZE; i++)
+    atomic_init(&ring[i].seq, i);
+
+  atomic_store(&ring_head, 0);
+  ring_tail = 0;
+
+  atomic_store(&log_running, 1);
+
+  if (pthread_create(&log_thread, NULL, log_thread_main, NULL) != 0)
+  {
+    atomic_store(&log_running, 0);
+    fprintf(log_out, "log: cannot create thread, logging synchronously\n");
+    return;
+  }
+
+  // errx() and exit() must not lose queued messages
+  atexit(log_deinit);
+}
+
+//--------------------------------------------------------------------------------------------------
+void log_deinit()
+{
+  if (!atomic_exchange(&log_running, 0))
+    return;
+
+  pthread_join(log_thread, NULL);
+
+  consume(1);
+  fflush(log_out);
+}
@@ -0,0 +1,37 @@
+/*
+ * log.h
+ *
+ * Asynchronous logging: audio threads push fixed-size binary records into a
+ * lock-free ring, a background thread formats them and writes to the log output.
+ */
+
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define LOG_RING_SIZE       1024  // records, must be a power of 2
+#define LOG_MAX_ARGS        8
+#define LOG_STR_SIZE        96    // storage for all %s arguments of one record
+
+#define LOG_RATE_WINDOW_MS  1000  // rate limit window per format string
+#define LOG_RATE_MAX        5     // messages per format string and window
+
+void log_init();
+void log_deinit();
+
+// default stdout, call before log_init()
+void log_set_output(FILE *out);
+
+// printf compatible, fmt must be a string literal (its address is used as the rate limit key).
+// Supported conversions: d i u x X o c p s f e g (with h/l/ll/z modifiers), no '*' width.
+void log_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// format and write all pending records synchronously
+void log_flush();
+
+// write synchronously after the pending records, not rate limited. For reports outside the audio path.
+void log_report(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+#endif /* LOG_H_ */
@@ -0,0 +1,277 @@
+/*
+ * meter.c
+ *
+ * Level metering, see meter.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <libavutil/channel_layout.h>
+
+#include "meter.h"
+
+#define METER_BLOCK_MS  100
+
+// four samples in vector registers, as in mixer.c
+typedef float v4sf __attribute__((vector_size(16)));
+typedef int32_t v4si __attribute__((vector_size(16)));
+typedef int16_t v4hi __attribute__((vector_size(8)));
+
+int meter_enabled = 0;
+
+static int interval_ms;
+static int loudness;
+
+//--------------------------------------------------------------------------------------------------
+int meter_init(const char *spec)
+{
+  char *end;
+
+  interval_ms = strtol(spec, &end, 10);
+
+  if (interval_ms <= 0)
+    return -1;
+
+  if (!strcmp(end, ",loudness"))
+    loudness = 1;
+  else if (*end)
+    return -1;
+
+  meter_enabled = 1;
+
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// K-weighting at any rate, BS.1770 gives the coefficients for 48kHz only: a high shelf for the
+// head, then a high pass
+static void k_filter(meter *m, int rate)
+{
+  double K = tan(M_PI * 1681.974450955533 / rate);
+  double Q = 0.7071752369554196;
+  double Vh = pow(10, 3.999843853973347 / 20);
+  double Vb = pow(Vh, 0.4996667741545416);
+  double a0 = 1 + K / Q + K * K;
+
+  m->b[0][0] = (Vh + Vb * K / Q + K * K) / a0;
+  m->b[0][1] = 2 * (K * K - Vh) / a0;
+  m->b[0][2] = (Vh - Vb * K / Q + K * K) / a0;
+  m->a[0][0] = 2 * (K * K - 1) / a0;
+  m->a[0][1] = (1 - K / Q + K * K) / a0;
+
+  K = tan(M_PI * 38.13547087602444 / rate);
+  Q = 0.5003270373238773;
+  a0 = 1 + K / Q + K * K;
+
+  m->b[1][0] = 1;
+  m->b[1][1] = -2;
+  m->b[1][2] = 1;
+  m->a[1][0] = 2 * (K * K - 1) / a0;
+  m->a[1][1] = (1 - K / Q + K * K) / a0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static float channel_weight(uint64_t ch)
+{
+  switch (ch)
+  {
+  case AV_CH_LOW_FREQUENCY:
+    return 0;
+  case AV_CH_SIDE_LEFT:
+  case AV_CH_SIDE_RIGHT:
+  case AV_CH_BACK_LEFT:
+  case AV_CH_BACK_RIGHT:
+    return 1.41f;
+  default:
+    return 1;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void meter_setup(meter *m, uint64_t layout, int channels, int rate)
+{
+  memset(m, 0, sizeof(*m));
+
+  m->channels = channels;
+  m->layout = layout;
+
+  if (av_get_channel_layout_nb_channels(layout) != channels)
+    layout = av_get_default_channel_layout(channels);
+
+  m->interval = (int64_t)rate * interval_ms / 1000;
+  m->loudness = loudness;
+  m->blockSize = rate * METER_BLOCK_MS / 1000;
+
+  for (int c = 0; c < channels; c++)
+    m->weight[c] = layout ? channel_weight(av_channel_layout_extract_channel(layout, c)) : 1;
+
+  k_filter(m, rate);
+}
+
+//--------------------------------------------------------------------------------------------------
+// lane k of vector v holds channel (4 * v + k) % channels: a step of 4 * vecs samples covers whole
+// frames, lcm(channels, 4). Inlined with a constant vecs the accumulators stay in registers.
+static inline __attribute__((always_inline)) void accumulate(meter *m, const int16_t *buf, int samples, int vecs)
+{
+  v4sf sum[METER_MAX_CHANNELS - 1] = {{0}};
+  v4sf peak[METER_MAX_CHANNELS - 1] = {{0}};
+  int ch = m->channels;
+  int i = 0;
+
+  for (; i + 4 * vecs <= samples; i += 4 * vecs)
+  {
+    for (int v = 0; v < vecs; v++)
+    {
+      v4hi h;
+
+      memcpy(&h, buf + i + 4 * v, sizeof(h));
+
+      v4sf x = __builtin_convertvector(h, v4sf) * (1.0f / 32768);
+      v4sf sq = x * x;
+      v4si gt = sq > peak[v];
+
+      sum[v] += sq;
+      peak[v] = (v4sf)(((v4si)sq & gt) | ((v4si)peak[v] & ~gt));
+    }
+  }
+
+  for (int v = 0; v < vecs; v++)
+  {
+    for (int k = 0; k < 4; k++)
+    {
+      int c = (4 * v + k) % ch;
+
+      m->sum[c] += sum[v][k];
+
+      if (peak[v][k] > m->peak[c])
+        m->peak[c] = peak[v][k];
+    }
+  }
+
+  // the last frames, fewer than a step
+  for (; i < samples; i++)
+  {
+    int c = i % ch;
+    float x = buf[i] * (1.0f / 32768);
+
+    m->sum[c] += x * x;
+
+    if (x * x > m->peak[c])
+      m->peak[c] = x * x;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void levels(meter *m, const int16_t *buf, int frames)
+{
+  int ch = m->channels;
+  int vecs = ch % 4 == 0 ? ch / 4 : ch % 2 == 0 ? ch / 2 : ch;
+
+  // mono, stereo, 4.0 and 7.1 in one or two vectors, 5.1 in three
+  switch (vecs)
+  {
+  case 1:
+    accumulate(m, buf, frames * ch, 1);
+    break;
+  case 2:
+    accumulate(m, buf, frames * ch, 2);
+    break;
+  case 3:
+    accumulate(m, buf, frames * ch, 3);
+    break;
+  default:
+    accumulate(m, buf, frames * ch, vecs);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// the recursion runs along the samples, only the channels of a frame are independent
+static void k_weighted(meter *m, const int16_t *buf, int frames)
+{
+  int ch = m->channels;
+
+  for (int i = 0; i < frames; i++, buf += ch)
+  {
+    double e = 0;
+
+    for (int c = 0; c < ch; c++)
+    {
+      double x = buf[c] * (1.0 / 32768);
+      double y = m->b[0][0] * x + m->z[0][0][c];
+
+      m->z[0][0][c] = m->b[0][1] * x - m->a[0][0] * y + m->z[0][1][c];
+      m->z[0][1][c] = m->b[0][2] * x - m->a[0][1] * y;
+
+      double w = m->b[1][0] * y + m->z[1][0][c];
+
+      m->z[1][0][c] = m->b[1][1] * y - m->a[1][0] * w + m->z[1][1][c];
+      m->z[1][1][c] = m->b[1][2] * y - m->a[1][1] * w;
+
+      e += m->weight[c] * w * w;
+    }
+
+    m->block += e;
+
+    if (++m->blockFrames < m->blockSize)
+      continue;
+
+    m->blocks[m->blockPos] = m->block / m->blockSize;
+    m->blockPos = (m->blockPos + 1) % METER_BLOCKS;
+
+    if (m->blockCount < METER_BLOCKS)
+      m->blockCount++;
+
+    m->block = 0;
+    m->blockFrames = 0;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+static float to_db(double power)
+{
+  return power > 0 ? fmaxf(10 * log10(power), METER_FLOOR_DB) : METER_FLOOR_DB;
+}
+
+//--------------------------------------------------------------------------------------------------
+int meter_process(meter *m, const int16_t *buf, int frames, meter_levels *out)
+{
+  if (!m->channels || frames <= 0)
+    return 0;
+
+  levels(m, buf, frames);
+
+  if (m->loudness)
+    k_weighted(m, buf, frames);
+
+  m->frames += frames;
+
+  if (m->frames < m->interval)
+    return 0;
+
+  out->channels = m->channels;
+
+  for (int c = 0; c < m->channels; c++)
+  {
+    out->peak[c] = to_db(m->peak[c]);
+    out->rms[c] = to_db(m->sum[c] / m->frames);
+    m->peak[c] = 0;
+    m->sum[c] = 0;
+  }
+
+  out->loudness = NAN;
+
+  if (m->loudness && m->blockCount)
+  {
+    double sum = 0;
+
+    for (int b = 0; b < m->blockCount; b++)
+      sum += m->blocks[b];
+
+    out->loudness = sum > 0 ? fmaxf(-0.691 + 10 * log10(sum / m->blockCount), METER_FLOOR_DB) : METER_FLOOR_DB;
+  }
+
+  m->frames = 0;
+
+  return 1;
+}
@@ -0,0 +1,58 @@
+/*
+ * meter.h
+ *
+ * Level metering (-l) of the converted output, interleaved S16 as it goes to
+ * the sink: per channel sample peak and RMS, optionally the short-term
+ * loudness (ITU-R BS.1770, K-weighted, 3s window) over all channels. The
+ * levels are published through the status server at a fixed interval, a
+ * monitoring UI does not need a second ALSA client tapping the output.
+ */
+
+#ifndef METER_H_
+#define METER_H_
+
+#include <stdint.h>
+
+#define METER_MAX_CHANNELS  8
+#define METER_FLOOR_DB      -120.0f   // digital silence, JSON has no -inf
+#define METER_BLOCKS        30        // 100ms blocks of the short-term window
+
+extern int meter_enabled;
+
+typedef struct {
+  int channels;                       // 0 = not set up
+  uint64_t layout;                    // as passed to meter_setup()
+  int interval;                       // frames per report
+  int frames;                         // since the last report
+  float peak[METER_MAX_CHANNELS];     // squared, full scale 1.0
+  double sum[METER_MAX_CHANNELS];
+
+  // loudness, K-weighting filter per channel: two biquads, transposed direct form II
+  int loudness;
+  float weight[METER_MAX_CHANNELS];   // 0 for the LFE, 1.41 for the surrounds
+  double b[2][3], a[2][2];
+  double z[2][2][METER_MAX_CHANNELS];
+  double block;                       // weighted energy of the current block
+  int blockFrames, blockSize;
+  double blocks[METER_BLOCKS];
+  int blockCount, blockPos;
+} meter;
+
+typedef struct {
+  int channels;
+  float peak[METER_MAX_CHANNELS];     // dBFS
+  float rms[METER_MAX_CHANNELS];      // dBFS
+  float loudness;                     // LUFS, NAN without loudness or before the first block
+} meter_levels;
+
+// "<ms>[,loudness]", the report interval, e.g. "100,loudness". -1 on a bad spec.
+int meter_init(const char *spec);
+
+// on every format change, starts over. layout 0 = the default layout of channels, at most
+// METER_MAX_CHANNELS.
+void meter_setup(meter *m, uint64_t layout, int channels, int rate);
+
+// 1 when the interval is complete, levels filled and the interval restarted
+int meter_process(meter *m, const int16_t *buf, int frames, meter_levels *levels);
+
+#endif /* METER_H_ */
@@ -0,0 +1,343 @@
+/*
+ * mixer.c
+ *
+ * Channel matrix mixing, see mixer.h
+ */
+
+#include <string.h>
+#include <math.h>
+#include <libavutil/channel_layout.h>
+
+#include "mixer.h"
+
+#define SQRT1_2 0.70710678f
+
+#define LEFT_SURROUNDS  (AV_CH_SIDE_LEFT | AV_CH_BACK_LEFT)
+#define RIGHT_SURROUNDS (AV_CH_SIDE_RIGHT | AV_CH_BACK_RIGHT)
+
+// four samples of one channel, SSE and NEON registers through the GCC vector extension
+typedef float v4sf __attribute__((vector_size(16)));
+
+static const struct {
+  const char *name;
+  int set;
+  int clear;
+} options[] = {
+  {"loro",  0,           MIXER_LTRT},
+  {"ltrt",  MIXER_LTRT,  0},
+  {"upmix", MIXER_UPMIX, 0},
+};
+
+//--------------------------------------------------------------------------------------------------
+int mixer_parse(const char *spec)
+{
+  int flags = 0;
+
+  for (const char *s = spec; *s; )
+  {
+    size_t len = strcspn(s, ",");
+    int found = 0;
+
+    for (unsigned i = 0; i < sizeof(options) / sizeof(options[0]) && !found; i++)
+    {
+      if (strlen(options[i].name) == len && !strncmp(options[i].name, s, len))
+      {
+        flags = (flags & ~options[i].clear) | options[i].set;
+        found = 1;
+      }
+    }
+
+    if (!found)
+      return -1;
+
+    s += len + (s[len] == ',');
+  }
+
+  return flags;
+}
+
+//--------------------------------------------------------------------------------------------------
+// input channel c into output position ch, 0 if the output has no such channel
+static int put(mixer *mx, uint64_t out, uint64_t ch, int c, float gain)
+{
+  if (!(out & ch))
+    return 0;
+
+  mx->m[av_get_channel_layout_channel_index(out, ch)][c] += gain;
+  return 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+// side and back surrounds stand in for each other
+static uint64_t alternative(uint64_t ch)
+{
+  switch (ch)
+  {
+  case AV_CH_SIDE_LEFT:  return AV_CH_BACK_LEFT;
+  case AV_CH_SIDE_RIGHT: return AV_CH_BACK_RIGHT;
+  case AV_CH_BACK_LEFT:  return AV_CH_SIDE_LEFT;
+  case AV_CH_BACK_RIGHT: return AV_CH_SIDE_RIGHT;
+  default:               return 0;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// input channel c at position ch of the input layout in into the output layout out
+static void place(mixer *mx, uint64_t in, uint64_t out, int c, uint64_t ch, float gain)
+{
+  uint64_t alt = alternative(ch);
+
+  // the same position, or the other surround pair if the input does not use it
+  if (put(mx, out, ch, c, gain) || (!(in & alt) && put(mx, out, alt, c, gain)))
+    return;
+
+  // 7.1 > 5.1: back and side surrounds share the side pair
+  if (put(mx, out, alt, c, gain * SQRT1_2))
+    return;
+
+  switch (ch)
+  {
+  case AV_CH_FRONT_CENTER:
+    put(mx, out, AV_CH_FRONT_LEFT, c, gain * SQRT1_2);
+    put(mx, out, AV_CH_FRONT_RIGHT, c, gain * SQRT1_2);
+    return;
+  case AV_CH_FRONT_LEFT:
+  case AV_CH_FRONT_RIGHT:
+    // mono output
+    put(mx, out, AV_CH_FRONT_CENTER, c, gain * SQRT1_2);
+    return;
+  case AV_CH_BACK_CENTER:
+    // 6.1: half to either side
+    place(mx, in, out, c, AV_CH_BACK_LEFT, gain * SQRT1_2);
+    place(mx, in, out, c, AV_CH_BACK_RIGHT, gain * SQRT1_2);
+    return;
+  case AV_CH_LOW_FREQUENCY:
+    // LoRo and LtRt both drop the LFE
+    return;
+  }
+
+  if (!(ch & (LEFT_SURROUNDS | RIGHT_SURROUNDS)))
+    return;
+
+  if (!(out & (AV_CH_FRONT_LEFT | AV_CH_FRONT_RIGHT)))
+  {
+    put(mx, out, AV_CH_FRONT_CENTER, c, gain * SQRT1_2);
+  }
+  else if (mx->flags & MIXER_LTRT)
+  {
+    // Dolby Surround: the surrounds summed in antiphase, a matrix decoder steers them back
+    put(mx, out, AV_CH_FRONT_LEFT, c, -gain * SQRT1_2);
+    put(mx, out, AV_CH_FRONT_RIGHT, c, gain * SQRT1_2);
+  }
+  else
+  {
+    put(mx, out, ch & LEFT_SURROUNDS ? AV_CH_FRONT_LEFT : AV_CH_FRONT_RIGHT, c, gain * SQRT1_2);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// stereo into center and the first surround pair of the output
+static void spread(mixer *mx, uint64_t out)
+{
+  uint64_t left = out & AV_CH_SIDE_LEFT ? AV_CH_SIDE_LEFT : AV_CH_BACK_LEFT;
+  uint64_t right = out & AV_CH_SIDE_RIGHT ? AV_CH_SIDE_RIGHT : AV_CH_BACK_RIGHT;
+
+  put(mx, out, AV_CH_FRONT_CENTER, 0, 0.5f);
+  put(mx, out, AV_CH_FRONT_CENTER, 1, 0.5f);
+  put(mx, out, left, 0, SQRT1_2);
+  put(mx, out, right, 1, SQRT1_2);
+}
+
+//--------------------------------------------------------------------------------------------------
+static inline int16_t clip16(float v)
+{
+  long s = lrintf(v);
+
+  return s < -32768 ? -32768 : s > 32767 ? 32767 : s;
+}
+
+//--------------------------------------------------------------------------------------------------
+// four samples per step in vector registers. Inlined with constant channel counts every loop
+// over channels unrolls and the coefficients stay in registers.
+static inline __attribute__((always_inline)) void mix(const mixer *mx, const float **in, int16_t *out, int samples, int ins, int outs)
+{
+  float m[MIXER_MAX_CHANNELS][MIXER_MAX_CHANNELS];
+  int i = 0;
+
+  // float full scale is 1.0
+  for (int o = 0; o < outs; o++)
+    for (int c = 0; c < ins; c++)
+      m[o][c] = mx->m[o][c] * 32768.0f;
+
+  for (; i + 4 <= samples; i += 4)
+  {
+    v4sf x[MIXER_MAX_CHANNELS];
+
+    for (int c = 0; c < ins; c++)
+      memcpy(&x[c], in[c] + i, sizeof(v4sf));
+
+    for (int o = 0; o < outs; o++)
+    {
+      v4sf acc = x[0] * m[o][0];
+
+      for (int c = 1; c < ins; c++)
+        acc += x[c] * m[o][c];
+
+      for (int k = 0; k < 4; k++)
+        out[(i + k) * outs + o] = clip16(acc[k]);
+    }
+  }
+
+  for (; i < samples; i++)
+  {
+    for (int o = 0; o < outs; o++)
+    {
+      float acc = 0;
+
+      for (int c = 0; c < ins; c++)
+        acc += in[c][i] * m[o][c];
+
+      out[i * outs + o] = clip16(acc);
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void mix_6_2(const mixer *mx, const float **in, int16_t *out, int samples)
+{
+  mix(mx, in, out, samples, 6, 2);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void mix_2_6(const mixer *mx, const float **in, int16_t *out, int samples)
+{
+  mix(mx, in, out, samples, 2, 6);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void mix_8_6(const mixer *mx, const float **in, int16_t *out, int samples)
+{
+  mix(mx, in, out, samples, 8, 6);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void mix_generic(const mixer *mx, const float **in, int16_t *out, int samples)
+{
+  mix(mx, in, out, samples, mx->in_channels, mx->out_channels);
+}
+
+static const struct {
+  int ins;
+  int outs;
+  void (*kernel)(const mixer *mx, const float **in, int16_t *out, int samples);
+  const char *name;
+} kernels[] = {
+  {6, 2, mix_6_2, "5.1>2.0"},
+  {2, 6, mix_2_6, "2.0>5.1"},
+  {8, 6, mix_8_6, "7.1>5.1"},
+};
+
+//--------------------------------------------------------------------------------------------------
+void mixer_setup(mixer *mx, uint64_t in_layout, int in_channels, int out_channels, int flags)
+{
+  uint64_t in = in_layout;
+  uint64_t out = av_get_default_channel_layout(out_channels);
+
+  memset(mx, 0, sizeof(*mx));
+  mx->in_channels  = in_channels;
+  mx->in_layout    = in_layout;
+  mx->out_channels = out_channels;
+  mx->flags        = flags;
+
+  if (av_get_channel_layout_nb_channels(in) != in_channels)
+    in = av_get_default_channel_layout(in_channels);
+
+  if (!in || !out)
+  {
+    // no known layout: by position
+    for (int c = 0; c < in_channels && c < out_channels; c++)
+      mx->m[c][c] = 1;
+  }
+  else
+  {
+    for (int c = 0; c < in_channels; c++)
+      place(mx, in, out, c, av_channel_layout_extract_channel(in, c), 1);
+
+    if ((flags & MIXER_UPMIX) && in == AV_CH_LAYOUT_STEREO)
+      spread(mx, out);
+  }
+
+  // downmixes are scaled so the loudest output channel cannot clip
+  float peak = 0;
+
+  for (int o = 0; o < out_channels; o++)
+  {
+    float sum = 0;
+
+    for (int c = 0; c < in_channels; c++)
+      sum += fabsf(mx->m[o][c]);
+
+    if (sum > peak)
+      peak = sum;
+  }
+
+  for (int o = 0; o < out_channels && peak > 1; o++)
+    for (int c = 0; c < in_channels; c++)
+      mx->m[o][c] /= peak;
+
+  mx->identity = in_channels == out_channels;
+
+  for (int o = 0; o < out_channels; o++)
+    for (int c = 0; c < in_channels; c++)
+      if (mx->m[o][c] != (o == c))
+        mx->identity = 0;
+
+  mx->kernel = mix_generic;
+  mx->kernel_name = "generic";
+
+  for (unsigned k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++)
+  {
+    if (kernels[k].ins == in_channels && kernels[k].outs == out_channels)
+    {
+      mx->kernel = kernels[k].kernel;
+      mx->kernel_name = kernels[k].name;
+    }
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void mixer_planar(const mixer *mx, const float **in, int16_t *out, int samples)
+{
+  mx->kernel(mx, in, out, samples);
+}
+
+//--------------------------------------------------------------------------------------------------
+void mixer_interleaved(const mixer *mx, int16_t *buf, int samples)
+{
+  int ins = mx->in_channels, outs = mx->out_channels;
+
+  if (mx->identity)
+    return;
+
+  // in place: growing runs backwards, shrinking forwards, so no input is overwritten unread
+  int grow = outs > ins;
+
+  for (int i = 0; i < samples; i++)
+  {
+    int s = grow ? samples - 1 - i : i;
+    const int16_t *in = buf + s * ins;
+    int16_t v[MIXER_MAX_CHANNELS];
+
+    for (int o = 0; o < outs; o++)
+    {
+      float acc = 0;
+
+      for (int c = 0; c < ins; c++)
+        acc += in[c] * mx->m[o][c];
+
+      v[o] = clip16(acc);
+    }
+
+    memcpy(buf + s * outs, v, outs * sizeof(int16_t));
+  }
+}
@@ -0,0 +1,46 @@
+/*
+ * mixer.h
+ *
+ * Channel matrix mixing into a fixed output channel count (-m): layouts the
+ * output lacks are downmixed (LoRo or Dolby Surround compatible LtRt),
+ * stereo can be spread over a surround output. The coefficients are built
+ * once per layout change; planar float decoder output is mixed and
+ * interleaved to S16 in one pass by kernels unrolled for 5.1 > 2.0,
+ * 2.0 > 5.1 and 7.1 > 5.1, any other pair takes the generic kernel.
+ */
+
+#ifndef MIXER_H_
+#define MIXER_H_
+
+#include <stdint.h>
+
+#define MIXER_MAX_CHANNELS 8
+
+// -M flags
+#define MIXER_LTRT   1            // surrounds matrixed into stereo for a Pro Logic decoder
+#define MIXER_UPMIX  2            // stereo spread to center and surrounds
+
+typedef struct s_mixer {
+  int in_channels;                // 0 = not set up
+  uint64_t in_layout;             // as passed to mixer_setup()
+  int out_channels;
+  int flags;
+  int identity;                   // the output is the input, nothing to mix
+  float m[MIXER_MAX_CHANNELS][MIXER_MAX_CHANNELS];  // [out][in]
+  void (*kernel)(const struct s_mixer *mx, const float **in, int16_t *out, int samples);
+  const char *kernel_name;
+} mixer;
+
+// "loro" (default), "ltrt", "upmix" comma separated, e.g. "ltrt,upmix". Flags, -1 on a bad spec.
+int mixer_parse(const char *spec);
+
+// in_layout 0 = the default layout of in_channels, the output always has the default layout
+void mixer_setup(mixer *mx, uint64_t in_layout, int in_channels, int out_channels, int flags);
+
+// planar float (AV_SAMPLE_FMT_FLTP) to interleaved S16 of out_channels
+void mixer_planar(const mixer *mx, const float **in, int16_t *out, int samples);
+
+// interleaved S16 in place, buf holds samples * max(in_channels, out_channels)
+void mixer_interleaved(const mixer *mx, int16_t *buf, int samples);
+
+#endif /* MIXER_H_ */
@@ -48,3 +48,22 @@ double gettimeofday_ms()
 
   return stamp.tv_sec * 1000.0L + stamp.tv_usec / 1000.0L;
 }
+
+double clock_ms(clockid_t id)
+{
+  struct timespec ts;
+  clock_gettime(id, &ts);
+
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+double monotonic_ms()
+{
+  return clock_ms(CLOCK_MONOTONIC);
+}
+
+void sleep_ms(double ms)
+{
+  struct timespec ts = {.tv_sec = (time_t)(ms / 1000), .tv_nsec = (long)((ms - (time_t)(ms / 1000) * 1000) * 1000000)};
+  nanosleep(&ts, NULL);
+}
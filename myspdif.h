@@ -24,16 +24,22 @@
 
 #include <stdint.h>
 #include <sys/time.h>
+#include <time.h>
 #include <libavformat/avformat.h>
+#include "burstcheck.h"
 
 #define SYNCWORD1 0xF872
 #define SYNCWORD2 0x4E1F
 #define BURST_HEADER_SIZE 0x8
+#define EAC3_BURST_SIZE 24576    // repetition period of 6144 frames, the link runs at 4x the sample rate
+//#define MAX_BURST_SIZE	24576           //  Dolby Digital+ bust            = 6144 frames = 128ms
+#define MAX_BURST_SIZE	(8+1792+4344)     //  Dolby Digital  bust 6144 bytes = 1536 frames =  32ms, read size
 #define SPDIF_MAX_OFFSET 16384
 
 #define SPIF_DECODER_RETRY_REQUIRED   1
 #define SPIF_DECODER_RESTART_REQUIRED 2
 #define SPIF_DECODER_PCM              3
+#define SPIF_DECODER_REJECTED         4   // corrupt payload dropped, see burstcheck.h
 
 /*
 enum myIEC61937DataType {
@@ -67,12 +73,30 @@ static const uint16_t spdif_mpeg_pkt_offset[2][3] = {
 };
 */
 
+// demuxer state of one input, initialize with MY_SPDIF_STATE_INIT
+typedef struct {
+  uint32_t state;                               // last 4 bytes read while searching the sync words
+  int last_data_type;                           // enum IEC61937DataType, 0 = PCM
+  int burst_size;                               // bytes from this preamble to the next, 0 if unknown
+  int rejected_reason;                          // BURSTCHECK_* of the last SPIF_DECODER_REJECTED
+  unsigned rejected[BURSTCHECK_REASONS];        // bursts rejected since start, per reason
+  int (*skip)(void *opaque, int bytes);         // optional: drops whole frames of input unread, bytes dropped
+  void *skip_opaque;
+} MySpdifState;
+
+#define MY_SPDIF_STATE_INIT {.state = 0, .last_data_type = 0xFF}
+
 void my_spdif_bswap_buf16(uint16_t *dst, const uint16_t *src, int w);
-int my_spdif_read_packet(AVFormatContext *s, AVPacket *pkt,
+int my_spdif_read_packet(AVFormatContext *s, MySpdifState *rs, AVPacket *pkt,
 		uint8_t * garbagebuffer, int garbagebuffersize, int * garbagebufferfilled);
 int my_spdif_probe(const uint8_t *p_buf, int buf_size, enum AVCodecID *codec);
 
 double gettimeofday_ms();
 
+// ms of any clock, monotonic_ms() for intervals and pacing, sleep_ms() to wait for a pace
+double clock_ms(clockid_t id);
+double monotonic_ms();
+void sleep_ms(double ms);
+
 
 #endif /* MYSPDIF_H_ */
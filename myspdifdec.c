@@ -25,14 +25,19 @@
  * @author Anssi Hannula
  */
 
+#include <stdatomic.h>
 #include <libavformat/avformat.h>
 #include <libavformat/spdif.h>
 #include "myspdif.h"
+#include "log.h"
+#include "record.h"
+#include "prof.h"
+#include "fault.h"
 #include <libavcodec/ac3.h>
 #include "libavcodec/adts_parser.h"
 #include "libavutil/bswap.h"
 
-extern int debug_data;
+extern atomic_int debug_data;
 
 static int spdif_get_offset_and_codec(AVFormatContext *s,
                                       enum IEC61937DataType data_type,
@@ -49,7 +54,7 @@ static int spdif_get_offset_and_codec(AVFormatContext *s,
         *codec = AV_CODEC_ID_AC3;
         break;
     case IEC61937_EAC3:
-        *offset = 0;
+        *offset = EAC3_BURST_SIZE;
         *codec = AV_CODEC_ID_EAC3;
         break;
     case IEC61937_MPEG1_LAYER1:
@@ -105,10 +110,33 @@ static int spdif_get_offset_and_codec(AVFormatContext *s,
 }
 
 
-enum IEC61937DataType last_data_type = 0xFF;
-uint32_t state = 0;
+// padding up to the next burst: what the AVIO buffer holds is stepped over, the frames after it
+// the source drops without them being read (rs->skip), only what it could not is read and discarded
+static void skip_padding(AVIOContext *pb, MySpdifState *rs, int bytes)
+{
+    int buffered = pb->buf_end - pb->buf_ptr;
+    int direct = (bytes - buffered) & ~3;
+
+    if (!rs->skip || direct <= 0) {
+        avio_skip(pb, bytes);
+        return;
+    }
+
+    pb->buf_ptr = pb->buf_end;
+
+    int n = rs->skip(rs->skip_opaque, direct);
+
+    if (n < 0)
+        n = 0;
+
+    pb->pos += n;
+
+    if (bytes - buffered - n > 0)
+        avio_skip(pb, bytes - buffered - n);
+}
+
 
-int my_spdif_read_packet(AVFormatContext *spdif_ctx, AVPacket *pkt,
+int my_spdif_read_packet(AVFormatContext *spdif_ctx, MySpdifState *rs, AVPacket *pkt,
 		uint8_t * garbagebuffer, int garbagebuffersize, int * garbagebufferfilled)
 {
     AVIOContext *pb = spdif_ctx->pb;
@@ -124,37 +152,40 @@ int my_spdif_read_packet(AVFormatContext *spdif_ctx, AVPacket *pkt,
     if(debug_data)
       start = gettimeofday_ms();
 
-    while (state != (AV_BSWAP16C(SYNCWORD1) << 16 | AV_BSWAP16C(SYNCWORD2))) 
+    while (rs->state != (AV_BSWAP16C(SYNCWORD1) << 16 | AV_BSWAP16C(SYNCWORD2))) 
     {
     	if(*garbagebufferfilled < garbagebuffersize)
       {
     		*garbagebuffer = avio_r8(pb);
     		(*garbagebufferfilled)++;
 
-    		state = (state << 8) | *garbagebuffer;
+    		rs->state = (rs->state << 8) | *garbagebuffer;
     		garbagebuffer++;
 
     		if (avio_feof(pb)) {
-          printf("read_packet EOF\n");
+          log_printf("read_packet EOF\n");
           return AVERROR_EOF;
         }
     	}
       else 
       {
-        if(last_data_type)
-          printf("No packet found > PCM\n");
+        if(rs->last_data_type)
+          log_printf("No packet found > PCM\n");
 
         // no stream found > unencoded PCM
-        last_data_type = 0;
+        rs->last_data_type = 0;
 
         if (spdif_ctx->nb_streams)
         {
-          printf("active stream > restart\n");
+          log_printf("active stream > restart\n");
+          record_event(RECORD_RESTART, &(record_reason){RECORD_REASON_PCM_WITH_STREAM}, sizeof(record_reason));
           return SPIF_DECODER_RESTART_REQUIRED;
         }
 
         if(debug_data)
-          printf("read_packet PCM\n");
+          log_printf("read_packet PCM\n");
+
+        record_event(RECORD_PCM, NULL, 0);
 
     		return SPIF_DECODER_PCM;
       }
@@ -163,15 +194,21 @@ int my_spdif_read_packet(AVFormatContext *spdif_ctx, AVPacket *pkt,
     if(debug_data)
     {
       double end = gettimeofday_ms();
-      printf("read_packet start in %.1lf ms\n", end - start);
+      log_printf("read_packet start in %.1lf ms\n", end - start);
       start = end;
     }
 
+    prof_stage(PROF_PAYLOAD);
+
     *garbagebufferfilled -= 4;
-    state = 0;
+    rs->state = 0;
     data_type = avio_rl16(pb);
     pkt_size  = avio_rl16(pb); 
 
+    // -F codec: another known data type, the codec change restarts the pipeline
+    if (fault_fire(FAULT_CODEC, NULL))
+      data_type = (data_type & 0xff) == IEC61937_AC3 ? IEC61937_MPEG1_LAYER23 : IEC61937_AC3;
+
     if(data_type != IEC61937_EAC3)
     {
       // size in bits, max 2048 frames
@@ -182,6 +219,9 @@ int my_spdif_read_packet(AVFormatContext *spdif_ctx, AVPacket *pkt,
         pkt_size = pkt_size >> 3;  // bits -> bytes
     }
 
+    if (record_enabled)
+      record_event(RECORD_BURST, &(record_burst){data_type, pkt_size, *garbagebufferfilled}, sizeof(record_burst));
+
     ret = av_new_packet(pkt, pkt_size);
     if (ret)
       return ret;
@@ -190,7 +230,7 @@ int my_spdif_read_packet(AVFormatContext *spdif_ctx, AVPacket *pkt,
 
     if (avio_read(pb, pkt->data, pkt->size) < pkt->size) 
     {
-      printf("read_packet: error avio_read\n");
+      log_printf("read_packet: error avio_read\n");
       av_free_packet(pkt);
       return AVERROR_EOF;
     }
@@ -198,7 +238,7 @@ int my_spdif_read_packet(AVFormatContext *spdif_ctx, AVPacket *pkt,
     if(debug_data)
     {
       double end = gettimeofday_ms();
-      printf("read_packet %d bytes in %.1lf ms\n", pkt->size, gettimeofday_ms() - start);
+      log_printf("read_packet %d bytes in %.1lf ms\n", pkt->size, gettimeofday_ms() - start);
       start = end;
     }
 
@@ -208,40 +248,42 @@ int my_spdif_read_packet(AVFormatContext *spdif_ctx, AVPacket *pkt,
 
     if (ret) 
     {
-      if(data_type != last_data_type)
-        printf("Unknown codec %d\n", data_type & 0xff);
+      if(data_type != rs->last_data_type)
+        log_printf("Unknown codec %d\n", data_type & 0xff);
 
-      last_data_type = data_type;
+      rs->last_data_type = data_type;
       av_free_packet(pkt);
 
       if (spdif_ctx->nb_streams)
       {
-        printf("active stream > restart\n");
+        log_printf("active stream > restart\n");
+        record_event(RECORD_RESTART, &(record_reason){RECORD_REASON_UNKNOWN_CODEC}, sizeof(record_reason));
         return SPIF_DECODER_RESTART_REQUIRED;
       }
       else 
         return SPIF_DECODER_RETRY_REQUIRED;
     }
 
-    last_data_type = data_type;
+    rs->last_data_type = data_type;
+    rs->burst_size = offset;
 
     if(debug_data)
-      printf("read_packet codec %s\n", avcodec_get_name(codec_id));
+      log_printf("read_packet codec %s\n", avcodec_get_name(codec_id));
 
     // skip over the padding to the beginning of the next frame
     int skip_bytes = offset - pkt->size - BURST_HEADER_SIZE;
 
-    if(offset && skip_bytes) 
+    if(offset && skip_bytes > 0) 
     {
       if(debug_data)
         start = gettimeofday_ms();
 
-      avio_skip(pb, skip_bytes);
+      skip_padding(pb, rs, skip_bytes);
 
       if(debug_data)
       {
         double end = gettimeofday_ms();
-        printf("read_packet skip %d bytes in %.1lf ms\n", skip_bytes, gettimeofday_ms() - start);
+        log_printf("read_packet skip %d bytes in %.1lf ms\n", skip_bytes, gettimeofday_ms() - start);
         start = end;
       }
     }
@@ -253,7 +295,7 @@ int my_spdif_read_packet(AVFormatContext *spdif_ctx, AVPacket *pkt,
 
       if (!st) 
       {
-        printf("read_packet: Could not create stream\n");
+        log_printf("read_packet: Could not create stream\n");
         av_free_packet(pkt);
         return AVERROR(ENOMEM);
       }
@@ -261,16 +303,30 @@ int my_spdif_read_packet(AVFormatContext *spdif_ctx, AVPacket *pkt,
       st->codec->codec_type = AVMEDIA_TYPE_AUDIO;
       st->codec->codec_id   = codec_id;
 
+      record_event(RECORD_CODEC, &(record_codec){codec_id, 0}, sizeof(record_codec));
+
       if (!spdif_ctx->bit_rate && spdif_ctx->streams[0]->codec->sample_rate)
         // stream bitrate matches 16-bit stereo PCM bitrate for currently supported codecs
         spdif_ctx->bit_rate = 2 * 16 * spdif_ctx->streams[0]->codec->sample_rate;
     } 
     else if (codec_id != spdif_ctx->streams[0]->codec->codec_id)
     {
-      printf("codec changed from %s to %s\n", avcodec_get_name(spdif_ctx->streams[0]->codec->codec_id), avcodec_get_name(codec_id));
+      log_printf("codec changed from %s to %s\n", avcodec_get_name(spdif_ctx->streams[0]->codec->codec_id), avcodec_get_name(codec_id));
+      record_event(RECORD_RESTART, &(record_reason){RECORD_REASON_CODEC_CHANGED}, sizeof(record_reason));
       av_free_packet(pkt);
       return SPIF_DECODER_RESTART_REQUIRED;
     }
+
+    // a corrupt payload would fail in the decoder and restart the pipeline
+    int reason = burstcheck(codec_id, pkt->data, pkt->size);
+
+    if (reason != BURSTCHECK_OK)
+    {
+      rs->rejected_reason = reason;
+      rs->rejected[reason]++;
+      av_free_packet(pkt);
+      return SPIF_DECODER_REJECTED;
+    }
    
     return 0;
 }
@@ -0,0 +1,308 @@
+/*
+ * prof.c
+ *
+ * Per burst hardware counter profiling, see prof.h
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "prof.h"
+#include "log.h"
+
+enum { M_CYCLES, M_INSTRUCTIONS, M_MISSES, M_SWITCHES, M_WALL, METRICS };
+
+#define EVENTS        M_WALL
+#define PROF_BUCKETS  (64 * 4)    // 4 per power of two, within 25%
+
+static const struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} events[EVENTS] = {
+  {"cycles",       PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+  {"ctx-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+static const char *metric_names[METRICS] = {"cycles", "instr", "misses", "switches", "wall us"};
+static const char *stage_names[PROF_STAGES + 1] = {"sync", "payload", "decode", "convert", "write", "burst"};
+
+typedef struct {
+  unsigned long long sum;
+  unsigned long long max;
+  unsigned buckets[PROF_BUCKETS];
+} prof_hist;
+
+int prof_enabled = 0;
+
+static int leader = -1;
+static int slot[EVENTS];                          // position in the group read, -1 = n/a
+static int user_only;
+static uint64_t last[METRICS];                    // counters at the last stage boundary
+static int current = -1;
+static uint64_t burst[PROF_STAGES][METRICS];
+static int written;
+static prof_hist hist[PROF_STAGES + 1][METRICS];  // + the whole burst
+static unsigned long bursts, dropped;
+
+//--------------------------------------------------------------------------------------------------
+static int open_event(int i, int exclude_kernel)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = events[i].type;
+  attr.config         = events[i].config;
+  attr.disabled       = leader < 0;
+  attr.exclude_kernel = exclude_kernel;
+  attr.exclude_hv     = 1;
+  attr.read_format    = PERF_FORMAT_GROUP;
+
+  // this thread on any cpu
+  return syscall(__NR_perf_event_open, &attr, 0, -1, leader, 0);
+}
+
+//--------------------------------------------------------------------------------------------------
+void prof_init()
+{
+  int slots = 0;
+
+  if (!prof_enabled)
+    return;
+
+  for (int i = 0; i < EVENTS; i++)
+  {
+    int fd = open_event(i, user_only);
+
+    // perf_event_paranoid 2 allows user space counting only
+    if (fd < 0 && !user_only && (fd = open_event(i, 1)) >= 0)
+      user_only = 1;
+
+    slot[i] = fd < 0 ? -1 : slots++;
+
+    if (fd < 0)
+      log_printf("prof: %s not available\n", events[i].name);
+
+    if (fd >= 0 && leader < 0)
+      leader = fd;
+  }
+
+  if (leader >= 0)
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  else
+    log_printf("prof: no performance counters available (perf_event_paranoid?), wall time only\n");
+}
+
+//--------------------------------------------------------------------------------------------------
+static void read_counters(uint64_t *v)
+{
+  struct { uint64_t nr; uint64_t values[EVENTS]; } data;
+  struct timespec ts;
+
+  memset(v, 0, METRICS * sizeof(uint64_t));
+
+  if (leader >= 0 && read(leader, &data, sizeof(data)) > 0)
+    for (int i = 0; i < EVENTS; i++)
+      if (slot[i] >= 0)
+        v[i] = data.values[slot[i]];
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  v[M_WALL] = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int bucket(uint64_t v)
+{
+  if (v < 4)
+    return v;
+
+  int e = 63 - __builtin_clzll(v);
+
+  return e * 4 + ((v >> (e - 2)) & 3);
+}
+
+//--------------------------------------------------------------------------------------------------
+// upper end of the bucket
+static uint64_t bucket_value(int b)
+{
+  if (b < 4)
+    return b;
+
+  int e = b / 4;
+
+  return ((uint64_t)(5 + b % 4) << (e - 2)) - 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void hist_add(prof_hist *h, uint64_t v)
+{
+  h->sum += v;
+  h->buckets[bucket(v)]++;
+
+  if (v > h->max)
+    h->max = v;
+}
+
+//--------------------------------------------------------------------------------------------------
+static uint64_t percentile(const prof_hist *h, double p)
+{
+  unsigned long need = bursts * p, seen = 0;
+
+  for (int b = 0; b < PROF_BUCKETS; b++)
+    if ((seen += h->buckets[b]) > need)
+      return bucket_value(b) < h->max ? bucket_value(b) : h->max;
+
+  return h->max;
+}
+
+//--------------------------------------------------------------------------------------------------
+void prof_stage(int stage)
+{
+  uint64_t now[METRICS];
+
+  if (!prof_enabled)
+    return;
+
+  read_counters(now);
+
+  if (current >= 0)
+    for (int m = 0; m < METRICS; m++)
+      burst[current][m] += now[m] - last[m];
+
+  memcpy(last, now, sizeof(last));
+  current = stage;
+
+  if (stage == PROF_WRITE)
+    written = 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+void prof_burst()
+{
+  if (!prof_enabled)
+    return;
+
+  prof_stage(PROF_SYNC);
+
+  // restarts, format changes and catch up skips would only blur the distributions
+  if (written)
+  {
+    uint64_t total[METRICS] = {0};
+
+    for (int s = 0; s < PROF_STAGES; s++)
+    {
+      for (int m = 0; m < METRICS; m++)
+      {
+        hist_add(&hist[s][m], burst[s][m]);
+        total[m] += burst[s][m];
+      }
+    }
+
+    for (int m = 0; m < METRICS; m++)
+      hist_add(&hist[PROF_STAGES][m], total[m]);
+
+    bursts++;
+  }
+  else if (burst[PROF_SYNC][M_WALL])
+    dropped++;
+
+  memset(burst, 0, sizeof(burst));
+  written = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void cpu_name(char *name, int size)
+{
+  FILE *f = fopen("/proc/cpuinfo", "r");
+  char line[256];
+
+  snprintf(name, size, "unknown");
+
+  while (f && fgets(line, sizeof(line), f))
+  {
+    char *colon = strchr(line, ':');
+
+    // x86 and ARM "model name", the Raspberry Pi board "Model" wins: both Pi 3 and 4 are ARMv7
+    if (colon && (!strncmp(line, "model name", 10) || !strncmp(line, "Model", 5)))
+    {
+      snprintf(name, size, "%s", colon + 2);
+      name[strcspn(name, "\n")] = 0;
+    }
+  }
+
+  if (f)
+    fclose(f);
+}
+
+//--------------------------------------------------------------------------------------------------
+// log_report() is not rate limited
+void prof_report()
+{
+  char cpu[128];
+
+  if (!prof_enabled)
+    return;
+
+  cpu_name(cpu, sizeof(cpu));
+
+  log_report("profile: %lu bursts, %lu without output not counted, cpu %s%s\n", bursts, dropped, cpu,
+    user_only ? ", user space only" : "");
+
+  if (!bursts)
+    return;
+
+  log_report("  %-8s %-9s %12s %12s %12s %12s %12s\n", "stage", "per burst", "mean", "p50", "p90", "p99", "max");
+
+  for (int s = 0; s <= PROF_STAGES; s++)
+  {
+    const char *name = stage_names[s];
+
+    for (int m = 0; m < METRICS; m++)
+    {
+      const prof_hist *h = &hist[s][m];
+
+      if (m < EVENTS && slot[m] < 0)
+        continue;
+
+      log_report("  %-8s %-9s %12.1f %12llu %12llu %12llu %12llu\n", name, metric_names[m],
+        (double)h->sum / bursts, (unsigned long long)percentile(h, 0.5), (unsigned long long)percentile(h, 0.9),
+        (unsigned long long)percentile(h, 0.99), h->max);
+      name = "";
+    }
+  }
+
+  log_report("summary:\n");
+
+  for (int s = 0; s < PROF_STAGES; s++)
+  {
+    const prof_hist *h = hist[s], *t = hist[PROF_STAGES];
+    char counters[160] = "";
+
+    if (slot[M_CYCLES] >= 0 && slot[M_INSTRUCTIONS] >= 0)
+      snprintf(counters, sizeof(counters), ", IPC %.2f, %.1f%% of cycles",
+        h[M_CYCLES].sum ? (double)h[M_INSTRUCTIONS].sum / h[M_CYCLES].sum : 0.0,
+        t[M_CYCLES].sum ? 100.0 * h[M_CYCLES].sum / t[M_CYCLES].sum : 0.0);
+
+    if (slot[M_MISSES] >= 0 && slot[M_INSTRUCTIONS] >= 0)
+      snprintf(counters + strlen(counters), sizeof(counters) - strlen(counters), ", %.2f misses/1k instr",
+        h[M_INSTRUCTIONS].sum ? 1000.0 * h[M_MISSES].sum / h[M_INSTRUCTIONS].sum : 0.0);
+
+    if (slot[M_SWITCHES] >= 0)
+      snprintf(counters + strlen(counters), sizeof(counters) - strlen(counters), ", %.2f switches/burst",
+        (double)h[M_SWITCHES].sum / bursts);
+
+    log_report("  %-8s %5.1f%% of wall%s\n", stage_names[s],
+      t[M_WALL].sum ? 100.0 * h[M_WALL].sum / t[M_WALL].sum : 0.0, counters);
+  }
+}
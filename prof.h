@@ -0,0 +1,42 @@
+/*
+ * prof.h
+ *
+ * Per burst profiling with hardware counters (-P). Cycles, instructions,
+ * cache misses and context switches of the pipeline thread are read with
+ * perf_event_open() at every stage boundary and accounted to the stage that
+ * just ended, next to its wall time. Bursts that reached the output are
+ * added to per stage histograms, a report with the distributions (median,
+ * p90, p99, max per burst) and a summary (IPC, misses per 1000 instructions,
+ * share of the burst) is logged at exit. A stage that blocks shows as wall
+ * time without cycles plus context switches, a cache bound one as low IPC.
+ *
+ * Counters the kernel or the PMU does not offer (perf_event_paranoid > 1
+ * without CAP_PERFMON, VMs, some ARM boards) are reported as n/a.
+ */
+
+#ifndef PROF_H_
+#define PROF_H_
+
+enum {
+  PROF_SYNC,                  // looking for the next preamble, includes waiting for the input
+  PROF_PAYLOAD,               // payload read and byteswap
+  PROF_DECODE,
+  PROF_CONVERT,               // sample format, rate and channel conversion
+  PROF_WRITE,
+  PROF_STAGES
+};
+
+extern int prof_enabled;
+
+// opens the counters for the calling thread, the one running the pipeline
+void prof_init();
+
+// start of a burst: the last one is accounted if it was written, PROF_SYNC begins
+void prof_burst();
+
+// the current stage ends, stage begins
+void prof_stage(int stage);
+
+void prof_report();
+
+#endif /* PROF_H_ */
@@ -0,0 +1,299 @@
+/*
+ * record.c
+ *
+ * Field capture recorder, see record.h
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <time.h>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "record.h"
+#include "log.h"
+#include "myspdif.h"
+
+#define RECORD_POLL_US      20000
+#define RECORD_FLUSH_MS     1000    // partial block is written at least this often
+
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_WHO_PROCESS  1
+
+typedef struct {
+  uint16_t type;
+  uint16_t len;
+  uint32_t reserved;
+  uint64_t time_us;
+} ring_header;
+
+int record_enabled = 0;
+
+static uint8_t ring[RECORD_RING_SIZE];
+static atomic_ullong ring_head;
+static atomic_ullong ring_tail;
+static atomic_uint ring_dropped;
+
+static int fd = -1;
+static uint32_t max_blocks;
+static double start_ms;
+
+static uint8_t block[RECORD_BLOCK_SIZE];
+static uint32_t block_used;          // record bytes after the block header
+static uint64_t block_time;
+static uint32_t block_seq = 1;
+static uint32_t block_slot = 0;
+
+static pthread_t record_thread;
+static atomic_int record_running;
+
+//--------------------------------------------------------------------------------------------------
+static void ring_put(uint64_t pos, const void *src, int n)
+{
+  uint32_t off = pos & (RECORD_RING_SIZE - 1);
+  uint32_t first = n < (int)(RECORD_RING_SIZE - off) ? n : RECORD_RING_SIZE - off;
+
+  memcpy(ring + off, src, first);
+  memcpy(ring, (const uint8_t*)src + first, n - first);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void ring_get(uint64_t pos, void *dst, int n)
+{
+  uint32_t off = pos & (RECORD_RING_SIZE - 1);
+  uint32_t first = n < (int)(RECORD_RING_SIZE - off) ? n : RECORD_RING_SIZE - off;
+
+  memcpy(dst, ring + off, first);
+  memcpy((uint8_t*)dst + first, ring, n - first);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void push(int type, const void *data, int len)
+{
+  uint64_t head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&ring_tail, memory_order_acquire);
+  int need = sizeof(ring_header) + len;
+
+  if (RECORD_RING_SIZE - (head - tail) < (uint64_t)need)
+  {
+    atomic_fetch_add_explicit(&ring_dropped, 1, memory_order_relaxed);
+    return;
+  }
+
+  ring_header h = {.type = type, .len = len, .time_us = (uint64_t)((monotonic_ms() - start_ms) * 1000)};
+
+  ring_put(head, &h, sizeof(h));
+
+  if (len)
+    ring_put(head + sizeof(h), data, len);
+
+  atomic_store_explicit(&ring_head, head + need, memory_order_release);
+}
+
+//--------------------------------------------------------------------------------------------------
+void record_raw(const uint8_t *buf, int size)
+{
+  if (!record_enabled)
+    return;
+
+  // record lengths are 16 bit
+  for (int n; size > 0; buf += n, size -= n)
+  {
+    n = size < 32768 ? size : 32768;
+    push(RECORD_RAW, buf, n);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void record_event(int type, const void *data, int size)
+{
+  if (record_enabled)
+    push(type, data, size);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void block_write()
+{
+  record_block_header *bh = (record_block_header*)block;
+
+  bh->magic   = RECORD_BLOCK_MAGIC;
+  bh->seq     = block_seq;
+  bh->time_us = block_time;
+  bh->used    = block_used;
+
+  off_t offset = RECORD_HEADER_SIZE + (off_t)block_slot * RECORD_BLOCK_SIZE;
+  ssize_t size = sizeof(record_block_header) + block_used;
+
+  if (pwrite(fd, block, size, offset) != size)
+    log_printf("record: write failed: %s\n", strerror(errno));
+}
+
+//--------------------------------------------------------------------------------------------------
+static void block_finish()
+{
+  block_write();
+
+  block_used = 0;
+  block_seq++;
+  block_slot = (block_slot + 1) % max_blocks;
+}
+
+//--------------------------------------------------------------------------------------------------
+// append a record to the current block, raw data is split over blocks, events are not
+static void block_append(int type, uint64_t time_us, const uint8_t *data, int len)
+{
+  while (1)
+  {
+    if (block_used == 0)
+      block_time = time_us;
+
+    int space = RECORD_BLOCK_SIZE - (int)sizeof(record_block_header) - (int)block_used - (int)sizeof(record_header);
+
+    if (space <= 0 || (type != RECORD_RAW && len > space) || time_us - block_time > UINT32_MAX)
+    {
+      block_finish();
+      continue;
+    }
+
+    int n = len < space ? len : space;
+    record_header rh = {.type = type, .len = n, .dt_us = time_us - block_time};
+    uint8_t *p = block + sizeof(record_block_header) + block_used;
+
+    memcpy(p, &rh, sizeof(rh));
+    memcpy(p + sizeof(rh), data, n);
+    block_used += sizeof(rh) + n;
+
+    data += n;
+    len -= n;
+
+    if (len == 0)
+      return;
+
+    block_finish();
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+static int drain()
+{
+  static uint8_t payload[65536];
+  int n = 0;
+
+  uint64_t tail = atomic_load_explicit(&ring_tail, memory_order_relaxed);
+  uint64_t head = atomic_load_explicit(&ring_head, memory_order_acquire);
+
+  while (tail != head)
+  {
+    ring_header h;
+
+    ring_get(tail, &h, sizeof(h));
+    ring_get(tail + sizeof(h), payload, h.len);
+    tail += sizeof(h) + h.len;
+
+    block_append(h.type, h.time_us, payload, h.len);
+    n++;
+  }
+
+  atomic_store_explicit(&ring_tail, tail, memory_order_release);
+
+  uint32_t dropped = atomic_exchange_explicit(&ring_dropped, 0, memory_order_relaxed);
+
+  if (dropped)
+    block_append(RECORD_DROP, (uint64_t)((monotonic_ms() - start_ms) * 1000), (uint8_t*)&dropped, sizeof(dropped));
+
+  return n;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void* record_thread_main(void *arg)
+{
+  // stay out of the way of the audio threads, cpu and disk
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+  syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+  double lastFlush = monotonic_ms();
+
+  while (atomic_load(&record_running))
+  {
+    drain();
+
+    double now = monotonic_ms();
+
+    if (now - lastFlush >= RECORD_FLUSH_MS && block_used)
+    {
+      block_write();
+      lastFlush = now;
+    }
+
+    usleep(RECORD_POLL_US);
+  }
+
+  return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+void record_init(const char *path, long long max_bytes)
+{
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+  if (fd < 0)
+    err(1, "cannot create recording %s", path);
+
+  long long blocks = (max_bytes - RECORD_HEADER_SIZE) / RECORD_BLOCK_SIZE;
+  max_blocks = blocks < 2 ? 2 : blocks > UINT32_MAX ? UINT32_MAX : blocks;
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  static uint8_t header[RECORD_HEADER_SIZE];
+  record_file_header *fh = (record_file_header*)header;
+
+  memcpy(fh->magic, RECORD_MAGIC, sizeof(fh->magic));
+  fh->version       = RECORD_VERSION;
+  fh->block_size    = RECORD_BLOCK_SIZE;
+  fh->max_blocks    = max_blocks;
+  fh->start_time_us = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+
+  if (pwrite(fd, header, sizeof(header), 0) != sizeof(header))
+    err(1, "cannot write recording %s", path);
+
+  start_ms = monotonic_ms();
+  record_enabled = 1;
+  atomic_store(&record_running, 1);
+
+  if (pthread_create(&record_thread, NULL, record_thread_main, NULL) != 0)
+    errx(1, "cannot create recorder thread");
+
+  atexit(record_deinit);
+
+  log_printf("recording input to %s, max %u blocks of %d kB\n", path, max_blocks, RECORD_BLOCK_SIZE / 1024);
+}
+
+//--------------------------------------------------------------------------------------------------
+void record_deinit()
+{
+  if (!atomic_exchange(&record_running, 0))
+    return;
+
+  record_enabled = 0;
+  pthread_join(record_thread, NULL);
+
+  drain();
+
+  if (block_used)
+    block_write();
+
+  close(fd);
+  fd = -1;
+}
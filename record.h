@@ -0,0 +1,92 @@
+/*
+ * record.h
+ *
+ * Field capture recorder (-r). Tees the raw input bytes and the burst
+ * boundaries and codec decisions of the demuxer into a timestamped file.
+ * The audio thread only copies into a ring, a low priority writer thread
+ * packs the records into fixed size blocks and writes them with pwrite.
+ *
+ * The file is a rolling buffer: a header followed by max_blocks blocks, when
+ * the size cap is reached the oldest block is overwritten. Every block starts
+ * with a sequence number and a timestamp, so a reader can seek to any block
+ * and find the oldest one. Replay with -i record:<file>.
+ */
+
+#ifndef RECORD_H_
+#define RECORD_H_
+
+#include <stdint.h>
+
+#define RECORD_MAGIC        "SPDIFREC"
+#define RECORD_VERSION      1
+#define RECORD_HEADER_SIZE  4096
+#define RECORD_BLOCK_SIZE   (64*1024)
+#define RECORD_BLOCK_MAGIC  0x304b4c42    // "BLK0"
+#define RECORD_RING_SIZE    (1024*1024)   // ~5s of input at the line rate
+
+enum {
+  RECORD_PAD = 0,
+  RECORD_RAW,         // raw input bytes as returned by the source
+  RECORD_BURST,       // record_burst: IEC 61937 burst found
+  RECORD_PCM,         // no burst found, input is PCM
+  RECORD_RESTART,     // record_reason: demuxer/decoder requested a restart
+  RECORD_CODEC,       // record_codec: codec decision
+  RECORD_DROP,        // uint32_t: records dropped because the ring was full
+};
+
+enum {
+  RECORD_REASON_UNKNOWN_CODEC = 1,
+  RECORD_REASON_CODEC_CHANGED,
+  RECORD_REASON_PCM_WITH_STREAM,
+  RECORD_REASON_DECODE_FAILED,
+};
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t block_size;
+  uint32_t max_blocks;
+  uint32_t reserved;
+  uint64_t start_time_us;   // wall clock of the start of the recording, unix µs
+} record_file_header;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;
+  uint64_t time_us;         // µs since start of the recording
+  uint32_t used;            // bytes of records following the header
+  uint32_t reserved;
+} record_block_header;
+
+typedef struct {
+  uint8_t type;
+  uint8_t reserved;
+  uint16_t len;             // payload bytes
+  uint32_t dt_us;           // µs since the block time
+} record_header;
+
+typedef struct {
+  uint16_t data_type;       // Pc
+  uint16_t pkt_size;        // payload bytes
+  uint32_t garbage;         // bytes skipped before the sync word
+} record_burst;
+
+typedef struct {
+  uint32_t codec_id;
+  uint32_t channels;
+} record_codec;
+
+typedef struct {
+  uint32_t reason;
+} record_reason;
+
+extern int record_enabled;
+
+// max_bytes: size cap of the rolling file
+void record_init(const char *path, long long max_bytes);
+void record_deinit();
+
+void record_raw(const uint8_t *buf, int size);
+void record_event(int type, const void *data, int size);
+
+#endif /* RECORD_H_ */
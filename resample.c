@@ -5,8 +5,50 @@
  *      Author: sebastian
  */
 #include "resample.h"
+#include "codechandler.h"
 
+#include <string.h>
+#include <err.h>
 #include <libavutil/opt.h>
+#include <libavutil/channel_layout.h>
+
+static int quality = RESAMPLE_QUALITY_MEDIUM;
+
+int resample_setQuality(const char *name){
+	static const char *names[] = {"low", "medium", "high"};
+
+	for(int i = 0; i < 3; i++){
+		if(!strcmp(name, names[i])){
+			quality = i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+// only used when the rates differ, swr does not resample otherwise
+static void set_filter(SwrContext *swr){
+	switch(quality){
+	case RESAMPLE_QUALITY_LOW:
+		av_opt_set_int(swr, "filter_size",   8, 0);
+		av_opt_set_int(swr, "phase_shift",   6, 0);
+		av_opt_set_int(swr, "linear_interp", 1, 0);
+		break;
+
+	case RESAMPLE_QUALITY_HIGH:
+		av_opt_set_int(swr, "filter_size",   64, 0);
+		av_opt_set_int(swr, "phase_shift",   12, 0);
+		av_opt_set_int(swr, "linear_interp", 0, 0);
+		av_opt_set_double(swr, "cutoff",     0.97, 0);
+		break;
+
+	default:
+		av_opt_set_int(swr, "filter_size",   32, 0);
+		av_opt_set_int(swr, "phase_shift",   10, 0);
+		av_opt_set_int(swr, "linear_interp", 1, 0);
+	}
+}
 
 SwrContext* resample_init(){
 	return swr_alloc();
@@ -18,17 +60,35 @@ void resample_deinit(SwrContext* swr){
 
 void resample_loadFromCodec(SwrContext *swr, AVCodecContext* audioCodec){
 	int err;
+	char msg[AV_ERROR_MAX_STRING_SIZE];
 
 	// Set up SWR context once you've got codec information
 	av_opt_set_int(swr, "in_channel_layout",  audioCodec->channel_layout, 0);
 	av_opt_set_int(swr, "out_channel_layout", audioCodec->channel_layout, 0);
 	av_opt_set_int(swr, "in_sample_rate",     audioCodec->sample_rate, 0);
-	av_opt_set_int(swr, "out_sample_rate",    audioCodec->sample_rate, 0);
+	av_opt_set_int(swr, "out_sample_rate",    RESAMPLE_OUTPUT_RATE, 0);
 	av_opt_set_sample_fmt(swr, "in_sample_fmt",  audioCodec->sample_fmt, 0);
 	av_opt_set_sample_fmt(swr, "out_sample_fmt", AV_SAMPLE_FMT_S16,  0);
+	set_filter(swr);
 
 	if((err = swr_init(swr)) < 0) 
-		errx(1, "resample_loadFromCodec: swr_init failed %s", my_av_strerror(err));
+		errx(1, "resample_loadFromCodec: swr_init failed %s", my_av_strerror(err, msg, sizeof(msg)));
+}
+
+void resample_loadPcm(SwrContext *swr, int sample_rate){
+	int err;
+	char msg[AV_ERROR_MAX_STRING_SIZE];
+
+	av_opt_set_int(swr, "in_channel_layout",  AV_CH_LAYOUT_STEREO, 0);
+	av_opt_set_int(swr, "out_channel_layout", AV_CH_LAYOUT_STEREO, 0);
+	av_opt_set_int(swr, "in_sample_rate",     sample_rate, 0);
+	av_opt_set_int(swr, "out_sample_rate",    RESAMPLE_OUTPUT_RATE, 0);
+	av_opt_set_sample_fmt(swr, "in_sample_fmt",  AV_SAMPLE_FMT_S16, 0);
+	av_opt_set_sample_fmt(swr, "out_sample_fmt", AV_SAMPLE_FMT_S16, 0);
+	set_filter(swr);
+
+	if((err = swr_init(swr)) < 0)
+		errx(1, "resample_loadPcm: swr_init failed %s", my_av_strerror(err, msg, sizeof(msg)));
 }
 
 void resample_do(SwrContext* swr, AVFrame *audioFrame, uint8_t* outputBuffer){
@@ -38,3 +98,35 @@ void resample_do(SwrContext* swr, AVFrame *audioFrame, uint8_t* outputBuffer){
 			(const uint8_t**)audioFrame->data,
 			audioFrame->nb_samples);
 }
+
+int resample_interleave(AVFrame *audioFrame, int channels, uint8_t* outputBuffer){
+	int16_t *out = (int16_t*)outputBuffer;
+	int n = audioFrame->nb_samples;
+
+	switch(audioFrame->format){
+	case AV_SAMPLE_FMT_S16:
+		memcpy(out, audioFrame->data[0], n * channels * sizeof(int16_t));
+		return 0;
+
+	case AV_SAMPLE_FMT_S16P:
+		for(int c = 0; c < channels; c++){
+			const int16_t *in = (const int16_t*)audioFrame->extended_data[c];
+
+			for(int i = 0; i < n; i++)
+				out[i * channels + c] = in[i];
+		}
+		return 0;
+
+	case AV_SAMPLE_FMT_S32P:
+		for(int c = 0; c < channels; c++){
+			const int32_t *in = (const int32_t*)audioFrame->extended_data[c];
+
+			for(int i = 0; i < n; i++)
+				out[i * channels + c] = in[i] >> 16;
+		}
+		return 0;
+
+	default:
+		return -1;
+	}
+}
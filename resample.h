@@ -13,9 +13,26 @@
 #include <libavutil/frame.h>
 #include <stdint.h>
 
+#define RESAMPLE_OUTPUT_RATE 48000
+
+// libswresample polyphase filter (SIMD on x86 and ARM): low = short filter with linear
+// interpolation between phases, medium = swr defaults, high = long filter, fine phases
+enum { RESAMPLE_QUALITY_LOW, RESAMPLE_QUALITY_MEDIUM, RESAMPLE_QUALITY_HIGH };
+
+// -Q, for contexts loaded afterwards. -1 for an unknown name
+int resample_setQuality(const char *name);
+
 SwrContext* resample_init();
 void resample_deinit(SwrContext* swr);
+
+// codec output (any rate) to S16 at RESAMPLE_OUTPUT_RATE
 void resample_loadFromCodec(SwrContext *swr, AVCodecContext* audioCodec);
+
+// raw S16 stereo at sample_rate to RESAMPLE_OUTPUT_RATE
+void resample_loadPcm(SwrContext *swr, int sample_rate);
 void resample_do(SwrContext* swr, AVFrame *audioFrame, uint8_t* outputBuffer);
 
+// S16, S16P and S32P to interleaved S16 without swr, -1 for other formats
+int resample_interleave(AVFrame *audioFrame, int channels, uint8_t* outputBuffer);
+
 #endif /* RESAMPLE_H_ */
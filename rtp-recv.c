@@ -0,0 +1,438 @@
+/*
+ * rtp-recv.c
+ *
+ * spdif-rtp-recv: receives the RTP stream of an rtp: sink (see rtp.h) and
+ * plays it on a local output. Packets are reordered in a jitter buffer that
+ * starts playing once it holds the target delay, lost packets are replaced by
+ * silence and the buffer is trimmed when the sender clock runs ahead of the
+ * output clock.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <getopt.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "backend.h"
+#include "rtp.h"
+#include "log.h"
+#include "myspdif.h"
+
+#define JB_SLOTS          512     // packets, must be a power of 2
+#define JB_POLL_MS        1
+#define STATS_INTERVAL_MS 10000
+
+typedef struct {
+  int used;
+  uint16_t seq;
+  int frames;
+  int16_t pcm[RTP_MAX_PAYLOAD / 2];   // converted to host S16
+} jb_slot;
+
+typedef struct {
+  jb_slot slots[JB_SLOTS];
+  int packets;              // slots in use
+  long frames;              // frames in use
+  uint16_t next_seq;
+  int have_seq;
+  int playing;
+  int last_frames;          // frames of the last packet, used for concealment
+} jitter_buffer;
+
+typedef struct {
+  unsigned long received, late, lost, trimmed, underruns, resets;
+} recv_stats;
+
+atomic_int debug_data = 0;
+
+static volatile sig_atomic_t stop = 0;
+
+static jitter_buffer jb;
+static recv_stats stats;
+
+static uint32_t ssrc;
+static int bytes, channels;           // current format, 0 = none yet
+
+static Sink *out_dev;
+static char *out_dev_name_ch;
+
+//--------------------------------------------------------------------------------------------------
+void usage(void)
+{
+	fprintf(stderr,
+		"usage:\n"
+		"  spdif-rtp-recv -l <addr>[:<port>] -o <output>\n\n"
+
+    " -l a ... unicast address or multicast group to listen on (default port 5004)\n"
+    " -j n ... jitter buffer target delay in ms (default 20)\n"
+    " -b n ... output device buffer time in ms (default 32)\n"
+    " -v   ... verbose\n\n"
+
+    " <output> ... [alsa:]<alsa-playback-dev>, file:<raw>, - (stdout), null (paced like a DAC)\n"
+    "   '#' is replaced by the channel count as in spdif-decoder\n");
+
+	exit(1);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void onSignal(int sig)
+{
+  stop = 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int open_socket(const char *spec)
+{
+  char host[256];
+  struct sockaddr_in addr;
+
+  snprintf(host, sizeof(host), "%s", spec);
+
+  char *port = strrchr(host, ':');
+
+  if (port)
+    *port++ = 0;
+
+  struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM}, *res;
+
+  if (getaddrinfo(host, NULL, &hints, &res) != 0)
+    errx(1, "cannot resolve %s", host);
+
+  memcpy(&addr, res->ai_addr, sizeof(addr));
+  freeaddrinfo(res);
+
+  addr.sin_port = htons(port ? atoi(port) : RTP_DEFAULT_PORT);
+
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+
+  if (fd < 0)
+    err(1, "cannot create socket");
+
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  if (IN_MULTICAST(ntohl(addr.sin_addr.s_addr)))
+  {
+    struct ip_mreq mreq = {.imr_multiaddr = addr.sin_addr, .imr_interface.s_addr = htonl(INADDR_ANY)};
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+      err(1, "cannot bind to %s", spec);
+
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+      err(1, "cannot join %s", host);
+  }
+  else if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    err(1, "cannot bind to %s", spec);
+
+  return fd;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void jb_reset()
+{
+  for (int i = 0; i < JB_SLOTS; i++)
+    jb.slots[i].used = 0;
+
+  jb.packets = 0;
+  jb.frames = 0;
+  jb.have_seq = 0;
+  jb.playing = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void jb_drop(jb_slot *slot)
+{
+  slot->used = 0;
+  jb.packets--;
+  jb.frames -= slot->frames;
+}
+
+//--------------------------------------------------------------------------------------------------
+// (re)open the output for the current format
+static void open_output()
+{
+  out_dev->close(out_dev);
+
+  if (out_dev_name_ch)
+    *out_dev_name_ch = '0' + channels;
+
+  out_dev->channels    = channels;
+  out_dev->sample_rate = RTP_RATE;
+
+  if (out_dev->open(out_dev) != 0)
+    errx(1, "cannot open audio output, channels=%d, format=s16, rate=%d", channels, RTP_RATE);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void handle_packet(const uint8_t *buf, int len)
+{
+  rtp_header h;
+  int pbytes, pchannels;
+
+  if (len < RTP_HEADER_SIZE)
+    return;
+
+  memcpy(&h, buf, sizeof(h));
+
+  if (h.vpxcc >> 6 != RTP_VERSION || rtp_parse_payload_type(h.mpt & 0x7f, &pbytes, &pchannels) < 0)
+    return;
+
+  // header extension, csrc and padding are not used by the sender, skip them anyway
+  int offset = RTP_HEADER_SIZE + (h.vpxcc & 0x0f) * 4;
+
+  if ((h.vpxcc & 0x10) && len >= offset + 4)
+    offset += 4 + ntohs(*(uint16_t*)(buf + offset + 2)) * 4;
+
+  if (h.vpxcc & 0x20)
+    len -= buf[len - 1];
+
+  int frames = (len - offset) / (pbytes * pchannels);
+
+  if (frames <= 0 || frames * pchannels > RTP_MAX_PAYLOAD / 2)
+    return;
+
+  stats.received++;
+
+  if (ntohl(h.ssrc) != ssrc || pbytes != bytes || pchannels != channels)
+  {
+    if (pchannels != channels)
+      log_printf("rtp: receiving L%d %d channels\n", pbytes * 8, pchannels);
+
+    int reopen = pchannels != channels || !Sink_isOpen(out_dev);
+
+    ssrc = ntohl(h.ssrc);
+    bytes = pbytes;
+    channels = pchannels;
+
+    jb_reset();
+    stats.resets++;
+
+    if (reopen)
+      open_output();
+  }
+
+  uint16_t seq = ntohs(h.seq);
+
+  if (!jb.have_seq)
+  {
+    jb.next_seq = seq;
+    jb.have_seq = 1;
+  }
+
+  int16_t diff = seq - jb.next_seq;
+
+  if (diff < 0)
+  {
+    stats.late++;
+    return;
+  }
+
+  if (diff >= JB_SLOTS)
+  {
+    // sender restarted or a long outage, start over
+    jb_reset();
+    jb.next_seq = seq;
+    jb.have_seq = 1;
+    stats.resets++;
+  }
+
+  jb_slot *slot = &jb.slots[seq & (JB_SLOTS - 1)];
+
+  if (slot->used)
+    return;   // duplicate
+
+  const uint8_t *p = buf + offset;
+
+  for (int i = 0; i < frames * pchannels; i++, p += pbytes)
+    slot->pcm[i] = (int16_t)(p[0] << 8 | p[1]);
+
+  slot->used = 1;
+  slot->seq = seq;
+  slot->frames = frames;
+  jb.packets++;
+  jb.frames += frames;
+  jb.last_frames = frames;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void receive(int fd, int timeout)
+{
+  static uint8_t buf[2048];
+  struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+  if (poll(&pfd, 1, timeout) <= 0)
+    return;
+
+  while (1)
+  {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+
+    if (n < 0)
+      break;
+
+    handle_packet(buf, n);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// play the next packet, 0 if the buffer ran empty
+static int play(long target_frames)
+{
+  static int16_t silence[RTP_MAX_PAYLOAD / 2];
+  jb_slot *slot = &jb.slots[jb.next_seq & (JB_SLOTS - 1)];
+
+  if (!jb.packets)
+    return 0;
+
+  // output clock slower than the sender, drop the oldest packet
+  if (jb.frames > 2 * target_frames + jb.last_frames && slot->used && slot->seq == jb.next_seq)
+  {
+    jb_drop(slot);
+    jb.next_seq++;
+    stats.trimmed++;
+    return 1;
+  }
+
+  if (slot->used && slot->seq == jb.next_seq)
+  {
+    if (!out_dev->write(out_dev, slot->pcm, slot->frames))
+      errx(1, "Could not play audio to output device");
+
+    jb_drop(slot);
+  }
+  else
+  {
+    // later packets are there, this one is lost
+    if (!out_dev->write(out_dev, silence, jb.last_frames))
+      errx(1, "Could not play audio to output device");
+
+    stats.lost++;
+  }
+
+  jb.next_seq++;
+  return 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+// the output still has at least a packet to play, an empty jitter buffer is no underrun yet
+static int output_busy()
+{
+  long delay;
+
+  return out_dev->delay(out_dev, &delay) == 0 && delay >= jb.last_frames;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void log_stats()
+{
+  log_printf("rtp: received %lu, lost %lu, late %lu, trimmed %lu, underruns %lu, resets %lu, buffered %ld ms\n",
+    stats.received, stats.lost, stats.late, stats.trimmed, stats.underruns, stats.resets, jb.frames * 1000 / RTP_RATE);
+}
+
+//--------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	char *listen_addr = NULL, *out_dev_name = NULL;
+	int jitter_ms = 20, buffer_time = 32;
+	int opt;
+
+	for (opt = 0; (opt = getopt(argc, argv, "hl:o:j:b:v")) != -1;) {
+		switch (opt) {
+		case 'l':
+			listen_addr = optarg;
+			break;
+		case 'o':
+			out_dev_name = optarg;
+			break;
+    case 'j':
+      jitter_ms = atoi(optarg);
+      break;
+    case 'b':
+      buffer_time = atoi(optarg);
+      break;
+		case 'v':
+			debug_data = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind != argc || !listen_addr || !out_dev_name)
+		usage();
+
+  // keep stdout clean for audio
+  if (!strcmp(out_dev_name, "-"))
+    log_set_output(stderr);
+
+	log_init();
+
+  int fd = open_socket(listen_addr);
+
+  out_dev = Sink_create(out_dev_name, buffer_time);
+
+  if (!out_dev)
+    errx(1, "cannot create output %s", out_dev_name);
+
+  out_dev_name_ch = strchr(out_dev->dev, '#');
+
+  struct sigaction sa = {.sa_handler = onSignal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  long target_frames = (long)jitter_ms * RTP_RATE / 1000;
+  double lastStats = monotonic_ms();
+
+	log_printf("listening on %s, jitter buffer %d ms\n", listen_addr, jitter_ms);
+
+  while (!stop)
+  {
+    receive(fd, jb.playing && jb.packets ? 0 : JB_POLL_MS);
+
+    if (!jb.playing)
+    {
+      if (jb.packets && jb.frames >= target_frames)
+      {
+        jb.playing = 1;
+
+        if (debug_data)
+          log_printf("rtp: playing, %ld ms buffered\n", jb.frames * 1000 / RTP_RATE);
+      }
+    }
+    else if (!play(target_frames) && !output_busy())
+    {
+      // rebuffer to the target delay
+      log_printf("warning: rtp jitter buffer underrun\n");
+      stats.underruns++;
+      jb.playing = 0;
+    }
+
+    if (debug_data && monotonic_ms() - lastStats >= STATS_INTERVAL_MS)
+    {
+      log_stats();
+      lastStats = monotonic_ms();
+    }
+  }
+
+  log_stats();
+
+  Sink_free(out_dev);
+  close(fd);
+
+	return 0;
+}
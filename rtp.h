@@ -0,0 +1,77 @@
+/*
+ * rtp.h
+ *
+ * RTP definitions shared by the rtp: and net: backends and spdif-rtp-recv.
+ *
+ * Payload is L16 or L24 (RFC 3551, big endian, interleaved) at 48kHz. There
+ * is no SDP, the dynamic payload type carries the format instead:
+ *
+ *   96..103   L16, 1..8 channels
+ *   104..111  L24, 1..8 channels
+ *   112       raw IEC 61937 / PCM input stream (S16LE stereo as captured),
+ *             the marker bit flags a packet starting with a burst preamble
+ *
+ * The RTP timestamp is the capture time of the first frame in 48kHz units,
+ * RTCP sender reports on port+1 map it to wall clock (NTP) time.
+ */
+
+#ifndef RTP_H_
+#define RTP_H_
+
+#include <stdint.h>
+
+#define RTP_VERSION         2
+#define RTP_PT_L16          96
+#define RTP_PT_L24          104
+#define RTP_PT_IEC61937     112
+#define RTP_MAX_CHANNELS    8
+#define RTP_MAX_PAYLOAD     1400      // stay below the ethernet MTU
+#define RTP_HEADER_SIZE     12
+#define RTP_DEFAULT_PORT    5004
+#define RTP_RATE            48000
+
+#define RTCP_SR             200
+#define RTCP_INTERVAL_MS    1000
+
+#define RTP_NTP_OFFSET      2208988800ULL   // 1900-01-01 to 1970-01-01 in s
+
+typedef struct {
+  uint8_t  vpxcc;           // version 2, no padding, no extension, no csrc
+  uint8_t  mpt;             // marker, payload type
+  uint16_t seq;             // all fields big endian
+  uint32_t timestamp;
+  uint32_t ssrc;
+} rtp_header;
+
+typedef struct {
+  uint8_t  vprc;
+  uint8_t  pt;              // RTCP_SR
+  uint16_t length;          // 32 bit words - 1
+  uint32_t ssrc;
+  uint32_t ntp_sec;
+  uint32_t ntp_frac;
+  uint32_t rtp_timestamp;
+  uint32_t packets;
+  uint32_t octets;
+} rtcp_sr;
+
+// payload type for a format, bytes per sample 2 (L16) or 3 (L24)
+static inline int rtp_payload_type(int bytes, int channels)
+{
+  return (bytes == 3 ? RTP_PT_L24 : RTP_PT_L16) + channels - 1;
+}
+
+// format of a payload type, -1 if unknown
+static inline int rtp_parse_payload_type(int pt, int *bytes, int *channels)
+{
+  if (pt >= RTP_PT_L16 && pt < RTP_PT_L16 + RTP_MAX_CHANNELS)
+    *bytes = 2, *channels = pt - RTP_PT_L16 + 1;
+  else if (pt >= RTP_PT_L24 && pt < RTP_PT_L24 + RTP_MAX_CHANNELS)
+    *bytes = 3, *channels = pt - RTP_PT_L24 + 1;
+  else
+    return -1;
+
+  return 0;
+}
+
+#endif /* RTP_H_ */
@@ -9,424 +9,952 @@ journalctl -r -u dsp
 #include <unistd.h>
 #include <err.h>
 #include <getopt.h>
-
-#include <sys/socket.h> 
-#include <arpa/inet.h> 
-#include <netinet/in.h> 
-#include <netinet/tcp.h>
-#include <netdb.h>
+#include <signal.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
 
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
 #include <libavdevice/avdevice.h>
-#include <ao/ao.h>
 #include <libavformat/avio.h>
 #include <libavformat/spdif.h>
 
-#include <alsa/asoundlib.h>
-
 #include "resample.h"
 #include "helper.h"
 #include "myspdif.h"
 #include "codechandler.h"
+#include "log.h"
+#include "status.h"
+#include "backend.h"
+#include "transition.h"
+#include "record.h"
+#include "control.h"
+#include "hwcache.h"
+#include "startup.h"
+#include "latency.h"
+#include "inrate.h"
+#include "prof.h"
+#include "mixer.h"
+#include "burstcheck.h"
+#include "fault.h"
+#include "meter.h"
 
 //#define DEBUG
-//#define MAX_BURST_SIZE	24576           //  Dolby Digital+ bust            = 6144 frames = 128ms
-#define MAX_BURST_SIZE	(8+1792+4344)     //  Dolby Digital  bust 6144 bytes = 1536 frames =  32ms
 #define I_BUFFER_SIZE 768
-
-typedef double sample_t;
-
-char *alsa_dev_name = NULL;
-char *out_dev_buffer_time = "64"; // 2 packets of 32ms
-AVFormatContext *spdif_ctx = NULL;
-unsigned char *alsa_buf = NULL;
+#define BATCH_BYTES_PER_MS (RESAMPLE_OUTPUT_RATE / 1000 * 2 * CODEC_MAX_CHANNELS)   // -e, widest output
+#define OUTPUT_BUFFER_SIZE CODEC_MAX_OUTPUT_SIZE   // decoded frames, PCM and passthrough bursts
+
+#define LEAK_WARMUP_CYCLES  100       // -L: allocator pools and codec tables settle
+#define LEAK_TOLERANCE_KB   256
+
+_Static_assert(OUTPUT_BUFFER_SIZE >= MAX_BURST_SIZE, "PCM bursts do not fit the output buffer");
+_Static_assert(OUTPUT_BUFFER_SIZE >= EAC3_BURST_SIZE, "passthrough bursts (E-AC-3, DTS type III) do not fit the output buffer");
+#define MAX_PIPELINES   CONTROL_MAX_PIPELINES
+
+// one input -> output chain, each runs on its own thread
+typedef struct {
+  int index;
+  pthread_t thread;
+
+  Source *source;
+  Sink *out_dev;
+  char *out_dev_spec;
+  char *out_dev_name_ch;
+
+  AVFormatContext *spdif_ctx;
+  AVIOContext *reader;                  // allocated once, reused by every initContext()
+  MySpdifState read_state;
+  inrate_probe inrate;                  // rate of raw PCM input, written by source_reader()
+  CodecHandler codecHandler;
+  char *resamples;
+  int outDelay;
+  latency_ctl latency;                  // adaptive catchup level, with config.latency_max
+  int passthrough;                      // the output carries IEC 61937 bursts
+  pthread_t preopenThread;              // opens the output in parallel with the input at start
+  int preopening;
+  int preopenChannels;
+  int preopened;                        // the output was opened for the format of the last run
+  enum AVCodecID passthroughRefused;    // the output did not open for passthrough of this codec
+  meter meter;                          // -l, follows the output format
+  uint8_t *batch;                       // -e: output collected for one write of batch_ms
+  int batchUsed;                        // bytes
+  double batchCapture;                  // capture time of the first frames in the batch
+
+  control_config config;
+} Pipeline;
+
+// shared by all pipelines, read-only once the threads run
 AVInputFormat *spdif_fmt = NULL;
-CodecHandler codecHandler;
 
-struct alsa_read_state {
-	snd_pcm_t *dev;
-};
-snd_pcm_t *out_dev = NULL;
+Pipeline pipelines[MAX_PIPELINES];
+int pipelineCount = 0;
 
-struct alsa_read_state read_state = {.dev = NULL,};
+atomic_int debug_data = 0;
+int leak_cycles = 0;      // -L
+int fixed_channels = 0;   // -m
+int mix_flags = 0;        // -M
+int batch_ms = 0;         // -e
+int leak_failed = 0;
 
-int debug_data = 0;
-int outDelay = 0;
+static volatile sig_atomic_t stop = 0;
 
 //--------------------------------------------------------------------------------------------------
 void usage(void)
 {
 	fprintf(stderr,
 		"usage:\n"
-		"  spdif-loop -i <alsa-input-dev> -o <alsa-output-dev>\n\n"
+		"  spdif-loop -i <input> -o <output> [-i <input> -o <output> ...]\n\n"
 
     " -b n ... output device buffer time in ms (default 2 packets = 64ms)\n"
+    " -c n ... drop frames to catch up when the output latency reaches n ms (default 30)\n"
+    " -a l:h . adapt the catch up latency between l and h ms to the underruns of the output,\n"
+    "          h should stay below -b (default off)\n"
+    " -p c ... pass codecs c (comma separated, e.g. ac3,dts, or all) undecoded to an IEC958 output,\n"
+    "          e.g. -o hdmi:CARD=PCH,DEV=0,AES0=6, codecs the output refuses are decoded\n"
+    " -s n ... status server tcp port on localhost (default 8788, 0 = off)\n"
+    " -u p ... status server unix socket path, both also accept control commands\n"
+    " -D p ... decoder policy: auto, float, fixed or per codec, e.g. ac3=fixed,aac=float (default auto,\n"
+    "          fixed-point decoders on ARM without NEON)\n"
+    " -m n ... keep the output open with n channels (e.g. 2, 6 or 8) and mix every stream layout into it,\n"
+    "          2.0 <> 5.1 switches do not touch the output\n"
+    " -M x ... -m mixing: loro (default) or ltrt downmix, upmix spreads stereo to center and surrounds,\n"
+    "          comma separated, e.g. ltrt,upmix\n"
+    " -l x ... publish output levels every x ms on the status server: peak and RMS per channel,\n"
+    "          x,loudness adds the short-term loudness (e.g. 100,loudness)\n"
+    " -e n ... efficiency: read the input and write the output in periods of n ms (e.g. 128), fewer\n"
+    "          wakeups and syscalls for up to 3 periods more latency, not with -a\n"
+    " -Q q ... resampling quality for 44.1/96kHz input: low, medium (default), high\n"
+    " -C f ... startup cache file (default ~/.cache/spdif-decoder.cache, off = none)\n"
+    " -r f ... record raw input and demuxer decisions to file f (replay with -i record:f)\n"
+    " -R n ... size cap of the recording in MB, oldest data is overwritten (default 64)\n"
+    " -T   ... log stream transition statistics at exit\n"
+    " -P   ... profile every burst with hardware counters (cycles, instructions, cache misses,\n"
+    "          context switches) per stage, distributions are logged at exit\n"
+    " -F f ... inject faults on a schedule and log the recovery times at exit: all or e.g.\n"
+    "          drop@5:2000,xrun_out@20 (drop corrupt silence codec decode xrun_in xrun_out delay\n"
+    "          slow_open, see fault.h)\n"
+    " -L n ... leak check: restart after every burst for n cycles, fail if the memory grows\n"
     " -v   ... verbose\n\n"
 
-    " <alsa-output-dev> can contain '#' to direct output to different devices depending on channel count.\n"
-    "   ex: -o dsp#    2 channels -> dsp2, 6 channels -> dsp6, and so on\n");
+    " <input>  ... [alsa:]<alsa-capture-dev>, file:<raw> (paced to 48kHz), fastfile:<raw>, record:<file>, - (stdin),\n"
+    "              net:<addr>[:<port>][,jitter=<ms>] (raw input from a net: output)\n"
+    " <output> ... [alsa:]<alsa-playback-dev>, file:<raw>, - (stdout), null (paced like a DAC),\n"
+    "              rtp:<host>[:<port>][,l24][,ptime=<ms>][,ttl=<n>] (RTP over UDP unicast or multicast),\n"
+    "              net:<host>[:<port>] (forward the raw input undecoded to a net: input)\n\n"
+
+    " <output> can contain '#' to direct output to different devices depending on channel count.\n"
+    "   ex: -o dsp#    2 channels -> dsp2, 6 channels -> dsp6, and so on\n\n"
+
+    " The n-th -i and the n-th -o form a pipeline running on its own thread. With more than\n"
+    " one pipeline each is pinned to its own core. -r, -T, -P and -L need a single pipeline.\n");
 
 	exit(1);
 }
 
+
+//--------------------------------------------------------------------------------------------------
+// bytes read or skipped count for the input rate, a file has no clock of its own
+static void inputArrived(Source *src, int n)
+{
+  if(!src->finite && n > 0 && inrate_update(&pipelines[src->pipeline].inrate, n, gettimeofday_ms()))
+    log_printf("pipeline %d: input runs at %d Hz\n", src->pipeline, pipelines[src->pipeline].inrate.rate);
+}
+
 //--------------------------------------------------------------------------------------------------
-static int alsa_reader(void *data, uint8_t *buf, int buf_size)
+static int source_reader(void *data, uint8_t *buf, int buf_size)
 {
-	struct alsa_read_state *state = data;
+	Source *src = data;
   double start = 0;
 
   if(debug_data) 
     start = gettimeofday_ms();
 
-	if (snd_pcm_state(state->dev) == SND_PCM_STATE_SETUP)
-  {
-  	int err = snd_pcm_prepare(state->dev);
+  int n = fault_input(buf, src->read(src, buf, buf_size));
 
-	  if(err < 0)
-    {
-      printf("error: alsa failed to prepare input device: %s", snd_strerror(err));
-      return AVERROR_EOF;
-    }
+  if(record_enabled)
+    record_raw(buf, n);
 
-    if(debug_data)
-      printf("alsa input prepared\n");
-  }
+  inputArrived(src, n);
 
-  int frames = buf_size / 4;
+  if(debug_data && n >= 0)
+    log_printf("source_reader %d bytes in %.1f ms\n", n, gettimeofday_ms() - start);
 
-	while(1)
-  {
-    ssize_t n = snd_pcm_readi(state->dev, (char *) buf, frames);
+  return n;
+}
 
-    if(n >= 0) 
-    {
-      if(debug_data)
-        printf("alsa_reader %d bytes in %.1f ms\n", n*4, gettimeofday_ms() - start);
+//--------------------------------------------------------------------------------------------------
+// the padding between bursts, dropped by the source without being read. A recording needs every
+// byte, the demuxer then reads the padding.
+static int source_skipper(void *data, int bytes)
+{
+	Source *src = data;
 
-      return n * 4;
-    }
+  if(record_enabled)
+    return 0;
 
-    if (n == -EPIPE)
-      printf("warning: alsa input overrun occurred\n");
-    else
-      printf("warning: alsa input %s\n", snd_strerror(n));
+  int n = src->skip(src, bytes);
 
-    n = snd_pcm_recover(state->dev, n, 1);
+  inputArrived(src, n);
 
-    if (n < 0)
-    {
-      printf("error: alsa input recover failed %s\n", snd_strerror(n));
-      return AVERROR_EOF;
-    }
-  }
+  if(debug_data)
+    log_printf("source_skipper %d of %d bytes\n", n, bytes);
+
+  return n;
 }
 
 //--------------------------------------------------------------------------------------------------
-ssize_t alsa_write(sample_t *buf, int buf_size)
+// output delay in ms at which frames are dropped, -e keeps up to two batches more buffered
+static int catchupMs(Pipeline *p)
 {
-	ssize_t n;
+  return (p->config.latency_max ? p->latency.target_ms : p->config.catchup_ms) + 2 * batch_ms;
+}
 
-	if (snd_pcm_state(out_dev) == SND_PCM_STATE_SETUP)
-  {
-  	int err = snd_pcm_prepare(out_dev);
+//--------------------------------------------------------------------------------------------------
+// playback starts with half the target buffered, the catch up does not trim right away. -e starts
+// with two batches, one plays while the next is collected.
+static void outputPrefill(Pipeline *p)
+{
+  if (!p->out_dev->prefill || !Sink_isOpen(p->out_dev))
+    return;
 
-	  if(err < 0)
-    {
-      printf("error: alsa failed to prepare output device: %s\n", snd_strerror(err));
-      return 0;
-    }
+  int perMs = p->out_dev->sample_rate / 1000;
 
-    if(debug_data)
-      printf("alsa output prepared\n");
+  p->out_dev->prefill(p->out_dev, p->config.latency_max ? p->latency.target_ms / 2 * perMs : batch_ms ? 2 * batch_ms * perMs : 1);
+}
+
+//--------------------------------------------------------------------------------------------------
+// -e: the output buffer holds at least three batches
+static int sinkBufferTime(int ms)
+{
+  return ms < 3 * batch_ms ? 3 * batch_ms : ms;
+}
+
+//--------------------------------------------------------------------------------------------------
+// cache key of the latency target the output settled at
+static void latencyKey(Pipeline *p, char *key, int size)
+{
+  snprintf(key, size, "latency %s", p->config.output);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void latencyChanged(Pipeline *p)
+{
+  char key[HWCACHE_KEY_SIZE];
+
+  log_printf("pipeline %d: catch up latency %d ms\n", p->index, p->latency.target_ms);
+  status_post_latency_target(p->index, p->latency.target_ms);
+
+  latencyKey(p, key, sizeof(key));
+  hwcache_put(key, &p->latency.target_ms, 1);
+
+  outputPrefill(p);
+}
+
+//--------------------------------------------------------------------------------------------------
+// (re)start the controller for the current output and bounds, at the level it settled at last time
+static void latencyStart(Pipeline *p)
+{
+  char key[HWCACHE_KEY_SIZE];
+  int start;
+
+  if (!p->config.latency_max)
+  {
+    status_post_latency_target(p->index, p->config.catchup_ms);
+    outputPrefill(p);
+    return;
   }
 
-  snd_pcm_sframes_t delay;
-  int err;
-  if ((err = snd_pcm_delay(out_dev, &delay)) < 0)
-    printf("alsa error: failed to get output latency: %s\n", snd_strerror(err));
-  else
+  latencyKey(p, key, sizeof(key));
+
+  if (hwcache_get(key, &start, 1) != 0)
+    start = p->config.catchup_ms;
+
+  latency_init(&p->latency, p->config.latency_min, p->config.latency_max, start, p->out_dev->xruns, gettimeofday_ms());
+  latencyChanged(p);
+}
+
+//--------------------------------------------------------------------------------------------------
+// channels the output plays: -m or those of the stream, IEC 61937 bursts are always stereo
+static int outputChannels(Pipeline *p)
+{
+  return fixed_channels && !p->passthrough ? fixed_channels : p->codecHandler.currentChannelCount;
+}
+
+//--------------------------------------------------------------------------------------------------
+// the bursts are played at the rate they came in: E-AC-3 needs four times the sample rate for its
+// repetition period, the others fit a 48kHz link
+static int passthroughRate(Pipeline *p)
+{
+  return (p->read_state.last_data_type & 0xff) == IEC61937_EAC3 ? 4 * 48000 : 48000;
+}
+
+//--------------------------------------------------------------------------------------------------
+static ssize_t writeOut(Pipeline *p, uint8_t *buf, int buf_size)
+{
+  long delay;
+
+  if (p->out_dev->delay(p->out_dev, &delay) == 0)
   {
-    delay /= 48;
+    delay = delay * 1000 / p->out_dev->sample_rate;
 
-    if(delay > outDelay || delay < outDelay-1) 
+    if (p->config.latency_max && latency_update(&p->latency, p->out_dev->xruns, delay, gettimeofday_ms()))
+      latencyChanged(p);
+
+    if(delay > p->outDelay || delay < p->outDelay-1) 
     {
-    outDelay = delay;
-    printf("alsa output latency: %d ms\n", outDelay);
+    p->outDelay = delay;
+    log_printf("pipeline %d: output latency: %d ms\n", p->index, p->outDelay);
+    status_post_latency(p->index, p->outDelay);
     }
   }
 
-  int frames = buf_size / 2 / codecHandler.currentChannelCount;
+  int frames = buf_size / 2 / outputChannels(p);
+  int delayMs;
 
-  while(1) 
-  {
-    n = snd_pcm_writei(out_dev, buf, frames);
+  if (fault_fire(FAULT_DELAY, &delayMs))
+    usleep(delayMs * 1000);
 
-    if(n >= 0)
-      return n;
+  ssize_t ret = p->out_dev->write(p->out_dev, buf, frames);
 
-    if (n == -EPIPE)
-      printf("warning: alsa output underrun occurred\n");
-    else
-      printf("warning: alsa output %s\n", snd_strerror(n));
+  startup_output(p->index);
 
-    n = snd_pcm_recover(out_dev, n, 1);
+  if (ret > 0)
+    fault_output(frames, p->out_dev->sample_rate);
 
-    if (n < 0) 
-    {
-      printf("error: alsa output recover failed %s\n", snd_strerror(n));
+  return ret;
+}
+
+//--------------------------------------------------------------------------------------------------
+// -e: bursts are collected and written once per batch_ms, a period of the device, the delay is
+// queried once per write as well. A burst longer than a batch completes several.
+static ssize_t batchWrite(Pipeline *p, uint8_t *buf, int buf_size)
+{
+  int frameSize = 2 * outputChannels(p);
+  int batchBytes = batch_ms * (p->out_dev->sample_rate / 1000) * frameSize;
+  double captureTime = p->out_dev->capture_time;
+  int done = 0;
+
+  if (!p->batchUsed)
+    p->batchCapture = captureTime;
+
+  memcpy(p->batch + p->batchUsed, buf, buf_size);
+  p->batchUsed += buf_size;
+
+  while (p->batchUsed - done >= batchBytes)
+  {
+    p->out_dev->capture_time = p->batchCapture;
+
+    if (!writeOut(p, p->batch + done, batchBytes))
       return 0;
-    }
+
+    done += batchBytes;
+    p->batchCapture = captureTime;
   }
+
+  // the rest starts the next batch
+  p->batchUsed -= done;
+  memmove(p->batch, p->batch + done, p->batchUsed);
+  p->out_dev->capture_time = captureTime;
+
+  return buf_size / frameSize;
 }
 
 //--------------------------------------------------------------------------------------------------
-snd_pcm_t* alsa_open(char* dev_name, int channels)
+ssize_t sink_write(Pipeline *p, uint8_t *buf, int buf_size)
 {
-	snd_pcm_hw_params_t *p = NULL;
-  snd_pcm_t *dev = NULL;
-  int err;
-  double start;
+  if (batch_ms)
+    return batchWrite(p, buf, buf_size);
 
-  if(debug_data)
-    start = gettimeofday_ms();
+  return writeOut(p, buf, buf_size);
+}
+
+//--------------------------------------------------------------------------------------------------
+void initContext(Pipeline *p) 
+{
+  double start = gettimeofday_ms();
+
+  if(debug_data) log_printf("initContext...\n");
+
+  // a custom reader is left alone by avformat_close_input()
+  if(p->spdif_ctx) 
+    avformat_close_input(&p->spdif_ctx);
 
-	if ((err = snd_pcm_open(&dev, dev_name, channels ? SND_PCM_STREAM_PLAYBACK : SND_PCM_STREAM_CAPTURE, 0)) < 0)
-		errx(1, "alsa error: failed to open device: %s", snd_strerror(err));
-	
-	if ((err = snd_pcm_hw_params_malloc(&p)) < 0)
-		errx(1, "alsa error: failed to allocate hw params: %s", snd_strerror(err));
-	
-	if ((err = snd_pcm_hw_params_any(dev, p)) < 0)
-		errx(1, "alsa error: failed to initialize hw params: %s", snd_strerror(err));
-
-	if ((err = snd_pcm_hw_params_set_access(dev, p, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
-		errx(1, "alsa error: failed to set access: %s", snd_strerror(err));
-	
-	if ((err = snd_pcm_hw_params_set_format(dev, p, SND_PCM_FORMAT_S16)) < 0)
-		errx(1, "alsa error: failed to set format: %s", snd_strerror(err));
-
-	if ((err = snd_pcm_hw_params_set_rate(dev, p, 48000, 0)) < 0)
-		errx(1, "alsa error: failed to set rate: %s", snd_strerror(err));
-
-	if (channels)
+	p->spdif_ctx = avformat_alloc_context();
+	if (!p->spdif_ctx)
+		errx(1, "cannot allocate S/PDIF context");
+
+  if(!p->reader)
   {
-    unsigned int us = atoi(out_dev_buffer_time) * 1000;
+    // -e: one capture period per read
+    int size = batch_ms ? batch_ms * 48 * 4 : I_BUFFER_SIZE;
+  	unsigned char *alsa_buf = av_malloc(size);
+  	if (!alsa_buf)
+  		errx(1, "cannot allocate input buffer");
 
-    if(( err = snd_pcm_hw_params_set_buffer_time_min(dev, p, &us, 0)) < 0)
-  		errx(1, "alsa error: cannot set output device buffer_time_min %s %s", out_dev_buffer_time, snd_strerror(err));
+  	p->reader = avio_alloc_context(alsa_buf, size, 0, p->source, source_reader, NULL, NULL);
 
-    if(debug_data)
-      printf("alse open output, channels=%d\n", channels);
-  } 
+  	if (!p->reader)
+  		errx(1, "cannot set up %s reader", p->source->type);
+  }
   else
   {
-    channels = 2;
-    if(debug_data)
-      printf("alse open input, channels=%d\n", channels);
+    // drop what was buffered before the reset
+    p->reader->buf_ptr = p->reader->buf_end = p->reader->buffer;
+    p->reader->pos = 0;
+    p->reader->eof_reached = 0;
+    p->reader->error = 0;
   }
 
-	if ((err = snd_pcm_hw_params_set_channels(dev, p, channels)) < 0)
-		errx(1, "alsa error: failed to set channels %d: %s", channels, snd_strerror(err));
+	p->spdif_ctx->pb = p->reader;
 
-	if ((err = snd_pcm_hw_params(dev, p)) < 0) 
-		errx(1, "alsa error: failed to set params: %s", snd_strerror(err));
+	if (avformat_open_input(&p->spdif_ctx, "internal", spdif_fmt, NULL) != 0)
+		errx(1, "cannot open S/PDIF input");
 
-	snd_pcm_hw_params_free(p);
+  if(debug_data) log_printf("initContext...ok\n");
 
-  if(debug_data) 
-    printf("alse open %s, channels=%d in %.1lf ms\n", dev_name, channels, gettimeofday_ms() - start);
+  transition_stage(TRANSITION_STAGE_INIT_CONTEXT, gettimeofday_ms() - start);
+}
+
+//--------------------------------------------------------------------------------------------------
+void resetSource(Pipeline *p)
+{
+  double start = gettimeofday_ms();
 
-  return dev;
+  p->source->reset(p->source);
+  inrate_reset(&p->inrate, p->source->sample_rate);
+
+  transition_stage(TRANSITION_STAGE_SOURCE_RESET, gettimeofday_ms() - start);
 }
 
 //--------------------------------------------------------------------------------------------------
-void* sendInfoToSocketThread(CodecHandler* codecHandler)
+static void onSignal(int sig)
 {
-  int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  
-  if (sockfd < 0)
-    return;
+  stop = 1;
+}
 
-  /* get the address of the host */
-  struct hostent* hptr = gethostbyname("localhost");
-  
-  if (!hptr) 
+//--------------------------------------------------------------------------------------------------
+void closeOutDev(Pipeline *p)
+{
+  p->out_dev->close(p->out_dev);
+  p->preopened = 0;
+
+  // a batch is in the format of the output
+  p->batchUsed = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+void freeOutDev(Pipeline *p)
+{
+  Sink_free(p->out_dev);
+  free(p->out_dev_spec);
+
+  p->out_dev = NULL;
+  p->out_dev_spec = NULL;
+  p->out_dev_name_ch = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+// -1 if the sink cannot be set up, no output then
+int createOutDev(Pipeline *p, const char *spec)
+{
+  // the sink keeps pointers into its spec and '#' is replaced in place
+  p->out_dev_spec = strdup(spec);
+
+  if (!p->out_dev_spec)
+    errx(1, "cannot allocate output spec");
+
+  p->out_dev = Sink_create(p->out_dev_spec, sinkBufferTime(p->config.buffer_time));
+
+  if (!p->out_dev)
   {
-    printf("sendInfoToSocket: gethostbyname\n");
-    return;
+    freeOutDev(p);
+    return -1;
   }
 
-  if (hptr->h_addrtype != AF_INET) /* versus AF_LOCAL */
-  {
-    printf("sendInfoToSocket: bad address family\n");
+  p->out_dev->period_time = batch_ms;
+  p->out_dev->pipeline = p->index;
+  p->out_dev_name_ch = strchr(p->out_dev->dev, '#');
+
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// cache key of the channel count last played on the output
+static void formatKey(Pipeline *p, char *key, int size)
+{
+  snprintf(key, size, "format %s", p->config.output);
+}
+
+//--------------------------------------------------------------------------------------------------
+// runs in parallel with source open and initContext(), touches nothing but the output
+static void* preopenOutDev(void *arg)
+{
+  Pipeline *p = arg;
+
+  if(p->out_dev_name_ch)
+    *p->out_dev_name_ch = '0' + p->preopenChannels;
+
+  p->out_dev->channels    = p->preopenChannels;
+  p->out_dev->sample_rate = RESAMPLE_OUTPUT_RATE;
+
+  // a device gone since the last run stays closed, runPipeline() opens the output for the first
+  // stream as without the cache
+  p->preopened = p->out_dev->open(p->out_dev) == 0;
+
+  if (p->preopened)
+    outputPrefill(p);
+
+  startup_mark(p->index, p->preopened ? "output open (cached format)" : "output open failed");
+
+  return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+// most starts play the same format as the last run, open the output for it right away
+void preopenStart(Pipeline *p)
+{
+  char key[HWCACHE_KEY_SIZE];
+  int channels;
+
+  formatKey(p, key, sizeof(key));
+
+  if (fixed_channels)
+    channels = fixed_channels;
+  else if (hwcache_get(key, &channels, 1) != 0 || channels < 1 || channels > 8)
     return;
-  }
 
-  /* connect to the server: configure server's address 1st */
-  struct sockaddr_in saddr; 
-  memset(&saddr, 0, sizeof(saddr)); 
-  saddr.sin_family = AF_INET; 
-  saddr.sin_addr.s_addr = ((struct in_addr*) hptr->h_addr_list[0])->s_addr;  
-  saddr.sin_port = htons(8787);
+  p->preopenChannels = channels;
+  p->preopening = pthread_create(&p->preopenThread, NULL, preopenOutDev, p) == 0;
+
+  if(p->preopening)
+    startup_mark(p->index, "output open started");
+}
 
-  if (connect(sockfd, (struct sockaddr*) &saddr, sizeof(saddr)) < 0) 
+//--------------------------------------------------------------------------------------------------
+void preopenWait(Pipeline *p)
+{
+  if(!p->preopening)
     return;
 
-  char msg[1024];
+  pthread_join(p->preopenThread, NULL);
+  p->preopening = 0;
+  p->outDelay = 0;
+}
 
-  sprintf(msg, "{\"codec\":\"%s\", \"channels\":%d, \"service_type\":%d}\n", 
-    avcodec_get_name(codecHandler->currentCodecID), 
+//--------------------------------------------------------------------------------------------------
+void postCodec(Pipeline *p)
+{
+  CodecHandler *codecHandler = &p->codecHandler;
+
+  status_post_codec(p->index, avcodec_get_name(codecHandler->currentCodecID),
     codecHandler->currentChannelCount,
+    codecHandler->currentChannelLayout,
+    codecHandler->currentSampleRate,
     codecHandler->codecContext ? codecHandler->codecContext->audio_service_type : -1);
+}
 
-  write(sockfd, msg, strlen(msg));
-  
-  close(sockfd); /* close the connection */
+//--------------------------------------------------------------------------------------------------
+int openOutDev(Pipeline *p)
+{
+  if(p->out_dev_name_ch)
+    *p->out_dev_name_ch = '0' + outputChannels(p);
+
+  p->out_dev->channels    = outputChannels(p);
+  p->out_dev->sample_rate = p->passthrough ? passthroughRate(p) : RESAMPLE_OUTPUT_RATE;
+
+  double openStart = gettimeofday_ms();
+  int slowMs;
+
+  if (fault_fire(FAULT_SLOW_OPEN, &slowMs))
+    usleep(slowMs * 1000);
+
+  int ret = p->out_dev->open(p->out_dev);
+
+  transition_stage(TRANSITION_STAGE_SINK_OPEN, gettimeofday_ms() - openStart);
+
+  if (ret == 0)
+    outputPrefill(p);
+
+  p->outDelay = 0;
+
+  return ret;
+}
+
+//--------------------------------------------------------------------------------------------------
+// apply control commands at a burst boundary. Only the output is rebuilt, capture and decoder
+// state stay untouched. An output that was open is reopened right away with the current format.
+void applyControl(Pipeline *p)
+{
+  control_config next = p->config;
+  int mask = control_take(p->index, &next);
+
+  if(mask & (CONTROL_BUFFER | CONTROL_OUTPUT))
+  {
+    int wasOpen = Sink_isOpen(p->out_dev);
+    Sink *oldDev = p->out_dev;
+    char *oldSpec = p->out_dev_spec;
+    int oldBufferTime = p->config.buffer_time;
+
+    // the old output must be closed before a new one may open the same device
+    closeOutDev(p);
+
+    p->config.buffer_time = next.buffer_time;
+
+    int failed = 0;
+
+    if(mask & CONTROL_OUTPUT)
+    {
+      failed = createOutDev(p, next.output) != 0;
+      p->passthroughRefused = AV_CODEC_ID_NONE;
+    }
+    else
+      p->out_dev->buffer_time = sinkBufferTime(next.buffer_time);
+
+    if(failed || (wasOpen && openOutDev(p) != 0))
+    {
+      log_printf("cannot open output %s with %d ms buffer, keeping the previous output\n", next.output, next.buffer_time);
+
+      if(mask & CONTROL_OUTPUT)
+      {
+        freeOutDev(p);
+        p->out_dev = oldDev;
+        p->out_dev_spec = oldSpec;
+        p->out_dev_name_ch = strchr(p->out_dev->dev, '#');
+        strcpy(next.output, p->config.output);
+      }
+
+      next.buffer_time = p->config.buffer_time = oldBufferTime;
+      p->out_dev->buffer_time = sinkBufferTime(oldBufferTime);
+
+      if(wasOpen && openOutDev(p) != 0)
+        errx(1, "cannot reopen audio output %s", p->out_dev->dev);
+    }
+    else if(mask & CONTROL_OUTPUT)
+    {
+      Sink_free(oldDev);
+      free(oldSpec);
+    }
+
+    log_printf("pipeline %d: output %s, buffer %d ms\n", p->index, p->out_dev->dev, p->out_dev->buffer_time);
+  }
+
+  int restartLatency = (mask & (CONTROL_LATENCY | CONTROL_OUTPUT)) ||
+    ((mask & CONTROL_CATCHUP) && !next.latency_max);
+
+  p->config = next;
+
+  if(restartLatency)
+    latencyStart(p);
+
+  control_applied(p->index, &p->config);
 }
 
 //--------------------------------------------------------------------------------------------------
-void sendInfoToSocket(CodecHandler* codecHandler)
+void reinit(Pipeline *p)
 {
-  pthread_t threadId;
-  int err = pthread_create(&threadId, NULL, &sendInfoToSocketThread, codecHandler);
+  log_printf("reinit...\n");
+
+  closeOutDev(p);
+  p->passthrough = 0;
+  CodecHandler_closeCodec(&p->codecHandler);
+  CodecHandler_deinit(&p->codecHandler);
+
+  resetSource(p);
+  initContext(p);
+  CodecHandler_init(&p->codecHandler);
+
+  log_printf("reinit...ok\n");
 }
 
 //--------------------------------------------------------------------------------------------------
-void initContext() 
+void reinit_input(Pipeline *p)
 {
-  if(debug_data) printf("initContext...\n");
+  log_printf("reinit input...\n");
 
-  if(spdif_ctx) 
-    avformat_close_input(&spdif_ctx);
+  resetSource(p);
+  initContext(p);
 
-	spdif_ctx = avformat_alloc_context();
-	if (!spdif_ctx)
-		errx(1, "cannot allocate S/PDIF context");
+  log_printf("reinit input...ok\n");
+}
 
-	alsa_buf = av_malloc(I_BUFFER_SIZE);
-	if (!alsa_buf)
-		errx(1, "cannot allocate input buffer");
+//--------------------------------------------------------------------------------------------------
+// codec is configured for passthrough and the output did not refuse it
+int passthroughWanted(Pipeline *p, enum AVCodecID codec)
+{
+  const char *list = p->config.passthrough;
+  const char *name = avcodec_get_name(codec);
+  int n = strlen(name);
 
-	spdif_ctx->pb = avio_alloc_context(alsa_buf, I_BUFFER_SIZE, 0, &read_state, alsa_reader, NULL, NULL);
+  // without a known repetition period the padding cannot be rebuilt
+  if (!*list || !p->read_state.burst_size || codec == p->passthroughRefused)
+    return 0;
 
-	if (!spdif_ctx->pb)
-		errx(1, "cannot set up alsa reader");
+  if (!strcmp(list, "all"))
+    return 1;
 
-	if (avformat_open_input(&spdif_ctx, "internal", spdif_fmt, NULL) != 0)
-		errx(1, "cannot open S/PDIF input");
+  for (const char *s = list; *s; )
+  {
+    int len = strcspn(s, ",");
+
+    if (len == n && !strncmp(s, name, n))
+      return 1;
 
-  if(debug_data) printf("initContext...ok\n");
+    s += len + (s[len] == ',');
+  }
+
+  return 0;
 }
 
 //--------------------------------------------------------------------------------------------------
-void closeOutDev()
+// forward a compressed burst as it came in: preamble, payload in 16-bit little endian words and
+// zero padding up to the repetition period. < 0 if the output does not take it.
+int passthroughBurst(Pipeline *p, AVPacket *pkt, enum AVCodecID codec, double readTime)
 {
-  if (!out_dev) 
-    return;
-  
-  snd_pcm_close(out_dev);
-  out_dev = NULL;
+  CodecHandler *codecHandler = &p->codecHandler;
+
+  if (!p->passthrough)
+  {
+    closeOutDev(p);
+    CodecHandler_closeCodec(codecHandler);
+    codecHandler->currentChannelCount = 2;
+    codecHandler->currentSampleRate = 48000;
+    codecHandler->currentChannelLayout = AV_CH_LAYOUT_STEREO;
+    p->passthrough = 1;
+
+    if (openOutDev(p) != 0)
+    {
+      log_printf("pipeline %d: %s does not take %s passthrough, decoding\n", p->index, p->out_dev->dev, avcodec_get_name(codec));
+      p->passthroughRefused = codec;
+      p->passthrough = 0;
+      return -1;
+    }
+
+    log_printf("pipeline %d: passthrough %s to %s\n", p->index, avcodec_get_name(codec), p->out_dev->dev);
+
+    // channels 0: not decoded
+    status_post_codec(p->index, avcodec_get_name(codec), 0, 0, 48000, -1);
+    transition_format(codec, 2, readTime);
+
+    // opening the output takes some time, flush input and restart with lowest possible latency
+    reinit_input(p);
+    return 0;
+  }
+
+  int size = p->read_state.burst_size;
+  int words = pkt->size / 2;
+
+  if (size < BURST_HEADER_SIZE + pkt->size)
+    size = (BURST_HEADER_SIZE + pkt->size + 3) & ~3;
+
+  // samples cannot be dropped from a burst, skip a whole one to catch up
+  if (p->outDelay >= catchupMs(p))
+  {
+    log_printf("pipeline %d: catch up %d frames\n", p->index, size / 4);
+    p->outDelay -= size / 4 * 1000 / p->out_dev->sample_rate;
+    return 0;
+  }
+
+  uint16_t *out = (uint16_t*)p->resamples;
+
+  out[0] = SYNCWORD1;
+  out[1] = SYNCWORD2;
+  out[2] = p->read_state.last_data_type;
+  // Pd counts bits, bytes for E-AC-3
+  out[3] = (p->read_state.last_data_type & 0xff) == IEC61937_EAC3 ? pkt->size : pkt->size * 8;
+
+  // the demuxer swapped the payload to big endian for the decoder
+  my_spdif_bswap_buf16(out + 4, (uint16_t*)pkt->data, words);
+
+  if (pkt->size & 1)
+    out[4 + words++] = pkt->data[pkt->size - 1] << 8;
+
+  memset(out + 4 + words, 0, size - BURST_HEADER_SIZE - words * 2);
+
+  p->out_dev->capture_time = readTime;
+  prof_stage(PROF_WRITE);
+
+  if(!sink_write(p, (uint8_t*)out, size))
+    errx(1, "Could not play audio to output device");
+
+  transition_output(readTime, gettimeofday_ms());
+
+  return 0;
 }
 
 //--------------------------------------------------------------------------------------------------
-void closeInDev()
+// a burst burstcheck() rejected is dropped, its duration plays as silence so the output does not
+// run low and the pipeline keeps running
+static void rejectBurst(Pipeline *p, double readTime)
 {
-  if (!read_state.dev)
+  MySpdifState *rs = &p->read_state;
+  const char *codec = avcodec_get_name(p->spdif_ctx->streams[0]->codec->codec_id);
+  const char *reason = burstcheck_reason(rs->rejected_reason);
+
+  log_printf("pipeline %d: %s burst rejected (%s), %u so far\n", p->index, codec, reason, rs->rejected[rs->rejected_reason]);
+  status_post_rejected(p->index, codec, reason, rs->rejected[BURSTCHECK_SYNC], rs->rejected[BURSTCHECK_SIZE], rs->rejected[BURSTCHECK_CRC]);
+
+  if (!Sink_isOpen(p->out_dev) || p->preopened || !rs->burst_size || !p->inrate.rate || p->outDelay >= catchupMs(p))
     return;
-  
- 	snd_pcm_close(read_state.dev);
-  read_state.dev = NULL;
+
+  int frameSize = 2 * outputChannels(p);
+  int64_t frames = (int64_t)rs->burst_size / 4 * p->out_dev->sample_rate / p->inrate.rate;
+
+  if (frames > OUTPUT_BUFFER_SIZE / frameSize)
+    frames = OUTPUT_BUFFER_SIZE / frameSize;
+
+  memset(p->resamples, 0, frames * frameSize);
+  p->out_dev->capture_time = readTime;
+
+  if(!sink_write(p, (uint8_t*)p->resamples, frames * frameSize))
+    errx(1, "Could not play audio to output device");
 }
 
 //--------------------------------------------------------------------------------------------------
-void reinit()
+// -l: levels of the converted output as it is played, published every interval
+static void meterOutput(Pipeline *p, int bytes)
 {
-  printf("reinit...\n");
+  int channels = outputChannels(p);
+  uint64_t layout = fixed_channels ? 0 : p->codecHandler.currentChannelLayout;
+  meter_levels levels;
+
+  if (p->meter.channels != channels || p->meter.layout != layout)
+    meter_setup(&p->meter, layout, channels, p->out_dev->sample_rate);
 
-  closeOutDev();
-  closeInDev();
-  CodecHandler_closeCodec(&codecHandler);
-  CodecHandler_deinit(&codecHandler);
+  if (meter_process(&p->meter, (int16_t*)p->resamples, bytes / 2 / channels, &levels))
+    status_post_levels(p->index, levels.channels, levels.peak, levels.rms, levels.loudness);
+}
+
+//--------------------------------------------------------------------------------------------------
+static long rss_kb()
+{
+  long pages = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
 
-  // snd_pcm_drain(read_state.dev); // long delay !?
+  if (f)
+  {
+    if (fscanf(f, "%*s %ld", &pages) != 1)
+      pages = 0;
 
-  read_state.dev = alsa_open(alsa_dev_name, 0);
-  initContext();
-  CodecHandler_init(&codecHandler);
+    fclose(f);
+  }
 
-  printf("reinit...ok\n");
-	fflush(stdout);
+  return pages * (sysconf(_SC_PAGESIZE) / 1024);
 }
 
 //--------------------------------------------------------------------------------------------------
-void reinit_input()
+// -L: a full restart after every burst played, as on a codec switch. Once the allocator has
+// settled the resident size must stay flat.
+void leakCheckCycle(Pipeline *p)
 {
-  printf("reinit input...\n");
+  static int cycle;
+  static long baseline;
+  int warmup = leak_cycles / 10 < LEAK_WARMUP_CYCLES ? leak_cycles / 10 : LEAK_WARMUP_CYCLES;
+
+  if (cycle++ == warmup)
+    baseline = rss_kb();
+
+  if (cycle < leak_cycles)
+  {
+    reinit(p);
+    return;
+  }
 
-  closeInDev();
+  long growth = rss_kb() - baseline;
 
-  read_state.dev = alsa_open(alsa_dev_name, 0);
-  initContext();
+  leak_failed = growth > LEAK_TOLERANCE_KB;
+  log_report("leak check: %d reinit cycles, rss %ld kB, growth after warm-up %ld kB: %s\n",
+    cycle, rss_kb(), growth, leak_failed ? "FAILED" : "ok");
 
-  printf("reinit input...ok\n");
-	fflush(stdout);
+  stop = 1;
 }
 
 //--------------------------------------------------------------------------------------------------
+void pinThread(Pipeline *p)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  cpu_set_t set;
+
+  if (cpus < 1)
+    return;
+
+  CPU_ZERO(&set);
+  CPU_SET(p->index % cpus, &set);
+
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+  if (err)
+    log_printf("pipeline %d: cannot pin to cpu %ld: %s\n", p->index, p->index % cpus, strerror(err));
+}
+
 //--------------------------------------------------------------------------------------------------
-int main(int argc, char **argv)
+// net: output, pass the raw input on undecoded
+void forwardPipeline(Pipeline *p)
 {
-	char *out_dev_name = NULL, *out_dev_name_ch = NULL;
-	int opt;
-  double start = 0;
+  uint8_t buf[I_BUFFER_SIZE];
 
-	for (opt = 0; (opt = getopt(argc, argv, "hi:o:vb:")) != -1;) {
-		switch (opt) {
-		case 'i':
-			alsa_dev_name = optarg;
-			break;
-		case 'o':
-			out_dev_name = optarg;
-      out_dev_name_ch = strchr(out_dev_name, '#');
-			break;
-		case 'v':
-			debug_data = 1;
-			break;
-    case 'b':
-      out_dev_buffer_time = optarg;
-      break;
-		default:
-			usage();
-		}
-	}
+  p->out_dev->channels = 2;
+  p->out_dev->sample_rate = 48000;
 
-	argc -= optind;
-	argv += optind;
+  if (p->out_dev->open(p->out_dev) != 0)
+    errx(1, "cannot open output %s", p->out_dev->dev);
 
-	if (argc != 0)
-		usage();
+  p->source->open(p->source);
+
+  log_printf("pipeline %d: forward %s -> %s\n", p->index, p->source->dev, p->out_dev->dev);
 
-	if (!alsa_dev_name)
+  while(!stop)
   {
-		fprintf(stderr, "please specify input device\n\n");
-		usage();
-	}
+    double readTime = gettimeofday_ms();
+    int n = source_reader(p->source, buf, sizeof(buf));
 
-	av_register_all();
-	avcodec_register_all();
-	avdevice_register_all();
-	ao_initialize();
+    if(n == AVERROR_EOF && p->source->finite)
+    {
+      log_printf("pipeline %d: end of input\n", p->index);
+      break;
+    }
 
-  char *resamples = malloc(1024*1024);
+    if(n < 0)
+      errx(1, "error: read input");
 
-  read_state.dev = alsa_open(alsa_dev_name, 0);
+    p->out_dev->capture_time = readTime;
 
-	spdif_fmt = av_find_input_format("spdif");
-	if (!spdif_fmt)
-		errx(1, "cannot find S/PDIF demux driver");
+    if(n >= 4 && !p->out_dev->write(p->out_dev, buf, n / 4))
+      errx(1, "Could not forward input to %s", p->out_dev->dev);
+
+    startup_output(p->index);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void* runPipeline(void *arg)
+{
+  Pipeline *p = arg;
+  CodecHandler *codecHandler = &p->codecHandler;
+  char *resamples = p->resamples;
+  double start = 0;
+
+  if (pipelineCount > 1)
+    pinThread(p);
+
+  if (!strcmp(p->out_dev->type, "net"))
+  {
+    forwardPipeline(p);
+    return NULL;
+  }
+
+  // before the output opens, the prefill depends on it
+  latencyStart(p);
+  preopenStart(p);
 
-  initContext();
+  p->source->open(p->source);
+  inrate_reset(&p->inrate, p->source->sample_rate);
+  startup_mark(p->index, "input open");
+
+  initContext(p);
+  startup_mark(p->index, "demuxer ready");
 
   AVPacket pkt = {.size = 0, .data = NULL};
   memset(&pkt, 0, sizeof(AVPacket));
@@ -434,24 +962,61 @@ int main(int argc, char **argv)
 
   uint32_t howmuch = 0;
   
-  CodecHandler_init(&codecHandler);
+  CodecHandler_init(codecHandler);
 
-	printf("start loop\n");
+  // the spec, the preopen thread may still be writing the channel count into out_dev->dev
+	log_printf("pipeline %d: start loop %s -> %s\n", p->index, p->source->dev, p->config.output);
 
-	while(1) 
+	while(!stop) 
   {
+    prof_burst();
+
+    if(control_pending(p->index))
+    {
+      preopenWait(p);
+      applyControl(p);
+    }
+
+    double readTime = gettimeofday_ms();
+
     if(debug_data)
-      start = gettimeofday_ms();
+      start = readTime;
+
+		int ret = my_spdif_read_packet(p->spdif_ctx, &p->read_state, &pkt, (uint8_t*)resamples, MAX_BURST_SIZE, &howmuch);
 
-		int ret = my_spdif_read_packet(spdif_ctx, &pkt, (uint8_t*)resamples, MAX_BURST_SIZE, &howmuch);
+    // the output is not touched before this
+    preopenWait(p);
+    startup_mark(p->index, "first burst read");
 
     if(ret == SPIF_DECODER_RETRY_REQUIRED)
       continue;
 
+    if(ret == SPIF_DECODER_REJECTED)
+    {
+      rejectBurst(p, readTime);
+      continue;
+    }
+
+    if(ret == AVERROR_EOF && p->source->finite && leak_cycles)
+    {
+      // keep cycling over the same input
+      p->source->close(p->source);
+      p->source->open(p->source);
+      reinit(p);
+      continue;
+    }
+
+    if(ret == AVERROR_EOF && p->source->finite)
+    {
+      log_printf("pipeline %d: end of input\n", p->index);
+      break;
+    }
+
     if(ret == SPIF_DECODER_RESTART_REQUIRED)
     {
       // codec changed ... reinit system
-      reinit();
+      transition_restart(gettimeofday_ms());
+      reinit(p);
       continue;
     }
 
@@ -459,70 +1024,141 @@ int main(int argc, char **argv)
       errx(1, "error: read packet");
 
     if(debug_data)
-      printf("read_packet() bytes=%d in %.1lf ms\n", pkt.size, gettimeofday_ms() - start);
+      log_printf("read_packet() bytes=%d in %.1lf ms\n", pkt.size, gettimeofday_ms() - start);
+
+    enum AVCodecID codecId = ret ? AV_CODEC_ID_NONE : p->spdif_ctx->streams[0]->codec->codec_id;
+    int passthrough = !ret && passthroughWanted(p, codecId);
+
+    if(p->passthrough && !passthrough)
+    {
+      // back to decoding, the output must not play PCM in IEC 61937 mode
+      closeOutDev(p);
+      p->passthrough = 0;
+    }
+
+    if(passthrough && passthroughBurst(p, &pkt, codecId, readTime) == 0)
+    {
+      av_packet_unref(&pkt);
+      continue;
+    }
 
     if(ret == SPIF_DECODER_PCM)
     {
-      CodecHandler_closeCodec(&codecHandler);
-      codecHandler.currentChannelCount = 2;
-      codecHandler.currentSampleRate = 48000;
-      codecHandler.currentChannelLayout = AV_CH_LAYOUT_STEREO;
+      int rateChanged = codecHandler->currentSampleRate != p->inrate.rate;
+
+      CodecHandler_closeCodec(codecHandler);
+      codecHandler->currentChannelCount = 2;
+      codecHandler->currentSampleRate = p->inrate.rate;
+      codecHandler->currentChannelLayout = AV_CH_LAYOUT_STEREO;
       howmuch = MAX_BURST_SIZE;
+
+      prof_stage(PROF_CONVERT);
+
+      if(CodecHandler_convertPcm(codecHandler, p->inrate.rate, (uint8_t*)resamples, &howmuch) == SPIF_DECODER_RESTART_REQUIRED)
+      {
+        reinit(p);
+        continue;
+      }
+
+      if(rateChanged && Sink_isOpen(p->out_dev))
+        postCodec(p);
+
+      transition_format(0, 2, readTime);
     }
     else
     {
-      int newCodec = CodecHandler_loadCodec(&codecHandler, spdif_ctx);
+      double loadStart = gettimeofday_ms();
+      int newCodec = CodecHandler_loadCodec(codecHandler, p->spdif_ctx);
+
+      transition_stage(TRANSITION_STAGE_LOAD_CODEC, gettimeofday_ms() - loadStart);
+      startup_mark(p->index, "codec loaded");
+
+      prof_stage(PROF_DECODE);
+      ret = CodecHandler_decodeFrame(codecHandler, &pkt);
 
-      if( (ret = CodecHandler_decodeCodec(&codecHandler, &pkt, (uint8_t*)resamples, &howmuch)) == 1)
+      if(ret != SPIF_DECODER_RESTART_REQUIRED && fault_fire(FAULT_DECODE, NULL))
+        ret = SPIF_DECODER_RESTART_REQUIRED;
+
+      prof_stage(PROF_CONVERT);
+
+      if(ret != SPIF_DECODER_RESTART_REQUIRED && CodecHandler_convertFrame(codecHandler, (uint8_t*)resamples, &howmuch) == SPIF_DECODER_RESTART_REQUIRED)
+        ret = SPIF_DECODER_RESTART_REQUIRED;
+
+      if(ret == 1)
       {
-        //channel count has changed
-        closeOutDev();
+        //channel count has changed, an output opened for the format of the last run may fit
+        if(fixed_channels)
+        {
+          // -m: the output keeps its channels, the codec handler mixes the layout into them
+          if(Sink_isOpen(p->out_dev) && !p->preopened)
+            postCodec(p);
+        }
+        else if(!p->preopened || p->out_dev->channels != codecHandler->currentChannelCount)
+          closeOutDev(p);
       }
 
       if(ret == SPIF_DECODER_RESTART_REQUIRED) 
       {
         // decodeing failed, restart
-        reinit();
+        record_event(RECORD_RESTART, &(record_reason){RECORD_REASON_DECODE_FAILED}, sizeof(record_reason));
+        transition_restart(gettimeofday_ms());
+        reinit(p);
         continue;
       }
 
+      transition_format(codecHandler->currentCodecID, codecHandler->currentChannelCount, readTime);
+
+      if(record_enabled && (newCodec || ret == 1))
+        record_event(RECORD_CODEC, &(record_codec){codecHandler->currentCodecID, codecHandler->currentChannelCount}, sizeof(record_codec));
+
       if(newCodec)
-        printf("Loaded codec %s channels:%d, channel-layout:%08x \n", avcodec_get_name(codecHandler.currentCodecID), codecHandler.currentChannelCount, codecHandler.currentChannelLayout);
+        log_printf("pipeline %d: Loaded codec %s (%s) channels:%d, channel-layout:%08llx \n", p->index, avcodec_get_name(codecHandler->currentCodecID), codecHandler->codec->name, codecHandler->currentChannelCount, (unsigned long long)codecHandler->currentChannelLayout);
 
       if(pkt.size != 0)
-        printf("still some bytes left %d\n",pkt.size);
+        log_printf("still some bytes left %d\n",pkt.size);
     }
 
-    if (!out_dev) 
-    {
-      sendInfoToSocket(&codecHandler);
+    if (p->preopened && p->out_dev->channels != outputChannels(p))
+      closeOutDev(p);
 
-      if(out_dev_name_ch)
-        *out_dev_name_ch = '0' + codecHandler.currentChannelCount;
+    if (p->preopened)
+    {
+      // opened while the input started, no input flush needed
+      p->preopened = 0;
+      postCodec(p);
+    }
+    else if (!Sink_isOpen(p->out_dev)) 
+    {
+      char key[HWCACHE_KEY_SIZE];
 
-      out_dev = alsa_open(out_dev_name, codecHandler.currentChannelCount);
+      postCodec(p);
 
-      if (!out_dev)
-        errx(1, "cannot open audio output, channels=%d, format=s16, rate=%d", codecHandler.currentChannelCount, codecHandler.currentSampleRate);
+      if (openOutDev(p) != 0)
+        errx(1, "cannot open audio output, channels=%d, format=s16, rate=%d", outputChannels(p), p->out_dev->sample_rate);
 
+      startup_mark(p->index, "output open");
 
-      outDelay = 0;
+      formatKey(p, key, sizeof(key));
+      hwcache_put(key, &p->out_dev->channels, 1);
 
-      // alsa_open() takes some time, flush input and restart with lowest possible latency
-      reinit_input();
+      // opening the output takes some time, flush input and restart with lowest possible latency
+      reinit_input(p);
 
       av_packet_unref(&pkt); // reset packet for reuse
       continue;
     }
 
+    if(meter_enabled)
+      meterOutput(p, howmuch);
+
     // remove some frames to catch up
-    if(outDelay >= 30)  // ms
+    if(p->outDelay >= catchupMs(p))
     {
-      int frameSize = 2 * codecHandler.currentChannelCount;
+      int frameSize = 2 * outputChannels(p);
       int frames = howmuch / frameSize;
       int offset = 0;
 
-      printf("catch up %d frames\n", frames / 8);
+      log_printf("pipeline %d: catch up %d frames\n", p->index, frames / 8);
 
       frames -= frames / 8;
 
@@ -545,14 +1181,314 @@ int main(int argc, char **argv)
     if(debug_data)
       start = gettimeofday_ms();
 
-    if(!alsa_write(resamples, howmuch))
+    p->out_dev->capture_time = readTime;
+    prof_stage(PROF_WRITE);
+
+    if(!sink_write(p, (uint8_t*)resamples, howmuch))
       errx(1, "Could not play audio to output device");
 
+    transition_output(readTime, gettimeofday_ms());
+
     if(debug_data)
-      printf("alsa_write() frames=%d ms=%.1f in %.1lf ms\n", howmuch / 2 / codecHandler.currentChannelCount, howmuch / 2 / codecHandler.currentChannelCount / 48.0, gettimeofday_ms() - start);
+      log_printf("sink_write() frames=%d ms=%.1f in %.1lf ms\n", howmuch / 2 / outputChannels(p), howmuch / 2 / outputChannels(p) * 1000.0 / p->out_dev->sample_rate, gettimeofday_ms() - start);
 
     av_packet_unref(&pkt); // reset packet for reuse
+
+    if(leak_cycles)
+      leakCheckCycle(p);
+	}
+
+  // -e: the last, partial batch
+  if(p->batchUsed && Sink_isOpen(p->out_dev))
+    writeOut(p, p->batch, p->batchUsed);
+
+  av_packet_unref(&pkt);
+
+  return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+// logged at exit to compare -e with the default: wakeups are the voluntary context switches of all
+// threads, blocking reads and writes, sleeps and the status server's poll
+static void usageReport(double startMs)
+{
+  struct rusage ru;
+  double wall = (gettimeofday_ms() - startMs) / 1000;
+
+  if (getrusage(RUSAGE_SELF, &ru) != 0 || wall <= 0)
+    return;
+
+  double cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+
+  log_report("usage: %.1f s, cpu %.1f%%, %.1f wakeups/s%s\n", wall, cpu * 100 / wall, ru.ru_nvcsw / wall,
+    batch_ms ? ", batched" : "");
+}
+
+//--------------------------------------------------------------------------------------------------
+Pipeline* addPipeline(char *in_dev_name)
+{
+  if (pipelineCount == MAX_PIPELINES)
+    errx(1, "at most %d pipelines", MAX_PIPELINES);
+
+  Pipeline *p = &pipelines[pipelineCount];
+
+  p->index = pipelineCount++;
+  p->read_state = (MySpdifState)MY_SPDIF_STATE_INIT;
+  p->source = Source_create(in_dev_name);
+  p->source->period_time = batch_ms;
+  p->source->pipeline = p->index;
+
+  if (p->source->skip)
+  {
+    p->read_state.skip = source_skipper;
+    p->read_state.skip_opaque = p->source;
+  }
+
+  return p;
+}
+
+//--------------------------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	double startMs = gettimeofday_ms();
+	char *in_dev_names[MAX_PIPELINES], *out_dev_names[MAX_PIPELINES];
+	int inputs = 0, outputs = 0;
+	char *status_unix_path = NULL;
+	int status_port = STATUS_DEFAULT_PORT;
+	char *record_path = NULL;
+	char *cache_path = NULL;
+	int record_mb = 64;
+	int opt;
+
+  control_config defaults = {
+    .buffer_time = 64,  // 2 packets of 32ms
+    .catchup_ms  = 30,
+  };
+
+	for (opt = 0; (opt = getopt(argc, argv, "hi:o:vb:c:a:p:m:M:e:s:u:C:D:Q:TPF:L:l:r:R:")) != -1;) {
+		switch (opt) {
+		case 'i':
+      if (inputs == MAX_PIPELINES)
+        errx(1, "at most %d pipelines", MAX_PIPELINES);
+			in_dev_names[inputs++] = optarg;
+			break;
+		case 'o':
+      if (outputs == MAX_PIPELINES)
+        errx(1, "at most %d pipelines", MAX_PIPELINES);
+			out_dev_names[outputs++] = optarg;
+			break;
+		case 'v':
+			debug_data = 1;
+			break;
+    case 'T':
+      transition_stats = 1;
+      break;
+    case 'F':
+      if (fault_init(optarg) != 0)
+        errx(1, "invalid fault spec %s", optarg);
+      break;
+    case 'P':
+      prof_enabled = 1;
+      break;
+    case 'L':
+      leak_cycles = atoi(optarg);
+      break;
+    case 'l':
+      if (meter_init(optarg) != 0)
+        errx(1, "invalid metering %s, expected <ms>[,loudness]", optarg);
+      break;
+    case 'r':
+      record_path = optarg;
+      break;
+    case 'R':
+      record_mb = atoi(optarg);
+      break;
+    case 'b':
+      defaults.buffer_time = atoi(optarg);
+      break;
+    case 'c':
+      defaults.catchup_ms = atoi(optarg);
+      break;
+    case 'a':
+      if (control_parse_latency(optarg, &defaults.latency_min, &defaults.latency_max) != 0)
+        errx(1, "invalid latency bounds %s, expected <min>:<max> in ms", optarg);
+      break;
+    case 'p':
+      if (strlen(optarg) >= sizeof(defaults.passthrough))
+        errx(1, "passthrough codec list too long");
+      snprintf(defaults.passthrough, sizeof(defaults.passthrough), "%s", strcmp(optarg, "off") ? optarg : "");
+      break;
+    case 's':
+      status_port = atoi(optarg);
+      break;
+    case 'u':
+      status_unix_path = optarg;
+      break;
+    case 'm':
+      fixed_channels = atoi(optarg);
+      if (fixed_channels < 1 || fixed_channels > CODEC_MAX_CHANNELS)
+        errx(1, "output channels must be 1..%d", CODEC_MAX_CHANNELS);
+      break;
+    case 'M':
+      if ((mix_flags = mixer_parse(optarg)) < 0)
+        errx(1, "invalid mixing %s", optarg);
+      break;
+    case 'e':
+      batch_ms = atoi(optarg);
+      if (batch_ms < 1 || batch_ms > 1000)
+        errx(1, "batch time must be 1..1000 ms");
+      break;
+    case 'Q':
+      if (resample_setQuality(optarg) != 0)
+        errx(1, "invalid resampling quality %s", optarg);
+      break;
+    case 'C':
+      cache_path = optarg;
+      break;
+    case 'D':
+      if (CodecHandler_setPolicy(optarg) != 0)
+        errx(1, "invalid decoder policy %s", optarg);
+      break;
+		default:
+			usage();
+		}
 	}
 
-	return (0);
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 0)
+		usage();
+
+	if (!inputs)
+  {
+		fprintf(stderr, "please specify input device\n\n");
+		usage();
+	}
+
+	if (outputs != inputs)
+  {
+		fprintf(stderr, "please specify one output device per input device\n\n");
+		usage();
+	}
+
+  for (int i = 0; i < inputs; i++)
+  {
+    if (strlen(out_dev_names[i]) >= sizeof(defaults.output))
+      errx(1, "output name too long");
+
+    // keep stdout clean for audio
+    if (!strcmp(out_dev_names[i], "-"))
+      log_set_output(stderr);
+  }
+
+  // the recorder ring, the transition statistics and the counters have a single producer
+  if (inputs > 1 && (record_path || transition_stats || leak_cycles || prof_enabled || fault_enabled))
+    errx(1, "-r, -T, -P, -F and -L need a single input");
+
+  // the adaptive level would be measured against the batches
+  if (batch_ms && defaults.latency_max)
+    errx(1, "-e and -a exclude each other");
+
+  CodecHandler_setOutput(fixed_channels, mix_flags);
+
+	log_init();
+  startup_init(inputs);
+  prof_init();
+  hwcache_init(cache_path);
+
+  for (int i = 0; i < inputs; i++)
+  {
+    control_config config = defaults;
+
+    snprintf(config.output, sizeof(config.output), "%s", out_dev_names[i]);
+    control_init(i, &config);
+  }
+
+  if (batch_ms)
+    status_set_interval(batch_ms);
+
+	status_init(inputs, status_port, status_unix_path);
+
+  if (record_path)
+    record_init(record_path, record_mb * 1024LL * 1024);
+
+  // libav is initialized once and shared by all pipelines
+	av_register_all();
+	avcodec_register_all();
+	avdevice_register_all();
+
+	spdif_fmt = av_find_input_format("spdif");
+	if (!spdif_fmt)
+		errx(1, "cannot find S/PDIF demux driver");
+
+  startup_mark(-1, "libav ready");
+
+  for (int i = 0; i < inputs; i++)
+  {
+    Pipeline *p = addPipeline(in_dev_names[i]);
+
+    p->config = defaults;
+    snprintf(p->config.output, sizeof(p->config.output), "%s", out_dev_names[i]);
+
+    p->resamples = malloc(OUTPUT_BUFFER_SIZE);
+    if (!p->resamples)
+      errx(1, "cannot allocate output buffer");
+
+    // less than a batch left over and the write that completes it, batchWrite() drains every full one
+    p->batch = batch_ms ? malloc(batch_ms * BATCH_BYTES_PER_MS + OUTPUT_BUFFER_SIZE) : NULL;
+    if (batch_ms && !p->batch)
+      errx(1, "cannot allocate batch buffer");
+
+    if (createOutDev(p, out_dev_names[i]) != 0)
+      errx(1, "cannot create output %s", out_dev_names[i]);
+
+    // forwardPipeline() does not apply control commands
+    if (!strcmp(p->out_dev->type, "net"))
+      control_lock(p->index);
+  }
+
+  struct sigaction sa = {.sa_handler = onSignal};
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  if (pipelineCount == 1)
+    runPipeline(&pipelines[0]);
+  else
+  {
+    for (int i = 0; i < pipelineCount; i++)
+      if (pthread_create(&pipelines[i].thread, NULL, runPipeline, &pipelines[i]) != 0)
+        errx(1, "cannot create pipeline thread");
+
+    for (int i = 0; i < pipelineCount; i++)
+      pthread_join(pipelines[i].thread, NULL);
+  }
+
+  transition_report();
+  prof_report();
+  fault_report();
+  usageReport(startMs);
+
+  for (int i = 0; i < pipelineCount; i++)
+  {
+    Pipeline *p = &pipelines[i];
+
+    freeOutDev(p);
+    Source_free(p->source);
+    CodecHandler_closeCodec(&p->codecHandler);
+    CodecHandler_deinit(&p->codecHandler);
+    avformat_close_input(&p->spdif_ctx);
+
+    if (p->reader)
+      av_freep(&p->reader->buffer);
+
+    avio_context_free(&p->reader);
+    free(p->resamples);
+    free(p->batch);
+  }
+
+  status_deinit();
+
+	return leak_failed;
 }
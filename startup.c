@@ -0,0 +1,120 @@
+/*
+ * startup.c
+ *
+ * Startup timeline, see startup.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "startup.h"
+#include "log.h"
+#include "myspdif.h"
+
+typedef struct {
+  int pipeline;
+  const char *what;
+  double ms;                      // since process start
+} startup_entry;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static startup_entry marks[STARTUP_MAX_MARKS];
+static int count;
+static int pending;               // pipelines without output yet
+static int done[STARTUP_MAX_PIPELINES];  // per pipeline, only touched by its own thread
+static double origin;             // process start, CLOCK_REALTIME ms
+
+//--------------------------------------------------------------------------------------------------
+// process start in CLOCK_REALTIME ms, now if unknown
+static double process_start(double now)
+{
+  FILE *f = fopen("/proc/self/stat", "r");
+  char buf[1024];
+  unsigned long long start;
+  long hz = sysconf(_SC_CLK_TCK);
+
+  if (!f)
+    return now;
+
+  size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[n] = 0;
+
+  // field 22 starttime, counted after the command name which may contain anything
+  char *p = strrchr(buf, ')');
+
+  if (!p || hz <= 0 || sscanf(p + 2, "%*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %llu", &start) != 1)
+    return now;
+
+  double boot = now - clock_ms(CLOCK_BOOTTIME);
+  double t = boot + start * 1000.0 / hz;
+
+  return t <= now ? t : now;
+}
+
+//--------------------------------------------------------------------------------------------------
+void startup_init(int pipelines)
+{
+  double now = clock_ms(CLOCK_REALTIME);
+
+  origin = process_start(now);
+  pending = pipelines;
+
+  startup_mark(-1, "main");
+}
+
+//--------------------------------------------------------------------------------------------------
+// once, right after the first samples went out. log_report() is not rate limited.
+static void report()
+{
+  log_report("startup timeline:\n");
+
+  for (int i = 0; i < count; i++)
+  {
+    if (marks[i].pipeline < 0)
+      log_report("  %7.1f ms  %s\n", marks[i].ms, marks[i].what);
+    else
+      log_report("  %7.1f ms  pipeline %d: %s\n", marks[i].ms, marks[i].pipeline, marks[i].what);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void startup_mark(int pipeline, const char *what)
+{
+  double ms = clock_ms(CLOCK_REALTIME) - origin;
+
+  if (pipeline >= 0 && done[pipeline])
+    return;
+
+  pthread_mutex_lock(&lock);
+
+  int seen = 0;
+
+  for (int i = 0; i < count && !seen; i++)
+    seen = marks[i].pipeline == pipeline && marks[i].what == what;
+
+  if (!seen && count < STARTUP_MAX_MARKS)
+    marks[count++] = (startup_entry){pipeline, what, ms};
+
+  pthread_mutex_unlock(&lock);
+}
+
+//--------------------------------------------------------------------------------------------------
+void startup_output(int pipeline)
+{
+  if (done[pipeline])
+    return;
+
+  startup_mark(pipeline, "first sample written");
+  done[pipeline] = 1;
+
+  pthread_mutex_lock(&lock);
+
+  if (--pending == 0)
+    report();
+
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,24 @@
+/*
+ * startup.h
+ *
+ * Startup timeline: milestones from process start to the first sample
+ * written by each pipeline, logged once all pipelines played their first
+ * sample. Process start is taken from /proc/self/stat (10ms resolution),
+ * so dynamic loading before main() is included.
+ */
+
+#ifndef STARTUP_H_
+#define STARTUP_H_
+
+#define STARTUP_MAX_MARKS 48
+#define STARTUP_MAX_PIPELINES 8
+
+void startup_init(int pipelines);
+
+// record a milestone once, pipeline -1 for process wide steps. what must be a literal.
+void startup_mark(int pipeline, const char *what);
+
+// first sample written, cheap after the first call
+void startup_output(int pipeline);
+
+#endif /* STARTUP_H_ */
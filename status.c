@@ -0,0 +1,645 @@
+/*
+ * status.c
+ *
+ * Status/event server, see status.h
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "status.h"
+#include "log.h"
+#include "control.h"
+
+#define STATUS_POLL_MS    20
+#define STATUS_LINE_SIZE  512
+
+enum { EV_CODEC, EV_LATENCY, EV_LATENCY_TARGET, EV_XRUN, EV_INPUT, EV_REJECTED, EV_LEVELS };
+
+#define STATUS_MAX_CHANNELS 8
+
+typedef struct {
+  atomic_uint seq;
+  int type;
+  int pipeline;
+  const char *codec;
+  int channels;
+  uint64_t channel_layout;
+  int sample_rate;
+  int service_type;
+  int value;
+  int target;
+  unsigned lost, concealed;
+  const char *reason;
+  unsigned rejected[3];             // sync, size, crc
+  float peak[STATUS_MAX_CHANNELS];
+  float rms[STATUS_MAX_CHANNELS];
+  float loudness;
+} status_event;
+
+typedef struct {
+  int fd;
+  char in[CONTROL_SPEC_SIZE + 64];
+  int inUsed;
+} status_client;
+
+typedef struct {
+  const char *codec;
+  int channels;
+  uint64_t channel_layout;
+  int sample_rate;
+  int service_type;
+  int latency_ms;
+  int latency_target_ms;    // output delay at which frames are dropped
+  unsigned xruns_in;
+  unsigned xruns_out;
+  int input_depth_ms;       // network input only, -1 otherwise
+  int input_target_ms;
+  unsigned input_lost;
+  unsigned input_concealed;
+  unsigned rejected[3];     // bursts dropped before decoding: sync, size, crc
+} status_state;
+
+static status_event queue[STATUS_QUEUE_SIZE];
+static atomic_uint queue_head;
+static unsigned queue_tail;
+static atomic_uint queue_dropped;
+
+static status_state state[STATUS_MAX_PIPELINES];
+static int pipelines = 1;
+static status_client clients[STATUS_MAX_CLIENTS];
+static int tcp_fd = -1, unix_fd = -1;
+static char unix_name[108];
+
+static pthread_t status_thread;
+static atomic_int status_running;
+static int poll_ms = STATUS_POLL_MS;
+
+//--------------------------------------------------------------------------------------------------
+static status_event* queue_claim(unsigned *pos)
+{
+  if (!atomic_load_explicit(&status_running, memory_order_relaxed))
+    return NULL;
+
+  *pos = atomic_load_explicit(&queue_head, memory_order_relaxed);
+
+  while (1)
+  {
+    status_event *e = &queue[*pos & (STATUS_QUEUE_SIZE - 1)];
+    int diff = (int)(atomic_load_explicit(&e->seq, memory_order_acquire) - *pos);
+
+    if (diff == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&queue_head, pos, *pos + 1, memory_order_relaxed, memory_order_relaxed))
+        return e;
+    }
+    else if (diff < 0)
+    {
+      atomic_fetch_add_explicit(&queue_dropped, 1, memory_order_relaxed);
+      return NULL;
+    }
+    else
+      *pos = atomic_load_explicit(&queue_head, memory_order_relaxed);
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+static void queue_publish(status_event *e, unsigned pos)
+{
+  atomic_store_explicit(&e->seq, pos + 1, memory_order_release);
+}
+
+//--------------------------------------------------------------------------------------------------
+void status_post_codec(int pipeline, const char *codec, int channels, uint64_t channel_layout, int sample_rate, int service_type)
+{
+  unsigned pos;
+  status_event *e = queue_claim(&pos);
+
+  if (!e)
+    return;
+
+  e->type           = EV_CODEC;
+  e->pipeline       = pipeline;
+  e->codec          = codec;
+  e->channels       = channels;
+  e->channel_layout = channel_layout;
+  e->sample_rate    = sample_rate;
+  e->service_type   = service_type;
+
+  queue_publish(e, pos);
+}
+
+//--------------------------------------------------------------------------------------------------
+void status_post_latency(int pipeline, int ms)
+{
+  unsigned pos;
+  status_event *e = queue_claim(&pos);
+
+  if (!e)
+    return;
+
+  e->type     = EV_LATENCY;
+  e->pipeline = pipeline;
+  e->value    = ms;
+
+  queue_publish(e, pos);
+}
+
+//--------------------------------------------------------------------------------------------------
+void status_post_latency_target(int pipeline, int ms)
+{
+  unsigned pos;
+  status_event *e = queue_claim(&pos);
+
+  if (!e)
+    return;
+
+  e->type     = EV_LATENCY_TARGET;
+  e->pipeline = pipeline;
+  e->value    = ms;
+
+  queue_publish(e, pos);
+}
+
+//--------------------------------------------------------------------------------------------------
+void status_post_xrun(int pipeline, int output)
+{
+  unsigned pos;
+  status_event *e = queue_claim(&pos);
+
+  if (!e)
+    return;
+
+  e->type     = EV_XRUN;
+  e->pipeline = pipeline;
+  e->value    = output;
+
+  queue_publish(e, pos);
+}
+
+//--------------------------------------------------------------------------------------------------
+void status_post_input(int pipeline, int depth_ms, int target_ms, unsigned lost, unsigned concealed)
+{
+  unsigned pos;
+  status_event *e = queue_claim(&pos);
+
+  if (!e)
+    return;
+
+  e->type      = EV_INPUT;
+  e->pipeline  = pipeline;
+  e->value     = depth_ms;
+  e->target    = target_ms;
+  e->lost      = lost;
+  e->concealed = concealed;
+
+  queue_publish(e, pos);
+}
+
+//--------------------------------------------------------------------------------------------------
+void status_post_rejected(int pipeline, const char *codec, const char *reason, unsigned sync, unsigned size, unsigned crc)
+{
+  unsigned pos;
+  status_event *e = queue_claim(&pos);
+
+  if (!e)
+    return;
+
+  e->type        = EV_REJECTED;
+  e->pipeline    = pipeline;
+  e->codec       = codec;
+  e->reason      = reason;
+  e->rejected[0] = sync;
+  e->rejected[1] = size;
+  e->rejected[2] = crc;
+
+  queue_publish(e, pos);
+}
+
+//--------------------------------------------------------------------------------------------------
+void status_post_levels(int pipeline, int channels, const float *peak, const float *rms, float loudness)
+{
+  unsigned pos;
+  status_event *e = queue_claim(&pos);
+
+  if (!e)
+    return;
+
+  if (channels > STATUS_MAX_CHANNELS)
+    channels = STATUS_MAX_CHANNELS;
+
+  e->type     = EV_LEVELS;
+  e->pipeline = pipeline;
+  e->channels = channels;
+  e->loudness = loudness;
+  memcpy(e->peak, peak, channels * sizeof(float));
+  memcpy(e->rms, rms, channels * sizeof(float));
+
+  queue_publish(e, pos);
+}
+
+//--------------------------------------------------------------------------------------------------
+// "[-3.0, -6.5]"
+static int format_db(char *buf, int size, const float *db, int n)
+{
+  int len = snprintf(buf, size, "[");
+
+  for (int i = 0; i < n && len < size; i++)
+    len += snprintf(buf + len, size - len, "%s%.1f", i ? ", " : "", db[i]);
+
+  if (len < size)
+    len += snprintf(buf + len, size - len, "]");
+
+  return len;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int format_levels(status_event *e, char *buf, int size)
+{
+  char peak[STATUS_MAX_CHANNELS * 10], rms[STATUS_MAX_CHANNELS * 10], loudness[32] = "";
+
+  format_db(peak, sizeof(peak), e->peak, e->channels);
+  format_db(rms, sizeof(rms), e->rms, e->channels);
+
+  if (!isnan(e->loudness))
+    snprintf(loudness, sizeof(loudness), ", \"loudness_lufs\":%.1f", e->loudness);
+
+  return snprintf(buf, size, "{\"event\":\"levels\", \"pipeline\":%d, \"channels\":%d, \"peak_db\":%s, \"rms_db\":%s%s}\n",
+    e->pipeline, e->channels, peak, rms, loudness);
+}
+
+static void client_send(status_client *c, const char *msg, int len);
+
+//--------------------------------------------------------------------------------------------------
+static int format_state(int p, char *buf, int size)
+{
+  status_state *st = &state[p];
+
+  return snprintf(buf, size,
+    "{\"event\":\"state\", \"pipeline\":%d, \"codec\":\"%s\", \"channels\":%d, \"channel_layout\":%llu, \"sample_rate\":%d, "
+    "\"service_type\":%d, \"latency_ms\":%d, \"latency_target_ms\":%d, \"xruns_in\":%u, \"xruns_out\":%u, "
+    "\"input_depth_ms\":%d, \"input_target_ms\":%d, \"input_lost\":%u, \"input_concealed\":%u, "
+    "\"rejected_sync\":%u, \"rejected_size\":%u, \"rejected_crc\":%u}\n",
+    p, st->codec, st->channels, (unsigned long long)st->channel_layout, st->sample_rate,
+    st->service_type, st->latency_ms, st->latency_target_ms, st->xruns_in, st->xruns_out,
+    st->input_depth_ms, st->input_target_ms, st->input_lost, st->input_concealed,
+    st->rejected[0], st->rejected[1], st->rejected[2]);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void send_state(status_client *c)
+{
+  char msg[STATUS_LINE_SIZE];
+
+  for (int p = 0; p < pipelines && c->fd >= 0; p++)
+    client_send(c, msg, format_state(p, msg, sizeof(msg)));
+}
+
+//--------------------------------------------------------------------------------------------------
+static void client_close(status_client *c)
+{
+  close(c->fd);
+  c->fd = -1;
+  c->inUsed = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void client_send(status_client *c, const char *msg, int len)
+{
+  // clients which can't keep up are dropped, never block the server
+  if (send(c->fd, msg, len, MSG_NOSIGNAL | MSG_DONTWAIT) != len)
+    client_close(c);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void broadcast(const char *msg, int len)
+{
+  for (int i = 0; i < STATUS_MAX_CLIENTS; i++)
+    if (clients[i].fd >= 0)
+      client_send(&clients[i], msg, len);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void drain_queue()
+{
+  char msg[STATUS_LINE_SIZE];
+  int len;
+
+  while (1)
+  {
+    status_event *e = &queue[queue_tail & (STATUS_QUEUE_SIZE - 1)];
+
+    if (atomic_load_explicit(&e->seq, memory_order_acquire) != queue_tail + 1)
+      break;
+
+    status_state *st = &state[e->pipeline];
+
+    switch (e->type)
+    {
+    case EV_CODEC:
+      st->codec          = e->codec;
+      st->channels       = e->channels;
+      st->channel_layout = e->channel_layout;
+      st->sample_rate    = e->sample_rate;
+      st->service_type   = e->service_type;
+
+      len = snprintf(msg, sizeof(msg),
+        "{\"event\":\"codec\", \"pipeline\":%d, \"codec\":\"%s\", \"channels\":%d, \"channel_layout\":%llu, \"sample_rate\":%d, \"service_type\":%d}\n",
+        e->pipeline, st->codec, st->channels, (unsigned long long)st->channel_layout, st->sample_rate, st->service_type);
+      break;
+
+    case EV_LATENCY:
+      st->latency_ms = e->value;
+      len = snprintf(msg, sizeof(msg), "{\"event\":\"latency\", \"pipeline\":%d, \"latency_ms\":%d}\n", e->pipeline, e->value);
+      break;
+
+    case EV_LATENCY_TARGET:
+      st->latency_target_ms = e->value;
+      len = snprintf(msg, sizeof(msg), "{\"event\":\"latency_target\", \"pipeline\":%d, \"target_ms\":%d}\n", e->pipeline, e->value);
+      break;
+
+    case EV_XRUN:
+      if (e->value)
+        st->xruns_out++;
+      else
+        st->xruns_in++;
+
+      len = snprintf(msg, sizeof(msg), "{\"event\":\"xrun\", \"pipeline\":%d, \"device\":\"%s\", \"count\":%u}\n",
+        e->pipeline, e->value ? "output" : "input", e->value ? st->xruns_out : st->xruns_in);
+      break;
+
+    case EV_INPUT:
+      st->input_depth_ms  = e->value;
+      st->input_target_ms = e->target;
+      st->input_lost      = e->lost;
+      st->input_concealed = e->concealed;
+
+      len = snprintf(msg, sizeof(msg),
+        "{\"event\":\"input\", \"pipeline\":%d, \"depth_ms\":%d, \"target_ms\":%d, \"lost\":%u, \"concealed\":%u}\n",
+        e->pipeline, e->value, e->target, e->lost, e->concealed);
+      break;
+
+    case EV_REJECTED:
+      memcpy(st->rejected, e->rejected, sizeof(st->rejected));
+
+      len = snprintf(msg, sizeof(msg),
+        "{\"event\":\"rejected\", \"pipeline\":%d, \"codec\":\"%s\", \"reason\":\"%s\", \"sync\":%u, \"size\":%u, \"crc\":%u}\n",
+        e->pipeline, e->codec, e->reason, e->rejected[0], e->rejected[1], e->rejected[2]);
+      break;
+
+    case EV_LEVELS:
+      len = format_levels(e, msg, sizeof(msg));
+      break;
+
+    default:
+      len = 0;
+    }
+
+    atomic_store_explicit(&e->seq, queue_tail + STATUS_QUEUE_SIZE, memory_order_release);
+    queue_tail++;
+
+    if (len > 0)
+      broadcast(msg, len);
+  }
+
+  unsigned dropped = atomic_exchange_explicit(&queue_dropped, 0, memory_order_relaxed);
+
+  if (dropped)
+    log_printf("status: %u events dropped, queue full\n", dropped);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void accept_client(int listen_fd)
+{
+  int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+  if (fd < 0)
+    return;
+
+  for (int i = 0; i < STATUS_MAX_CLIENTS; i++)
+  {
+    if (clients[i].fd < 0)
+    {
+      clients[i].fd = fd;
+      clients[i].inUsed = 0;
+      send_state(&clients[i]);
+      return;
+    }
+  }
+
+  log_printf("status: too many clients\n");
+  close(fd);
+}
+
+//--------------------------------------------------------------------------------------------------
+static void read_client(status_client *c)
+{
+  char msg[STATUS_LINE_SIZE];
+  int n = recv(c->fd, c->in + c->inUsed, sizeof(c->in) - 1 - c->inUsed, MSG_DONTWAIT);
+
+  if (n <= 0)
+  {
+    if (n == 0 || (errno != EAGAIN && errno != EINTR))
+      client_close(c);
+    return;
+  }
+
+  c->inUsed += n;
+  c->in[c->inUsed] = 0;
+
+  char *eol;
+
+  while (c->fd >= 0 && (eol = strchr(c->in, '\n')))
+  {
+    *eol = 0;
+
+    if (eol > c->in && eol[-1] == '\r')
+      eol[-1] = 0;
+
+    if (!strcmp(c->in, "state"))
+      send_state(c);
+    else if (c->in[0])
+      client_send(c, msg, control_command(c->in, msg, sizeof(msg)));
+
+    c->inUsed -= eol + 1 - c->in;
+    memmove(c->in, eol + 1, c->inUsed + 1);
+  }
+
+  // line too long, discard
+  if (c->inUsed >= (int)sizeof(c->in) - 1)
+    c->inUsed = 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+static void* status_thread_main(void *arg)
+{
+  struct pollfd fds[2 + STATUS_MAX_CLIENTS];
+
+  while (atomic_load(&status_running))
+  {
+    int n = 0;
+
+    if (tcp_fd >= 0)
+      fds[n++] = (struct pollfd){.fd = tcp_fd, .events = POLLIN};
+
+    if (unix_fd >= 0)
+      fds[n++] = (struct pollfd){.fd = unix_fd, .events = POLLIN};
+
+    int listeners = n;
+
+    for (int i = 0; i < STATUS_MAX_CLIENTS; i++)
+      if (clients[i].fd >= 0)
+        fds[n++] = (struct pollfd){.fd = clients[i].fd, .events = POLLIN};
+
+    if (poll(fds, n, poll_ms) > 0)
+    {
+      for (int i = 0; i < listeners; i++)
+        if (fds[i].revents & POLLIN)
+          accept_client(fds[i].fd);
+
+      for (int i = listeners; i < n; i++)
+      {
+        if (!fds[i].revents)
+          continue;
+
+        for (int c = 0; c < STATUS_MAX_CLIENTS; c++)
+          if (clients[c].fd == fds[i].fd)
+            read_client(&clients[c]);
+      }
+    }
+
+    drain_queue();
+  }
+
+  return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int listen_tcp(int port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if (fd < 0)
+    return -1;
+
+  int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  struct sockaddr_in saddr;
+  memset(&saddr, 0, sizeof(saddr));
+  saddr.sin_family = AF_INET;
+  saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  saddr.sin_port = htons(port);
+
+  if (bind(fd, (struct sockaddr*) &saddr, sizeof(saddr)) < 0 || listen(fd, 4) < 0)
+  {
+    log_printf("status: cannot listen on tcp port %d: %s\n", port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+//--------------------------------------------------------------------------------------------------
+static int listen_unix(const char *path)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if (fd < 0)
+    return -1;
+
+  struct sockaddr_un saddr;
+  memset(&saddr, 0, sizeof(saddr));
+  saddr.sun_family = AF_UNIX;
+  snprintf(saddr.sun_path, sizeof(saddr.sun_path), "%s", path);
+
+  unlink(path);
+
+  if (bind(fd, (struct sockaddr*) &saddr, sizeof(saddr)) < 0 || listen(fd, 4) < 0)
+  {
+    log_printf("status: cannot listen on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  snprintf(unix_name, sizeof(unix_name), "%s", path);
+
+  return fd;
+}
+
+//--------------------------------------------------------------------------------------------------
+void status_set_interval(int ms)
+{
+  poll_ms = ms > 0 ? ms : STATUS_POLL_MS;
+}
+
+//--------------------------------------------------------------------------------------------------
+void status_init(int npipelines, int tcp_port, const char *unix_path)
+{
+  pipelines = npipelines;
+
+  for (int p = 0; p < STATUS_MAX_PIPELINES; p++)
+    state[p] = (status_state){.codec = "none", .service_type = -1, .input_depth_ms = -1};
+
+  for (int i = 0; i < STATUS_MAX_CLIENTS; i++)
+    clients[i].fd = -1;
+
+  for (unsigned i = 0; i < STATUS_QUEUE_SIZE; i++)
+    atomic_init(&queue[i].seq, i);
+
+  if (tcp_port)
+    tcp_fd = listen_tcp(tcp_port);
+
+  if (unix_path)
+    unix_fd = listen_unix(unix_path);
+
+  if (tcp_fd < 0 && unix_fd < 0)
+    return;
+
+  atomic_store(&status_running, 1);
+
+  if (pthread_create(&status_thread, NULL, status_thread_main, NULL) != 0)
+  {
+    atomic_store(&status_running, 0);
+    log_printf("status: cannot create thread\n");
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+void status_deinit()
+{
+  if (atomic_exchange(&status_running, 0))
+    pthread_join(status_thread, NULL);
+
+  for (int i = 0; i < STATUS_MAX_CLIENTS; i++)
+    if (clients[i].fd >= 0)
+      client_close(&clients[i]);
+
+  if (tcp_fd >= 0)
+    close(tcp_fd);
+
+  if (unix_fd >= 0)
+  {
+    close(unix_fd);
+    unlink(unix_name);
+  }
+
+  tcp_fd = unix_fd = -1;
+}
@@ -0,0 +1,48 @@
+/*
+ * status.h
+ *
+ * Status/event server. Clients connect via TCP or unix socket, receive the
+ * current state as one JSON line per pipeline on connect and then one JSON
+ * line per event, tagged with the pipeline. Sending "state\n" requests the current state again, all other lines
+ * are control commands (see control.h).
+ *
+ * The post functions only push into a lock-free queue and never block, they
+ * are safe to call from the audio path.
+ */
+
+#ifndef STATUS_H_
+#define STATUS_H_
+
+#include <stdint.h>
+
+#define STATUS_DEFAULT_PORT  8788  // 8787 is where older versions pushed to, listeners may still hold it
+#define STATUS_QUEUE_SIZE    256   // events, must be a power of 2
+#define STATUS_MAX_CLIENTS   16
+#define STATUS_MAX_PIPELINES 8
+
+// queued events are sent every ms (default 20), longer saves wakeups. Before status_init().
+void status_set_interval(int ms);
+
+// tcp_port 0 disables tcp, unix_path NULL disables the unix socket
+void status_init(int pipelines, int tcp_port, const char *unix_path);
+void status_deinit();
+
+// codec must be a static string (e.g. from avcodec_get_name)
+void status_post_codec(int pipeline, const char *codec, int channels, uint64_t channel_layout, int sample_rate, int service_type);
+void status_post_latency(int pipeline, int ms);
+void status_post_xrun(int pipeline, int output);
+
+// output delay at which frames are dropped, moves with -a
+void status_post_latency_target(int pipeline, int ms);
+
+// a corrupt burst was dropped before decoding, reason "sync", "size" or "crc" (static strings) and
+// the rejections per reason since start
+void status_post_rejected(int pipeline, const char *codec, const char *reason, unsigned sync, unsigned size, unsigned crc);
+
+// output levels per channel in dBFS, loudness in LUFS or NAN. Events only, not part of the state.
+void status_post_levels(int pipeline, int channels, const float *peak, const float *rms, float loudness);
+
+// network input jitter buffer, packets lost and bursts concealed since start
+void status_post_input(int pipeline, int depth_ms, int target_ms, unsigned lost, unsigned concealed);
+
+#endif /* STATUS_H_ */
@@ -0,0 +1,153 @@
+/*
+ * transition.c
+ *
+ * Stream transition statistics, see transition.h
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <libavcodec/avcodec.h>
+
+#include "transition.h"
+#include "log.h"
+
+typedef struct {
+  int from_codec, from_channels;
+  int to_codec, to_channels;
+  double start;                  // first sight of the new format / restart, ms
+  double first_output;           // ms after start, < 0 while pending
+  double lost_ms;                // input between start and the first burst played
+  double stage_ms[TRANSITION_STAGES];
+} transition;
+
+int transition_stats = 0;
+
+static transition transitions[TRANSITION_MAX];
+static int transition_count = 0;
+static transition *active = NULL;
+
+static int cur_codec = -1, cur_channels = 0;
+static double pending_start = -1;
+static double pending_stage_ms[TRANSITION_STAGES];
+
+//--------------------------------------------------------------------------------------------------
+static const char* format_name(int codec, int channels, char *buf, int size)
+{
+  if (codec < 0)
+    snprintf(buf, size, "start");
+  else
+    snprintf(buf, size, "%s %dch", codec ? avcodec_get_name(codec) : "pcm", channels);
+
+  return buf;
+}
+
+//--------------------------------------------------------------------------------------------------
+void transition_restart(double now)
+{
+  if (!transition_stats)
+    return;
+
+  if (pending_start < 0)
+    pending_start = now;
+}
+
+//--------------------------------------------------------------------------------------------------
+void transition_format(int codec, int channels, double read_time)
+{
+  if (!transition_stats)
+    return;
+
+  int changed = codec != cur_codec || channels != cur_channels;
+
+  if (changed || pending_start >= 0)
+  {
+    if (transition_count < TRANSITION_MAX)
+    {
+      active = &transitions[transition_count++];
+      memset(active, 0, sizeof(transition));
+
+      active->from_codec    = cur_codec;
+      active->from_channels = cur_channels;
+      active->to_codec      = codec;
+      active->to_channels   = channels;
+      active->start         = pending_start >= 0 && pending_start < read_time ? pending_start : read_time;
+      active->first_output  = -1;
+
+      memcpy(active->stage_ms, pending_stage_ms, sizeof(pending_stage_ms));
+    }
+    else
+      active = NULL;
+  }
+
+  cur_codec = codec;
+  cur_channels = channels;
+  pending_start = -1;
+  memset(pending_stage_ms, 0, sizeof(pending_stage_ms));
+}
+
+//--------------------------------------------------------------------------------------------------
+void transition_stage(int stage, double ms)
+{
+  if (!transition_stats)
+    return;
+
+  if (active && active->first_output < 0)
+    active->stage_ms[stage] += ms;
+  else
+    pending_stage_ms[stage] += ms;
+}
+
+//--------------------------------------------------------------------------------------------------
+void transition_output(double read_time, double now)
+{
+  if (!transition_stats || !active || active->first_output >= 0)
+    return;
+
+  active->first_output = now - active->start;
+  active->lost_ms = read_time > active->start ? read_time - active->start : 0;
+  active = NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+void transition_report()
+{
+  char from[32], to[32];
+  double sum = 0, max = 0;
+  int n = 0;
+
+  if (!transition_stats)
+    return;
+
+  log_report("transitions: %d\n", transition_count);
+  log_report("  %-26s %10s %10s %10s %10s %10s %10s\n",
+    "transition", "first out", "lost", "sink open", "initCtx", "loadCodec", "src reset");
+
+  for (int i = 0; i < transition_count; i++)
+  {
+    transition *t = &transitions[i];
+
+    format_name(t->from_codec, t->from_channels, from, sizeof(from));
+    format_name(t->to_codec, t->to_channels, to, sizeof(to));
+
+    if (t->first_output < 0)
+    {
+      log_report("  %11s > %-12s  no output\n", from, to);
+      continue;
+    }
+
+    log_report("  %11s > %-12s %7.1f ms %5d smpl %7.1f ms %7.1f ms %7.1f ms %7.1f ms\n",
+      from, to, t->first_output, (int)(t->lost_ms * 48),
+      t->stage_ms[TRANSITION_STAGE_SINK_OPEN], t->stage_ms[TRANSITION_STAGE_INIT_CONTEXT],
+      t->stage_ms[TRANSITION_STAGE_LOAD_CODEC], t->stage_ms[TRANSITION_STAGE_SOURCE_RESET]);
+
+    sum += t->first_output;
+    n++;
+
+    if (t->first_output > max)
+      max = t->first_output;
+  }
+
+  if (n)
+    log_report("  first output: average %.1f ms, max %.1f ms\n", sum / n, max);
+}
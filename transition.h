@@ -0,0 +1,39 @@
+/*
+ * transition.h
+ *
+ * Stream transition statistics (-T). Every format change of the input
+ * (PCM <> codec, codec change, channel count change) and every restart is
+ * recorded with the time from the first sight of the new format to the first
+ * sample of it written to the output, the input lost meanwhile and the time
+ * spent in the expensive setup stages. A report is logged at exit.
+ */
+
+#ifndef TRANSITION_H_
+#define TRANSITION_H_
+
+#define TRANSITION_MAX 256
+
+enum {
+  TRANSITION_STAGE_SINK_OPEN,
+  TRANSITION_STAGE_INIT_CONTEXT,
+  TRANSITION_STAGE_LOAD_CODEC,
+  TRANSITION_STAGE_SOURCE_RESET,
+  TRANSITION_STAGES
+};
+
+extern int transition_stats;
+
+// a restart was triggered, the new format is not known yet
+void transition_restart(double now);
+
+// format of the burst read at read_time, codec 0 = PCM
+void transition_format(int codec, int channels, double read_time);
+
+void transition_stage(int stage, double ms);
+
+// burst read at read_time was written to the output
+void transition_output(double read_time, double now);
+
+void transition_report();
+
+#endif /* TRANSITION_H_ */